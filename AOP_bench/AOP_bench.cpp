@@ -0,0 +1,108 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#include "Bench.hpp"
+#include "AOP_src/AOP.hpp"
+#include "AOP_src/CallSiteRegistry.hpp"
+
+#include <cstring>
+
+/*
+ * 用法：AOP_bench [--quick] [group...]
+ * 不指定 group 时运行全部测试组，--quick 会缩短每轮的测量时间（结果噪声更大）。
+ * 调用点的代码体积和内联情况可以通过构建 AOP_bench_sizes 目标查看。
+ */
+
+namespace {
+
+    struct Group {
+        const char* name;
+        void (*run)();
+    };
+
+    const Group groups[] = {
+        { "invoke", Bench::invoke_bench },
+        { "location", Bench::location_bench },
+        { "error", Bench::error_bench },
+        { "memoize", Bench::memoize_bench },
+        { "latency", Bench::latency_bench },
+        { "parallel", Bench::parallel_bench },
+    };
+
+#ifdef AOP_WILL_USE_SOURCE_LOCATION
+    /// 与 AOP::invoke 中对 AOPthreadLoc 的保存、重置、恢复完全相同的操作。
+    BENCH_SITE void location_save_restore_site() {
+        Base::SourceLocation save = Base::AOPthreadLoc;
+        Base::AOPthreadLoc = Base::SourceLocation();
+        Bench::clobber_memory();
+        Base::AOPthreadLoc = save;
+    }
+
+    /// 被调用函数开头的 AOP_FUN_MARK（AOPthreadLoc 处于 unknown 状态时）。
+    BENCH_SITE void location_mark_site() {
+        Base::AOPthreadLoc = Base::SourceLocation();
+        AOP_FUN_MARK
+        Bench::clobber_memory();
+    }
+#endif
+
+    BENCH_SITE void empty_site() {
+        Bench::clobber_memory();
+    }
+
+    /// 被调用函数开头的 AOP_CALL_SITE_MARK（定义 AOP_CALL_SITE_STATS 时 AOP_FUN_MARK 额外产生的开销）。
+    BENCH_SITE void call_site_mark_site() {
+        AOP_CALL_SITE_MARK
+        Bench::clobber_memory();
+    }
+
+}
+
+void Bench::location_bench() {
+#ifdef AOP_WILL_USE_SOURCE_LOCATION
+    print_header("AOPthreadLoc cost (AOP_WILL_USE_SOURCE_LOCATION on)");
+    Result empty = measure("empty call", [] { empty_site(); });
+    print(empty);
+    print(measure("save/reset/restore in invoke", [] { location_save_restore_site(); }), empty);
+    print(measure("reset + AOP_FUN_MARK", [] { location_mark_site(); }), empty);
+#else
+    print_header("AOPthreadLoc cost (AOP_WILL_USE_SOURCE_LOCATION off)");
+    Result empty = measure("empty call", [] { empty_site(); });
+    print(empty);
+    std::printf("%s\n", "AOPthreadLoc is compiled out, compare invoke rows with AOP_bench_thread_loc.");
+#endif
+    print(measure("AOP_CALL_SITE_MARK (CallSiteRegistry)", [] { call_site_mark_site(); }), empty);
+}
+
+int main(int argc, char** argv) {
+    bool selected[sizeof(groups) / sizeof(Group)] = {};
+    bool any = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--quick") == 0) {
+            Bench::config().round_time = std::chrono::milliseconds(2);
+            Bench::config().rounds = 3;
+            continue;
+        }
+        bool found = false;
+        for (std::size_t g = 0; g < sizeof(groups) / sizeof(Group); ++g) {
+            if (std::strcmp(argv[i], groups[g].name) == 0)
+                selected[g] = found = any = true;
+        }
+        if (!found) {
+            std::fprintf(stderr, "unknown group: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+#ifdef AOP_WILL_USE_SOURCE_LOCATION
+    std::printf("AOP_WILL_USE_SOURCE_LOCATION: on\n");
+#else
+    std::printf("AOP_WILL_USE_SOURCE_LOCATION: off\n");
+#endif
+    for (std::size_t g = 0; g < sizeof(groups) / sizeof(Group); ++g) {
+        if (!any || selected[g])
+            groups[g].run();
+    }
+    return 0;
+}
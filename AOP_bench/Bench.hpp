@@ -0,0 +1,145 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#ifdef BENCH_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/// 用于标记被测的调用点，保证它们以独立符号存在，便于通过 AOP_bench_sizes 查看代码体积和内联情况。
+#if defined(__clang__) || defined(__GNUC__)
+#define BENCH_SITE __attribute__((noinline))
+#else
+#define BENCH_SITE
+#endif
+
+/// 一个简单的微基准测试框架，AOP_bench 的各组测试都基于它。
+namespace Bench {
+
+    /// 读取时间戳计数器，x86 上为 rdtsc（参考周期），其他平台退化为 steady_clock 的纳秒数。
+    inline std::uint64_t cycles() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    /// 阻止编译器把 value 的计算优化掉。
+    template <typename T>
+    inline void do_not_optimize(T &&value) {
+#if defined(__clang__) || defined(__GNUC__)
+        asm volatile("" : : "r,m"(value) : "memory");
+#else
+        static volatile auto sink = value;
+        sink = value;
+#endif
+    }
+
+    /// 阻止编译器跨越该点合并或删除内存读写。
+    inline void clobber_memory() {
+#if defined(__clang__) || defined(__GNUC__)
+        asm volatile("" : : : "memory");
+#endif
+    }
+
+    /// 一次测量的结果，均为单次调用的平均值（取多轮中的最小值）。
+    struct Result {
+        std::string name;
+        double cycles = 0;
+        double nanos = 0;
+    };
+
+    /// 全局配置，由 main 根据命令行参数设置。
+    struct Config {
+        /// 单轮测量的目标时长。
+        std::chrono::nanoseconds round_time = std::chrono::milliseconds(20);
+        /// 测量轮数。
+        int rounds = 5;
+    };
+
+    inline Config &config() {
+        static Config config;
+        return config;
+    }
+
+    /// 反复运行 fun，直到单轮耗时达到 Config::round_time，然后多轮测量取最小值。
+    template <typename Fun>
+    Result measure(std::string name, Fun &&fun) {
+        using Clock = std::chrono::steady_clock;
+        std::size_t iterations = 1;
+        for (;;) {
+            auto begin = Clock::now();
+            for (std::size_t i = 0; i < iterations; ++i)
+                fun();
+            if (Clock::now() - begin >= config().round_time / 4 || iterations >= (std::size_t(1) << 32))
+                break;
+            iterations *= 2;
+        }
+        iterations *= 4;
+
+        Result result { std::move(name), std::numeric_limits<double>::max(),
+                        std::numeric_limits<double>::max() };
+        for (int round = 0; round < config().rounds; ++round) {
+            auto begin = Clock::now();
+            std::uint64_t c0 = cycles();
+            for (std::size_t i = 0; i < iterations; ++i)
+                fun();
+            std::uint64_t c1 = cycles();
+            auto end = Clock::now();
+            double c = double(c1 - c0) / double(iterations);
+            double n = double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count())
+                / double(iterations);
+            if (c < result.cycles) result.cycles = c;
+            if (n < result.nanos) result.nanos = n;
+        }
+        return result;
+    }
+
+    /// 打印一组测试的标题和表头。
+    inline void print_header(const char* title) {
+        std::printf("\n== %s ==\n", title);
+        std::printf("%-56s %12s %10s %12s\n", "case", "cycles/call", "ns/call", "overhead");
+    }
+
+    /// 打印一行结果，overhead 为相对 baseline 多出的周期数。
+    inline void print(const Result &result, const Result &baseline) {
+        std::printf("%-56s %12.2f %10.2f %+12.2f\n", result.name.c_str(),
+                    result.cycles, result.nanos, result.cycles - baseline.cycles);
+    }
+
+    inline void print(const Result &result) {
+        std::printf("%-56s %12.2f %10.2f %12s\n", result.name.c_str(),
+                    result.cycles, result.nanos, "-");
+    }
+
+    /// 各组测试，定义在对应的源文件中。
+    void invoke_bench();
+
+    void location_bench();
+
+    void error_bench();
+
+    void memoize_bench();
+
+    void latency_bench();
+
+    void parallel_bench();
+
+}
+
+#endif
+
+#endif //BENCH_HPP
@@ -0,0 +1,243 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#include "Bench.hpp"
+#include "AOP_src/AOP.hpp"
+
+#include <exception>
+#include <optional>
+#include <tuple>
+#include <utility>
+
+using namespace Base;
+
+namespace {
+
+    /// 以返回值表示失败的目标函数，x 为奇数时失败。
+    BENCH_SITE std::optional<int> parse(int x) {
+        Bench::clobber_memory();
+        if (x & 1) return std::nullopt;
+        return x;
+    }
+
+    template <std::size_t I>
+    struct ResultHook {
+        void error(const std::optional<int> &) { ++count; };
+
+        void error(const std::exception_ptr &) { ++count; };
+
+        unsigned count = 0;
+    };
+
+    template <std::size_t...I>
+    AOP<AOP_ResultErrors<>, ResultHook<I>...> make_result_aop(std::index_sequence<I...>);
+
+    template <std::size_t N>
+    using ResultAOP = decltype(make_result_aop(std::make_index_sequence<N>()));
+
+    BENCH_SITE int direct_result_site(int x) {
+        std::optional<int> result = parse(x);
+        return result ? *result : -1;
+    }
+
+    template <typename A>
+    BENCH_SITE int aop_result_site(A &aop, int x) {
+        std::optional<int> result = aop.invoke(parse, x);
+        return result ? *result : -1;
+    }
+
+#ifdef AOP_HAS_EXCEPTIONS
+    struct Failure {
+        int code;
+    };
+
+    struct StdFailure : std::exception {
+        explicit StdFailure(int code) : code(code) {};
+
+        int code;
+    };
+
+    /// 总是抛出异常的目标函数。
+    BENCH_SITE int thrower(int x) {
+        Bench::clobber_memory();
+        if (x >= 0) throw Failure { x };
+        return x;
+    }
+
+    BENCH_SITE int std_thrower(int x) {
+        Bench::clobber_memory();
+        if (x >= 0) throw StdFailure(x);
+        return x;
+    }
+
+    template <std::size_t I>
+    struct ErrorHook {
+        void error(const std::exception_ptr &) { ++count; };
+
+        unsigned count = 0;
+    };
+
+    /// 只处理指定类型异常的 aspect，不会创建 exception_ptr。Failure 不是 std::exception 的派生类，需要通过 error_types 声明。
+    template <std::size_t I>
+    struct TypedHook {
+        using error_types = std::tuple<Failure>;
+
+        void error(const Failure &) { ++count; };
+
+        unsigned count = 0;
+    };
+
+    template <std::size_t I>
+    struct StdTypedHook {
+        void error(const StdFailure &) { ++count; };
+
+        unsigned count = 0;
+    };
+
+    template <template <std::size_t> class H, typename Seq>
+    struct Make;
+
+    template <template <std::size_t> class H, std::size_t...I>
+    struct Make<H, std::index_sequence<I...>> {
+        using Aop = AOP<H<I>...>;
+    };
+
+    template <std::size_t N, template <std::size_t> class H = ErrorHook>
+    using ErrorAOP = typename Make<H, std::make_index_sequence<N>>::Aop;
+
+    /// 模拟旧的实现：每个存在 error() 的 aspect 各自一层 try/catch，异常被捕获并重新抛出 N 次。
+    template <std::size_t I, std::size_t N>
+    BENCH_SITE int nested_rethrow(unsigned* counts, int x) {
+        try {
+            if constexpr (I + 1 < N)
+                return nested_rethrow<I + 1, N>(counts, x);
+            else
+                return thrower(x);
+        } catch (...) {
+            std::exception_ptr error = std::current_exception();
+            Bench::do_not_optimize(error);
+            ++counts[I];
+            throw;
+        }
+    }
+
+//------------------------------------------------------------------------------------------------
+
+    BENCH_SITE int direct_site(int x) {
+        try {
+            return thrower(x);
+        } catch (const Failure &failure) {
+            return failure.code;
+        }
+    }
+
+    template <std::size_t N>
+    BENCH_SITE int nested_site(unsigned* counts, int x) {
+        try {
+            return nested_rethrow<0, N>(counts, x);
+        } catch (const Failure &failure) {
+            return failure.code;
+        }
+    }
+
+    template <typename A>
+    BENCH_SITE int aop_site(A &aop, int x) {
+        try {
+            return aop.invoke(thrower, x);
+        } catch (const Failure &failure) {
+            return failure.code;
+        }
+    }
+
+    BENCH_SITE int direct_std_site(int x) {
+        try {
+            return std_thrower(x);
+        } catch (const StdFailure &failure) {
+            return failure.code;
+        }
+    }
+
+    template <typename A>
+    BENCH_SITE int aop_std_site(A &aop, int x) {
+        try {
+            return aop.invoke(std_thrower, x);
+        } catch (const StdFailure &failure) {
+            return failure.code;
+        }
+    }
+
+#endif
+
+//------------------------------------------------------------------------------------------------
+
+    template <typename Site>
+    Bench::Result run(std::string name, Site &&site) {
+        int x = 1;
+        return Bench::measure(std::move(name), [&] {
+            x = site(x) & 0xff;
+            Bench::do_not_optimize(x);
+        });
+    }
+
+    template <std::size_t N>
+    void result_rows(const Bench::Result &baseline) {
+        ResultAOP<N> aop;
+        Bench::print(run("AOP::invoke AOP_ResultErrors N=" + std::to_string(N),
+                         [&](int x) { return aop_result_site(aop, x + 1); }), baseline);
+    }
+
+#ifdef AOP_HAS_EXCEPTIONS
+    template <std::size_t N>
+    void error_rows(const Bench::Result &baseline) {
+        unsigned counts[N] = {};
+        ErrorAOP<N> aop;
+        Bench::print(run("nested rethrow N=" + std::to_string(N),
+                         [&](int x) { return nested_site<N>(counts, x); }), baseline);
+        Bench::print(run("AOP::invoke N=" + std::to_string(N),
+                         [&](int x) { return aop_site(aop, x); }), baseline);
+        ErrorAOP<N, TypedHook> typed_aop;
+        Bench::print(run("AOP::invoke N=" + std::to_string(N) + " error(const Failure &)",
+                         [&](int x) { return aop_site(typed_aop, x); }), baseline);
+    }
+
+    template <std::size_t N>
+    void std_error_rows(const Bench::Result &baseline) {
+        ErrorAOP<N> aop;
+        Bench::print(run("AOP::invoke N=" + std::to_string(N),
+                         [&](int x) { return aop_std_site(aop, x); }), baseline);
+        ErrorAOP<N, StdTypedHook> typed_aop;
+        Bench::print(run("AOP::invoke N=" + std::to_string(N) + " error(const StdFailure &)",
+                         [&](int x) { return aop_std_site(typed_aop, x); }), baseline);
+    }
+
+#endif
+
+}
+
+void Bench::error_bench() {
+    print_header("failure returned as std::optional, every other call fails");
+    Result direct_result = run("direct call (N=0)", [](int x) { return direct_result_site(x + 1); });
+    print(direct_result);
+    result_rows<1>(direct_result);
+    result_rows<4>(direct_result);
+    result_rows<16>(direct_result);
+
+#ifdef AOP_HAS_EXCEPTIONS
+    print_header("throw through N error() aspects (nested rethrow = previous implementation)");
+    Result direct = run("direct throw/catch (N=0)", [](int x) { return direct_site(x); });
+    print(direct);
+    error_rows<1>(direct);
+    error_rows<4>(direct);
+    error_rows<16>(direct);
+
+    print_header("throw a std::exception through N error() aspects");
+    Result direct_std = run("direct throw/catch (N=0)", [](int x) { return direct_std_site(x); });
+    print(direct_std);
+    std_error_rows<1>(direct_std);
+    std_error_rows<4>(direct_std);
+    std_error_rows<16>(direct_std);
+#else
+    std::printf("%s\n", "exceptions are disabled, only the result channel is measured.");
+#endif
+}
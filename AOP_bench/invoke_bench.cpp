@@ -0,0 +1,477 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#include "Bench.hpp"
+#include "AOP_src/AOP.hpp"
+#include "AOP_src/DynamicAspect.hpp"
+#include "AOP_src/Sampled.hpp"
+#include "AOP_src/Switchable.hpp"
+
+#include <exception>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+using namespace Base;
+
+namespace {
+
+    /// 被织入的目标函数，禁止内联以保留一次真实的调用。
+    BENCH_SITE int target(int x) {
+        Bench::clobber_memory();
+        return x + 1;
+    }
+
+    class Service {
+    public:
+        BENCH_SITE int fun(int x) { return value += x; };
+
+        BENCH_SITE int fun(int x) const { return value + x; };
+
+    private:
+        int value = 0;
+    };
+
+    /// 复制代价很高的对象，用于检查通过成员指针调用时是否复制了目标对象。
+    class Large {
+    public:
+        Large() = default;
+
+        Large(const Large &other) : value(other.value) { ++copies; };
+
+        BENCH_SITE int fun(int x) { return value += x; };
+
+        static inline std::size_t copies = 0;
+
+    private:
+        int value = 0;
+        char payload[4096] {};
+    };
+
+    /// 只有 before()/after() 的 aspect，模板参数用于生成互不相同的类型。
+    template <std::size_t I>
+    struct Hook {
+        void before() { ++count; };
+
+        void after() { ++count; };
+
+        void before() const { ++count; };
+
+        void after() const { ++count; };
+
+        mutable unsigned count = 0;
+    };
+
+    /// 额外带有 error() 的 aspect。
+    template <std::size_t I>
+    struct ErrorHook : Hook<I> {
+        void error(const std::exception_ptr &) { ++this->count; };
+
+        void error(const std::exception_ptr &) const { ++this->count; };
+    };
+
+    /// 使用 before(const int &) 和 after(const int &) 的 aspect，参数和返回值以引用的方式传入。
+    template <std::size_t I>
+    struct ArgHook {
+        void before(const int &x) { count += x; };
+
+        void after(const int &result) { count += result; };
+
+        void before(const int &x) const { count += x; };
+
+        void after(const int &result) const { count += result; };
+
+        mutable unsigned count = 0;
+    };
+
+    /// 使用 before(const InvocationContext &) 和 after(const InvocationContext &) 的 aspect。
+    template <std::size_t I>
+    struct ContextHook {
+        void before(const InvocationContext &context) { count += context.depth; };
+
+        void after(const InvocationContext &context) { count += context.location.line(); };
+
+        void before(const InvocationContext &context) const { count += context.depth; };
+
+        void after(const InvocationContext &context) const { count += context.location.line(); };
+
+        mutable unsigned count = 0;
+    };
+
+    /// 直接调用 next() 的 around()，用于测量 around 链本身的开销。
+    template <std::size_t I>
+    struct AroundHook {
+        template <typename Next>
+        decltype(auto) around(Next &next, const int &) { return next(); };
+
+        template <typename Next>
+        decltype(auto) around(Next &next, const int &) const { return next(); };
+    };
+
+    /// 不调用 next() 而直接返回结果的 around()。
+    template <std::size_t I>
+    struct ShortCircuitHook {
+        template <typename Next>
+        int around(Next &, const int &x) { return x + 1; };
+
+        template <typename Next>
+        int around(Next &, const int &x) const { return x + 1; };
+    };
+
+    /// 可以在运行时关闭的 Hook。
+    template <std::size_t I>
+    using SwitchHook = Switchable<Hook<I>>;
+
+    /// 每 64 次调用运行一次的 Hook。
+    template <std::size_t I>
+    using EveryHook = Sampled<Hook<I>, SampleEvery<64>>;
+
+    /// 平均每 64 次调用运行一次的 Hook。
+    template <std::size_t I>
+    using RandomHook = Sampled<Hook<I>, SampleRandom<64>>;
+
+    /// pointcut_rows 中标记调用的标签。
+    struct Woven {};
+
+    /// 只作用于带有 Woven 标签的调用的 Hook。
+    template <std::size_t I>
+    struct TaggedHook : Hook<I> {
+        using pointcut = AOP_Tagged<Woven>;
+    };
+
+    template <template <std::size_t> class H, typename Seq>
+    struct Make;
+
+    template <template <std::size_t> class H, std::size_t...I>
+    struct Make<H, std::index_sequence<I...>> {
+        using Aop = AOP<H<I>...>;
+        using Wrapper = AOP_Wrapper<Service, H<I>...>;
+        using Object = AOP_Object<Service, H<I>...>;
+    };
+
+    /// 由 N 个互不相同的 H<I> 组成的 AOP 类型族。
+    template <template <std::size_t> class H, std::size_t N>
+    using Weave = Make<H, std::make_index_sequence<N>>;
+
+    template <typename T>
+    using MemberFun = std::conditional_t<std::is_const_v<T>,
+                                         int (Service::*)(int) const, int (Service::*)(int)>;
+
+//------------------------------------------------------------------------------------------------
+
+    BENCH_SITE int direct_site(int x) {
+        return target(x);
+    }
+
+    template <typename S>
+    BENCH_SITE int direct_member_site(S &service, int x) {
+        return service.fun(x);
+    }
+
+    template <typename A>
+    BENCH_SITE int aop_site(A &aop, int x) {
+        return aop.invoke(target, x);
+    }
+
+    template <typename A>
+    BENCH_SITE int tagged_site(A &aop, int x) {
+        return aop.invoke(AOP_tag<Woven>(target), x);
+    }
+
+    template <typename W>
+    BENCH_SITE int wrapper_site(W &wrapper, int x) {
+        return wrapper.invoke(static_cast<MemberFun<W>>(&Service::fun), x);
+    }
+
+    /// 被调用者为编译期常量的 invoke<Sig, Fun>。
+    template <typename W>
+    BENCH_SITE int wrapper_constant_site(W &wrapper, int x) {
+        return wrapper.template invoke<MemberFun<W>, &Service::fun>(x);
+    }
+
+    template <typename W>
+    BENCH_SITE int wrapper_agent_site(W &wrapper, int x) {
+        return AOP_Wrapper_Agent(wrapper, fun, x);
+    }
+
+    template <typename O>
+    BENCH_SITE int object_site(O &object, int x) {
+        return object.invoke(static_cast<MemberFun<O>>(&Service::fun), x);
+    }
+
+    template <typename O>
+    BENCH_SITE int object_agent_site(O &object, int x) {
+        return AOP_Object_Agent(object, fun, x);
+    }
+
+    BENCH_SITE int direct_large_site(Large &large, int x) {
+        return large.fun(x);
+    }
+
+    template <typename A, typename Object>
+    BENCH_SITE int large_site(A &aop, Object &&object, int x) {
+        return aop.invoke(&Large::fun, std::forward<Object>(object), x);
+    }
+
+//------------------------------------------------------------------------------------------------
+
+    template <typename Site>
+    Bench::Result run(std::string name, Site &&site) {
+        int x = 1;
+        return Bench::measure(std::move(name), [&] {
+            x = site(x) & 0xff;
+            Bench::do_not_optimize(x);
+        });
+    }
+
+    std::string label(const char* kind, std::size_t n, bool is_const, bool with_error = false) {
+        return std::string(kind) + " N=" + std::to_string(n) + (is_const ? " const" : "")
+            + (with_error ? " +error" : "");
+    }
+
+    template <template <std::size_t> class H, std::size_t N>
+    void aop_rows(const Bench::Result &baseline, bool with_error) {
+        typename Weave<H, N>::Aop aop;
+        const auto &const_aop = aop;
+        Bench::print(run(label("AOP::invoke", N, false, with_error),
+                         [&](int x) { return aop_site(aop, x); }), baseline);
+        Bench::print(run(label("AOP::invoke", N, true, with_error),
+                         [&](int x) { return aop_site(const_aop, x); }), baseline);
+    }
+
+    template <std::size_t N>
+    void member_rows(const Bench::Result &baseline) {
+        Service service;
+        typename Weave<Hook, N>::Wrapper wrapper { service };
+        const auto &const_wrapper = wrapper;
+        typename Weave<Hook, N>::Object object { typename Weave<Hook, N>::Aop() };
+        const auto &const_object = object;
+
+        Bench::print(run(label("AOP_Wrapper::invoke", N, false),
+                         [&](int x) { return wrapper_site(wrapper, x); }), baseline);
+        Bench::print(run(label("AOP_Wrapper::invoke", N, true),
+                         [&](int x) { return wrapper_site(const_wrapper, x); }), baseline);
+        Bench::print(run(label("AOP_Wrapper_Agent", N, false),
+                         [&](int x) { return wrapper_agent_site(wrapper, x); }), baseline);
+        Bench::print(run(label("AOP_Wrapper_Agent", N, true),
+                         [&](int x) { return wrapper_agent_site(const_wrapper, x); }), baseline);
+        Bench::print(run(label("AOP_Object::invoke", N, false),
+                         [&](int x) { return object_site(object, x); }), baseline);
+        Bench::print(run(label("AOP_Object::invoke", N, true),
+                         [&](int x) { return object_site(const_object, x); }), baseline);
+        Bench::print(run(label("AOP_Object_Agent", N, false),
+                         [&](int x) { return object_agent_site(object, x); }), baseline);
+        Bench::print(run(label("AOP_Object_Agent", N, true),
+                         [&](int x) { return object_agent_site(const_object, x); }), baseline);
+    }
+
+    template <std::size_t...N>
+    void all_aop_rows(const Bench::Result &baseline, std::index_sequence<N...>) {
+        (aop_rows<Hook, N>(baseline, false), ...);
+        (aop_rows<ErrorHook, N>(baseline, true), ...);
+    }
+
+    template <std::size_t N>
+    void arg_rows(const Bench::Result &baseline) {
+        typename Weave<ArgHook, N>::Aop aop;
+        Service service;
+        typename Weave<ArgHook, N>::Wrapper wrapper { service };
+        Bench::print(run("AOP::invoke N=" + std::to_string(N) + " before(args)/after(result)",
+                         [&](int x) { return aop_site(aop, x); }), baseline);
+        Bench::print(run("AOP_Wrapper::invoke N=" + std::to_string(N) + " before(args)/after(result)",
+                         [&](int x) { return wrapper_site(wrapper, x); }), baseline);
+    }
+
+    template <std::size_t N>
+    void context_rows(const Bench::Result &baseline) {
+        typename Weave<ContextHook, N>::Aop aop;
+        Service service;
+        typename Weave<ContextHook, N>::Wrapper wrapper { service };
+        Bench::print(run("AOP::invoke N=" + std::to_string(N) + " before(context)/after(context)",
+                         [&](int x) { return aop_site(aop, x); }), baseline);
+        Bench::print(run("AOP_Wrapper_Agent N=" + std::to_string(N) + " before(context)/after(context)",
+                         [&](int x) { return wrapper_agent_site(wrapper, x); }), baseline);
+    }
+
+    template <std::size_t...I>
+    void set_enabled(const AOP<SwitchHook<I>...> &aop, bool enabled, std::index_sequence<I...>) {
+        (aop.template get_aspect<I>().set_enabled(enabled), ...);
+    }
+
+    template <std::size_t N>
+    void switch_rows(const Bench::Result &baseline) {
+        typename Weave<SwitchHook, N>::Aop aop;
+        Bench::print(run("AOP::invoke N=" + std::to_string(N) + " Switchable disabled",
+                         [&](int x) { return aop_site(aop, x); }), baseline);
+        set_enabled(aop, true, std::make_index_sequence<N>());
+        Bench::print(run("AOP::invoke N=" + std::to_string(N) + " Switchable enabled",
+                         [&](int x) { return aop_site(aop, x); }), baseline);
+    }
+
+    template <std::size_t N>
+    void sampled_rows(const Bench::Result &baseline) {
+        typename Weave<EveryHook, N>::Aop every;
+        typename Weave<RandomHook, N>::Aop random;
+        Bench::print(run("AOP::invoke N=" + std::to_string(N) + " Sampled SampleEvery<64>",
+                         [&](int x) { return aop_site(every, x); }), baseline);
+        Bench::print(run("AOP::invoke N=" + std::to_string(N) + " Sampled SampleRandom<64>",
+                         [&](int x) { return aop_site(random, x); }), baseline);
+    }
+
+    template <std::size_t N>
+    void around_rows(const Bench::Result &baseline) {
+        typename Weave<AroundHook, N>::Aop aop;
+        const auto &const_aop = aop;
+        typename Weave<Hook, N>::Aop hook_aop;
+        Bench::print(run("AOP::invoke N=" + std::to_string(N) + " before()/after()",
+                         [&](int x) { return aop_site(hook_aop, x); }), baseline);
+        Bench::print(run("AOP::invoke N=" + std::to_string(N) + " pass-through around()",
+                         [&](int x) { return aop_site(aop, x); }), baseline);
+        Bench::print(run("AOP::invoke N=" + std::to_string(N) + " const pass-through around()",
+                         [&](int x) { return aop_site(const_aop, x); }), baseline);
+    }
+
+    /// 每批只运行一次的 aspect。
+    struct BatchHook {
+        void before_batch(std::size_t count) { elements += count; };
+
+        void after_batch(std::size_t) { ++batches; };
+
+        std::size_t elements = 0;
+        std::size_t batches = 0;
+    };
+
+    /// 逐个元素调用与 invoke_batch 的对比，每轮处理 1024 个元素。
+    void batch_rows() {
+        std::vector<int> input(1024);
+        std::iota(input.begin(), input.end(), 0);
+        std::vector<int> output(input.size());
+        auto scale = [](int x) { return x * 3 + 1; };
+        Bench::Result direct = Bench::measure("direct loop (1024 elements)", [&] {
+            for (std::size_t i = 0; i < input.size(); ++i)
+                output[i] = scale(input[i]);
+            Bench::clobber_memory();
+        });
+        Bench::print(direct);
+        Weave<Hook, 1>::Aop hook;
+        Bench::print(Bench::measure("AOP::invoke per element before()/after()", [&] {
+            for (std::size_t i = 0; i < input.size(); ++i)
+                output[i] = hook.invoke(scale, input[i]);
+            Bench::clobber_memory();
+        }), direct);
+        AOP<BatchHook> batch;
+        Bench::print(Bench::measure("AOP::invoke_batch before_batch()/after_batch()", [&] {
+            batch.invoke_batch(scale, input, output.begin());
+            Bench::clobber_memory();
+        }), direct);
+        AOP<BatchHook, Hook<0>> mixed;
+        Bench::print(Bench::measure("AOP::invoke_batch batch + per-element hooks", [&] {
+            mixed.invoke_batch(scale, input, output.begin());
+            Bench::clobber_memory();
+        }), direct);
+    }
+
+    /// pointcut 不匹配的调用应与直接调用相同，匹配的调用与普通的 Hook 相同。
+    template <std::size_t N>
+    void pointcut_rows(const Bench::Result &baseline) {
+        typename Weave<TaggedHook, N>::Aop aop;
+        Bench::print(run("AOP::invoke N=" + std::to_string(N) + " pointcut not matching",
+                         [&](int x) { return aop_site(aop, x); }), baseline);
+        Bench::print(run("AOP::invoke N=" + std::to_string(N) + " pointcut matching",
+                         [&](int x) { return tagged_site(aop, x); }), baseline);
+    }
+
+    /// N 个 Hook 放在 AOP_Dynamic 中与静态织入的对比，以及与一个静态 aspect 组合时的开销。
+    template <std::size_t N>
+    void dynamic_rows(const Bench::Result &baseline) {
+        AOP<AOP_Dynamic<int(int)>> aop;
+        for (std::size_t i = 0; i < N; ++i)
+            aop.get_aspect<0>().attach(Hook<0>());
+        AOP<Hook<0>, AOP_Dynamic<int(int)>> mixed;
+        for (std::size_t i = 0; i < N; ++i)
+            mixed.get_aspect<1>().attach(Hook<0>());
+        Bench::print(run("AOP::invoke N=" + std::to_string(N) + " AOP_Dynamic",
+                         [&](int x) { return aop_site(aop, x); }), baseline);
+        Bench::print(run("AOP::invoke N=" + std::to_string(N) + " AOP_Dynamic + 1 static",
+                         [&](int x) { return aop_site(mixed, x); }), baseline);
+    }
+
+    template <std::size_t...N>
+    void all_member_rows(const Bench::Result &baseline, std::index_sequence<N...>) {
+        (member_rows<N>(baseline), ...);
+    }
+
+}
+
+void Bench::invoke_bench() {
+    print_header("AOP::invoke vs direct call (N = aspect count)");
+    Result direct = run("direct call (N=0)", [](int x) { return direct_site(x); });
+    print(direct);
+    all_aop_rows(direct, std::index_sequence<1, 2, 4, 8, 16>());
+    arg_rows<1>(direct);
+    arg_rows<4>(direct);
+    context_rows<1>(direct);
+    context_rows<4>(direct);
+    switch_rows<1>(direct);
+    switch_rows<4>(direct);
+    sampled_rows<1>(direct);
+    sampled_rows<4>(direct);
+    pointcut_rows<1>(direct);
+    pointcut_rows<4>(direct);
+
+    print_header("AOP_Dynamic (runtime chain) vs static aspects");
+    print(direct);
+    aop_rows<Hook, 1>(direct, false);
+    aop_rows<Hook, 4>(direct, false);
+    dynamic_rows<0>(direct);
+    dynamic_rows<1>(direct);
+    dynamic_rows<4>(direct);
+    dynamic_rows<16>(direct);
+
+    print_header("around() chain vs direct call");
+    print(direct);
+    around_rows<1>(direct);
+    around_rows<4>(direct);
+    around_rows<16>(direct);
+    Weave<ShortCircuitHook, 1>::Aop short_circuit;
+    print(run("AOP::invoke N=1 around() without next()",
+              [&](int x) { return aop_site(short_circuit, x); }), direct);
+
+    print_header("invoke_batch vs per-element invoke (1024 elements per call)");
+    batch_rows();
+
+    print_header("AOP_Wrapper / AOP_Object vs direct member call");
+    Service service;
+    const Service &const_service = service;
+    Result member = run("direct member call (N=0)",
+                        [&](int x) { return direct_member_site(service, x); });
+    print(member);
+    print(run("direct member call const (N=0)",
+              [&](int x) { return direct_member_site(const_service, x); }), member);
+    all_member_rows(member, std::index_sequence<1, 4, 16>());
+    Weave<Hook, 4>::Wrapper by_reference { service };
+    AOP_Wrapper<AOP_Hold<std::unique_ptr<Service>>, Hook<0>, Hook<1>, Hook<2>, Hook<3>> by_unique { std::make_unique<Service>() };
+    print(run("AOP_Wrapper::invoke N=4 Service&",
+              [&](int x) { return wrapper_site(by_reference, x); }), member);
+    print(run("AOP_Wrapper::invoke N=4 AOP_Hold<unique_ptr<Service>>",
+              [&](int x) { return wrapper_site(by_unique, x); }), member);
+    print(run("AOP_Wrapper::invoke<Sig, &Service::fun> N=4 Service&",
+              [&](int x) { return wrapper_constant_site(by_reference, x); }), member);
+
+    print_header("AOP::invoke with a member pointer on a 4KB object");
+    Large large;
+    std::unique_ptr<Large> unique = std::make_unique<Large>();
+    Weave<Hook, 4>::Aop aop;
+    Result large_direct = run("direct member call (N=0)",
+                              [&](int x) { return direct_large_site(large, x); });
+    print(large_direct);
+    print(run("AOP::invoke N=4 object", [&](int x) { return large_site(aop, large, x); }), large_direct);
+    print(run("AOP::invoke N=4 pointer", [&](int x) { return large_site(aop, &large, x); }), large_direct);
+    print(run("AOP::invoke N=4 reference_wrapper",
+              [&](int x) { return large_site(aop, std::ref(large), x); }), large_direct);
+    print(run("AOP::invoke N=4 unique_ptr", [&](int x) { return large_site(aop, unique, x); }), large_direct);
+    std::printf("copies of the target object: %zu\n", Large::copies);
+}
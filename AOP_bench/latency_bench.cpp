@@ -0,0 +1,113 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#include "Bench.hpp"
+#include "AOP_src/AOP.hpp"
+#include "AOP_src/LatencyHistogram.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace Base;
+
+namespace {
+
+    /// 被测量的函数，几十个周期。
+    BENCH_SITE int work(int x) {
+        for (int i = 0; i < 16; ++i) {
+            x = x * 31 + i;
+            Bench::clobber_memory();
+        }
+        return x;
+    }
+
+    /// 手写的对照组：每次调用读取两次 steady_clock，把耗时追加到一个加锁的 vector 中。
+    class MutexRecorder {
+    public:
+        template <typename Next, typename...Args>
+        decltype(auto) around(Next &next, const Args &...) const {
+            auto begin = std::chrono::steady_clock::now();
+            decltype(auto) result = next();
+            auto end = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> lock(_mutex);
+            _samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+            return result;
+        };
+
+        /// 避免 vector 无限增长。
+        void clear() const {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _samples.clear();
+        };
+
+    private:
+        mutable std::mutex _mutex;
+        mutable std::vector<std::int64_t> _samples;
+    };
+
+    /// threads 个线程同时调用 call，返回总吞吐量（百万次调用每秒）。
+    template <typename Call>
+    double run_threads(unsigned threads, Call &&call) {
+        const std::size_t calls = std::max<std::size_t>(Bench::config().round_time.count() / 50, 1000);
+        std::atomic<unsigned> ready { 0 };
+        std::atomic<bool> start { false };
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                int local = int(t);
+                ready.fetch_add(1);
+                while (!start.load()) {}
+                for (std::size_t i = 0; i < calls; ++i)
+                    local += call(int(i));
+                Bench::do_not_optimize(local);
+            });
+        }
+        while (ready.load() != threads) {}
+        auto begin = std::chrono::steady_clock::now();
+        start.store(true);
+        for (auto &worker : workers)
+            worker.join();
+        auto end = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(end - begin).count();
+        return double(calls) * threads / seconds / 1e6;
+    }
+
+}
+
+void Bench::latency_bench() {
+    print_header("latency recording overhead (single thread)");
+    Result direct = measure("direct call", [] { do_not_optimize(work(7)); });
+    print(direct);
+    AOP<LatencyHistogram<>> histogram;
+    print(measure("AOP::invoke + LatencyHistogram", [&] { do_not_optimize(histogram.invoke(work, 7)); }), direct);
+    AOP<MutexRecorder> recorder;
+    print(measure("AOP::invoke + steady_clock/mutex/vector", [&] {
+        do_not_optimize(recorder.invoke(work, 7));
+    }), direct);
+    recorder.get_aspect<0>().clear();
+
+    std::printf("\n== latency recording throughput by thread count ==\n");
+    std::printf("%-44s %8s %12s\n", "case", "threads", "Mcalls/s");
+    for (unsigned threads : { 1u, 2u, 4u, 8u }) {
+        std::printf("%-44s %8u %12.2f\n", "direct call", threads,
+                    run_threads(threads, [](int x) { return work(x); }));
+        std::printf("%-44s %8u %12.2f\n", "AOP::invoke + LatencyHistogram", threads,
+                    run_threads(threads, [&](int x) { return histogram.invoke(work, x); }));
+        std::printf("%-44s %8u %12.2f\n", "AOP::invoke + steady_clock/mutex/vector", threads,
+                    run_threads(threads, [&](int x) { return recorder.invoke(work, x); }));
+        recorder.get_aspect<0>().clear();
+    }
+
+    LatencySnapshot snapshot = histogram.get_aspect<0>().snapshot();
+    std::printf("\nLatencyHistogram snapshot (%s): count %llu, mean %.1f ns, p50 %.1f ns, "
+                "p99 %.1f ns, p99.9 %.1f ns, max %.1f ns\n",
+                LatencyClock::uses_tsc() ? "TSC" : "CLOCK_MONOTONIC",
+                static_cast<unsigned long long>(snapshot.count), snapshot.mean, snapshot.p50,
+                snapshot.p99, snapshot.p999, snapshot.max);
+}
@@ -0,0 +1,162 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#include "Bench.hpp"
+#include "AOP_src/AOP.hpp"
+#include "AOP_src/Memoize.hpp"
+#include "AOP_src/PersistentMemoize.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Base;
+
+namespace {
+
+    /// 代价较高的纯函数（约数千个周期），被 Memoize 缓存。
+    class Service {
+    public:
+        BENCH_SITE std::uint64_t lookup(std::uint64_t key) const {
+            std::uint64_t x = key;
+            for (int i = 0; i < 512; ++i) {
+                x ^= x >> 33;
+                x *= 0xff51afd7ed558ccdULL;
+                Bench::clobber_memory();
+            }
+            return x;
+        };
+    };
+
+    using Memoized = AOP_Wrapper<const Service, Memoize<std::uint64_t(std::uint64_t)>>;
+
+    /// 热点键的数目，这些键在测量前已被缓存。
+    constexpr std::uint64_t hot_keys = 1024;
+
+    /// 每个线程独立的伪随机数（xorshift）。
+    struct Random {
+        std::uint64_t next() {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return state;
+        };
+
+        std::uint64_t state;
+    };
+
+    /// 以 hit_percent 的概率访问热点键，否则访问一个从未出现过的键。
+    template <typename Call>
+    double run_threads(unsigned threads, unsigned hit_percent, Call &&call) {
+        const std::size_t calls = std::max<std::size_t>(Bench::config().round_time.count() / 50, 1000);
+        std::atomic<unsigned> ready { 0 };
+        std::atomic<bool> start { false };
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                Random random { 0x9e3779b97f4a7c15ULL * (t + 1) };
+                std::uint64_t fresh = (std::uint64_t(t) + 1) << 40;
+                std::uint64_t local = 0;
+                ready.fetch_add(1);
+                while (!start.load()) {}
+                for (std::size_t i = 0; i < calls; ++i) {
+                    std::uint64_t r = random.next();
+                    std::uint64_t key = r % 100 < hit_percent ? (r >> 8) % hot_keys : fresh++;
+                    local += call(key);
+                }
+                Bench::do_not_optimize(local);
+            });
+        }
+        while (ready.load() != threads) {}
+        auto begin = std::chrono::steady_clock::now();
+        start.store(true);
+        for (auto &worker : workers)
+            worker.join();
+        auto end = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(end - begin).count();
+        return double(calls) * threads / seconds / 1e6;
+    }
+
+#ifdef AOP_HAS_PERSISTENT_MEMOIZE
+    using Persistent = AOP_Wrapper<const Service, PersistentMemoize<std::uint64_t(std::uint64_t)>>;
+
+    /// 模拟进程启动：打开（映射）缓存文件，然后依次访问 keys 个键，返回两者各自的耗时（微秒）。
+    template <typename Make>
+    std::pair<double, double> start_up(std::uint64_t keys, Make &&make) {
+        using Clock = std::chrono::steady_clock;
+        auto begin = Clock::now();
+        auto wrapper = make();
+        auto opened = Clock::now();
+        std::uint64_t sum = 0;
+        for (std::uint64_t key = 0; key < keys; ++key)
+            sum += wrapper.invoke(&Service::lookup, key);
+        auto end = Clock::now();
+        Bench::do_not_optimize(sum);
+        return { std::chrono::duration<double, std::micro>(opened - begin).count(),
+                 std::chrono::duration<double, std::micro>(end - opened).count() };
+    }
+#endif
+
+    void print_row(const char* name, unsigned threads, unsigned hit_percent, double mcalls,
+                   const MemoizeStats* stats) {
+        std::printf("%-28s %8u %8u%% %12.2f", name, threads, hit_percent, mcalls);
+        if (stats) {
+            std::printf(" %10.1f%% %10llu\n", 100.0 * double(stats->hits) / double(stats->hits + stats->misses),
+                        static_cast<unsigned long long>(stats->evictions));
+        } else {
+            std::printf(" %11s %10s\n", "-", "-");
+        }
+    }
+
+}
+
+void Bench::memoize_bench() {
+    std::printf("\n== Memoize throughput by hit rate and thread count ==\n");
+    std::printf("%-28s %8s %9s %12s %11s %10s\n", "case", "threads", "hits", "Mcalls/s", "observed", "evictions");
+    const Service service;
+    for (unsigned threads : { 1u, 2u, 4u, 8u }) {
+        for (unsigned hit_percent : { 0u, 50u, 90u, 99u }) {
+            print_row("direct call", threads, hit_percent,
+                      run_threads(threads, hit_percent, [&](std::uint64_t key) { return service.lookup(key); }),
+                      nullptr);
+
+            Memoized memoized { service, MemoizeConfig { 1 << 16, {}, 64 } };
+            for (std::uint64_t key = 0; key < hot_keys; ++key)
+                memoized.invoke(&Service::lookup, key);
+            MemoizeStats warm = memoized.get_aspect<0>().stats();
+            double mcalls = run_threads(threads, hit_percent, [&](std::uint64_t key) {
+                return memoized.invoke(&Service::lookup, key);
+            });
+            MemoizeStats stats = memoized.get_aspect<0>().stats();
+            stats.hits -= warm.hits;
+            stats.misses -= warm.misses;
+            print_row("AOP_Wrapper + Memoize", threads, hit_percent, mcalls, &stats);
+        }
+    }
+
+#ifdef AOP_HAS_PERSISTENT_MEMOIZE
+    std::printf("\n== cold start vs warm start (first pass over every key after a restart) ==\n");
+    std::printf("%-40s %8s %12s %12s %12s\n", "case", "keys", "open us", "pass us", "ns/call");
+    const std::string path = "AOP_bench_persistent_memoize.cache";
+    for (std::uint64_t keys : { 1024u, 16384u }) {
+        auto print_start = [keys](const char* name, std::pair<double, double> time) {
+            std::printf("%-40s %8llu %12.1f %12.1f %12.1f\n", name, static_cast<unsigned long long>(keys),
+                        time.first, time.second, time.second * 1000 / double(keys));
+        };
+        std::remove(path.c_str());
+        print_start("Memoize (always cold after restart)", start_up(keys, [&] {
+            return Memoized { service, MemoizeConfig { 1 << 16 } };
+        }));
+        auto make_persistent = [&] { return Persistent { service, PersistentMemoizeConfig { path, 1 << 16 } }; };
+        print_start("PersistentMemoize cold (no file)", start_up(keys, make_persistent));
+        print_start("PersistentMemoize warm (after restart)", start_up(keys, make_persistent));
+        std::remove(path.c_str());
+        std::remove((path + ".lock").c_str());
+    }
+#endif
+}
@@ -0,0 +1,148 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#include "Bench.hpp"
+#include "AOP_src/AOP.hpp"
+#include "AOP_src/PerThread.hpp"
+#include "AOP_src/WorkStealingPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+using namespace Base;
+
+namespace {
+
+    /// 每个元素的工作量，几十个周期。
+    BENCH_SITE int work(int x) {
+        for (int i = 0; i < 16; ++i) {
+            x = x * 31 + i;
+            Bench::clobber_memory();
+        }
+        return x;
+    }
+
+    /// invoke_parallel 中每个 worker 各有一个，结束后 merge。
+    struct MergedCounter {
+        void before(const int &value) {
+            ++calls;
+            sum += value;
+        };
+
+        void merge(const MergedCounter &other) {
+            calls += other.calls;
+            sum += other.sum;
+        };
+
+        long long calls = 0;
+        long long sum = 0;
+    };
+
+    /// 所有线程共享一个 AOP 时的对照组：加锁。
+    struct LockedCounter {
+        void before(const int &value) const {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++calls;
+            sum += value;
+        };
+
+        mutable std::mutex mutex;
+        mutable long long calls = 0;
+        mutable long long sum = 0;
+    };
+
+    /// 所有线程共享一个 AOP 时的对照组：原子变量（仍然在同一条缓存行上竞争）。
+    struct AtomicCounter {
+        void before(const int &value) const {
+            calls.fetch_add(1, std::memory_order_relaxed);
+            sum.fetch_add(value, std::memory_order_relaxed);
+        };
+
+        mutable std::atomic<long long> calls { 0 };
+        mutable std::atomic<long long> sum { 0 };
+    };
+
+    /// 反复运行 call（每次处理 elements 个元素）一轮的时间，返回吞吐量（百万个元素每秒）。
+    template <typename Call>
+    double throughput(std::size_t elements, Call &&call) {
+        std::size_t runs = 0;
+        auto begin = std::chrono::steady_clock::now();
+        auto end = begin;
+        do {
+            call();
+            ++runs;
+            end = std::chrono::steady_clock::now();
+        } while (end - begin < Bench::config().round_time * Bench::config().rounds);
+        double seconds = std::chrono::duration<double>(end - begin).count();
+        return double(elements) * double(runs) / seconds / 1e6;
+    }
+
+}
+
+void Bench::parallel_bench() {
+    const unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<unsigned> counts;
+    for (unsigned threads = 1; threads < cores; threads *= 2)
+        counts.push_back(threads);
+    counts.push_back(cores);
+
+    std::vector<int> input(1 << 16);
+    std::iota(input.begin(), input.end(), 0);
+    std::vector<int> output(input.size());
+
+    std::printf("\n== invoke_parallel scaling (%zu elements per call, %u hardware threads) ==\n",
+                input.size(), cores);
+    std::printf("%-48s %8s %12s\n", "case", "threads", "Melem/s");
+    for (unsigned threads : counts) {
+        WorkStealingPool pool(threads);
+        std::printf("%-48s %8u %12.2f\n", "parallel_for, no aspect", threads, throughput(input.size(), [&] {
+            pool.parallel_for(input.size(), input.size() / (threads * 8) + 1,
+                              [&](unsigned, std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; ++i)
+                    output[i] = work(input[i]);
+            });
+        }));
+
+        AOP<MergedCounter> merged;
+        std::printf("%-48s %8u %12.2f\n", "invoke_parallel + per-worker counter/merge", threads,
+                    throughput(input.size(), [&] { merged.invoke_parallel_on(pool, work, input, output.begin()); }));
+
+        AOP<AtomicCounter> atomic;
+        std::printf("%-48s %8u %12.2f\n", "shared AOP::invoke + atomic counter", threads,
+                    throughput(input.size(), [&] {
+            pool.parallel_for(input.size(), input.size() / (threads * 8) + 1,
+                              [&](unsigned, std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; ++i)
+                    output[i] = atomic.invoke(work, input[i]);
+            });
+        }));
+
+        AOP<AOP_ConstOnly, AOP_AlignedSlots, PerThread<MergedCounter>> per_thread;
+        std::printf("%-48s %8u %12.2f\n", "shared AOP::invoke + PerThread counter", threads,
+                    throughput(input.size(), [&] {
+            pool.parallel_for(input.size(), input.size() / (threads * 8) + 1,
+                              [&](unsigned, std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; ++i)
+                    output[i] = per_thread.invoke(work, input[i]);
+            });
+        }));
+
+        AOP<LockedCounter> locked;
+        std::printf("%-48s %8u %12.2f\n", "shared AOP::invoke + mutex counter", threads,
+                    throughput(input.size(), [&] {
+            pool.parallel_for(input.size(), input.size() / (threads * 8) + 1,
+                              [&](unsigned, std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; ++i)
+                    output[i] = locked.invoke(work, input[i]);
+            });
+        }));
+        do_not_optimize(output.data());
+    }
+}
@@ -6,15 +6,31 @@
 #define AOP_HPP
 #ifdef AOP_HPP
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <tuple>
 #include <type_traits>
-#include <bits/move.h>
-
-#define AOP_WILL_USE_SOURCE_LOCATION /// 该宏解除后不会使用 SourceLocation 相关内容。
-#ifdef AOP_WILL_USE_SOURCE_LOCATION
+#include <utility>
+#include <vector>
+
+/// 不兼容的改动：AOPthreadLoc 默认不再存在（原来的 AOP_NO_SOURCE_LOCATION 因此被删除），读取它的旧 aspect 需要在编译选项中
+/// 定义 AOP_LEGACY_THREAD_LOCATION，启用后每次 invoke 都会保存、重置并恢复 thread_local 的 AOPthreadLoc。
+/// 该宏改变 AOP 的布局，同一程序中所有包含本文件的翻译单元必须一致。新的 aspect 应使用 InvocationContext。
+#ifdef AOP_LEGACY_THREAD_LOCATION
+#define AOP_WILL_USE_SOURCE_LOCATION /// 该宏未定义时不会使用 AOPthreadLoc。
+#endif
 
 #include "SourceLocation.hpp"
 
+#ifdef AOP_WILL_USE_SOURCE_LOCATION
+
 namespace Base {
     /// Aspect 对象可以从这里获得调用函数的信息（对于 before() 不起作用）。
     inline thread_local SourceLocation AOPthreadLoc;
@@ -22,6 +38,7 @@ namespace Base {
 
 /// 用于获得调用函数的函数信息，使用时放到函数内部的开头，只有当函数运行时才会修改 thread_local 对象：AOPthreadLoc
 #define AOP_FUN_MARK \
+AOP_CALL_SITE_RECORD \
 do { \
     if (Base::AOPthreadLoc.is_unknown()) \
         Base::AOPthreadLoc = CURRENT_FUN_LOCATION; \
@@ -29,7 +46,151 @@ do { \
 
 #else
 
-#define AOP_FUN_MARK
+#define AOP_FUN_MARK AOP_CALL_SITE_RECORD
+
+#endif
+
+/// 用于让无状态的 aspect 不占用空间（C++17 下作为扩展提供，GCC/Clang 不会产生警告）。
+#if defined(_MSC_VER) && __has_cpp_attribute(msvc::no_unique_address)
+#define AOP_NO_UNIQUE_ADDRESS [[msvc::no_unique_address]]
+#elif __has_cpp_attribute(no_unique_address)
+#define AOP_NO_UNIQUE_ADDRESS [[no_unique_address]]
+#else
+#define AOP_NO_UNIQUE_ADDRESS
+#endif
+
+#if !defined(AOP_NO_EXCEPTIONS) && (defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND))
+/// 关闭异常（-fno-exceptions）或定义 AOP_NO_EXCEPTIONS 时该宏不存在，此时 error() 只能由 AOP_ResultErrors 触发。
+#define AOP_HAS_EXCEPTIONS
+#endif
+
+/// 用于标记只在异常路径上运行的函数。
+#if defined(__clang__) || defined(__GNUC__)
+#define AOP_COLD __attribute__((cold, noinline))
+#elif defined(_MSC_VER)
+#define AOP_COLD __declspec(noinline)
+#else
+#define AOP_COLD
+#endif
+
+/// 用于标记很少成立的条件。
+#if defined(__clang__) || defined(__GNUC__)
+#define AOP_UNLIKELY(cond_) __builtin_expect(!!(cond_), 0)
+#else
+#define AOP_UNLIKELY(cond_) (cond_)
+#endif
+
+namespace Base {
+
+//------------------------------------------------------------------------------------------------
+
+    /// AOP_AlignedSlots 和 AOP_ThreadBlocks 使用的缓存行大小。
+    inline constexpr std::size_t AOP_cache_line = 64;
+
+    /*
+     * 每个线程一块 T 的无锁链表，PerThread、LatencyHistogram 和 CallSite 用它保存各线程自己的状态。
+     * 线程第一次访问时默认构造自己的块（一次分配和一次无锁的 CAS），块独占缓存行，只由该线程写入；
+     * local() 在 thread_local 的缓存中按对象的 id（而不是地址）查找，因此不会得到已销毁对象的块。
+     * for_each(fun) 依次以每个线程的块调用 fun(T &)，顺序与线程第一次访问的顺序相反，读取时其他线程可能仍在修改自己的块。
+     * 线程退出后它的块仍被保留；Owning 为 false 时块从不释放，AOP_ThreadBlocks 是平凡析构的。复制得到的对象没有任何块。
+     */
+    template <typename T, bool Owning = true>
+    class AOP_ThreadBlocks {
+    public:
+        AOP_ThreadBlocks() noexcept : _id(next_id().fetch_add(1, std::memory_order_relaxed) + 1) {};
+
+        AOP_ThreadBlocks(const AOP_ThreadBlocks &) noexcept : AOP_ThreadBlocks() {};
+
+        AOP_ThreadBlocks& operator=(const AOP_ThreadBlocks &) noexcept { return *this; };
+
+        /// 当前线程的块，不存在时创建。
+        T& local() const {
+            static thread_local CacheEntry cache[cache_size];
+            CacheEntry &entry = cache[_id % cache_size];
+            if (AOP_UNLIKELY(entry.id != _id)) {
+                entry.block = &find_block();
+                entry.id = _id;
+            }
+            return entry.block->value;
+        };
+
+        /// 不经过缓存查找当前线程的块，不存在时创建。调用者自己缓存结果时使用。
+        T& find() const { return find_block().value; };
+
+        template <typename Fun>
+        void for_each(Fun &&fun) const {
+            for (Block* block = _blocks.load(std::memory_order_acquire); block; block = block->next)
+                fun(block->value);
+        };
+
+    protected:
+        struct alignas(AOP_cache_line) Block {
+            T value {};
+            std::thread::id owner;
+            Block* next = nullptr;
+        };
+
+        struct CacheEntry {
+            std::uint64_t id = 0;
+            Block* block = nullptr;
+        };
+
+        static constexpr std::size_t cache_size = 8;
+
+        static std::atomic<std::uint64_t> &next_id() {
+            static std::atomic<std::uint64_t> id { 0 };
+            return id;
+        };
+
+        /// 只在线程第一次访问（或缓存被其他对象替换）时调用。
+        AOP_COLD Block &find_block() const {
+            std::thread::id self = std::this_thread::get_id();
+            for (Block* block = _blocks.load(std::memory_order_acquire); block; block = block->next) {
+                if (block->owner == self) return *block;
+            }
+            Block* block = new Block();
+            block->owner = self;
+            block->next = _blocks.load(std::memory_order_relaxed);
+            while (!_blocks.compare_exchange_weak(block->next, block, std::memory_order_release,
+                                                  std::memory_order_relaxed)) {}
+            return *block;
+        };
+
+        std::uint64_t _id;
+        mutable std::atomic<Block*> _blocks { nullptr };
+
+    };
+
+    template <typename T>
+    class AOP_ThreadBlocks<T, true> : public AOP_ThreadBlocks<T, false> {
+    public:
+        AOP_ThreadBlocks() = default;
+
+        AOP_ThreadBlocks(const AOP_ThreadBlocks &) = default;
+
+        AOP_ThreadBlocks& operator=(const AOP_ThreadBlocks &) = default;
+
+        ~AOP_ThreadBlocks() {
+            auto* block = this->_blocks.load(std::memory_order_acquire);
+            while (block) {
+                auto* next = block->next;
+                delete block;
+                block = next;
+            }
+        };
+    };
+
+}
+
+#ifdef AOP_CALL_SITE_STATS /// 在编译选项中定义后，AOP_FUN_MARK 会把所在函数登记到 CallSiteRegistry 并统计它的调用。
+
+#include "CallSiteRegistry.hpp"
+
+#define AOP_CALL_SITE_RECORD AOP_CALL_SITE_MARK
+
+#else
+
+#define AOP_CALL_SITE_RECORD
 
 #endif
 
@@ -55,39 +216,105 @@ namespace Base {
 
 //------------------------------------------------------------------------------------------------
 
-    /// 检查 O 以 .* 还是 ->* 方式调用 P，Args 为函数参数。
-    template <typename P, typename O, typename...Args>
-    class MemberFunPtrCallable {
-        using MPtr = std::remove_reference_t<P>;
-        using OPtr = std::remove_reference_t<O>;
+    /*
+     * 一次 invoke 的上下文，只有存在需要它的切入函数时才会在 invoke 的栈上构造（否则没有任何开销），
+     * 以 const 引用传给 before(const InvocationContext &[, const Args &...]) 和 after(const InvocationContext &[, const R &])。
+     * location 为 invoke_at 传入的调用位置（*_Agent 宏在编译期确定），通过 invoke 调用时为 unknown，
+     * 此时 after() 得到的是被调用函数中 AOP_FUN_MARK 记录的 AOPthreadLoc（如果启用了的话）。
+     * depth 为当前线程中外层同样构造了上下文的 invoke 的数目，最外层为 0。
+     * start() 在第一次被调用时读取时钟，之后返回同一个时间，因此不需要它的 invoke 不读取时钟；需要耗时的 aspect 应在 before() 中调用它。
+     */
+    struct InvocationContext {
+        InvocationContext(const SourceLocation &location, unsigned depth) noexcept : location(location), depth(depth) {};
+
+        [[nodiscard]] std::chrono::steady_clock::time_point start() const noexcept {
+            if (!_started) {
+                _start = std::chrono::steady_clock::now();
+                _started = true;
+            }
+            return _start;
+        };
+
+        SourceLocation location;
+        unsigned depth = 0;
 
     private:
-        template <typename U, typename W>
-        static auto test_ptr(U p, W w) -> decltype((w->*p)(std::declval<Args>()...),
-            std::true_type());
-        template <typename U, typename W>
-        static std::false_type test_ptr(...);
+        mutable std::chrono::steady_clock::time_point _start;
+        mutable bool _started = false;
+    };
 
-        template <typename U, typename W>
-        static auto test_object(U p) -> decltype((std::declval<W>().*p)(std::declval<Args>()...),
-            std::true_type());
-        template <typename U, typename W>
-        static std::false_type test_object(...);
+    /// 当前线程中正在进行的、构造了 InvocationContext 的 invoke 的数目。
+    inline thread_local unsigned AOPcontextDepth = 0;
+
+    /// 只用于排除泛型的切入函数（例如 template <typename...Args> void before(const Args &...)），
+    /// 这样只有第一个参数恰好为 InvocationContext 的切入函数才被视为需要上下文。
+    struct AOP_NotContext {};
+
+    /// invoke 中保存 InvocationContext 并维护 AOPcontextDepth，Enable 为 false 时为空。
+    template <bool Enable>
+    class AOP_ContextHolder {
+    public:
+        constexpr explicit AOP_ContextHolder(const SourceLocation*) noexcept {};
+    };
 
+    template <>
+    class AOP_ContextHolder<true> {
     public:
-        static constexpr bool ptr_callable = std::is_member_function_pointer_v<MPtr> &&
-            std::is_pointer_v<OPtr> && decltype(test_ptr<MPtr, OPtr>(nullptr, nullptr))::value;
+        explicit AOP_ContextHolder(const SourceLocation* location) noexcept :
+            _context(location ? *location : SourceLocation(), AOPcontextDepth++) {};
+
+        AOP_ContextHolder(const AOP_ContextHolder &) = delete;
 
-        static constexpr bool object_callable = std::is_member_function_pointer_v<MPtr> &&
-            !std::is_pointer_v<OPtr> && decltype(test_object<MPtr, OPtr>(nullptr))::value;
+        AOP_ContextHolder& operator=(const AOP_ContextHolder &) = delete;
 
-        static constexpr bool callable = ptr_callable || object_callable;
+        ~AOP_ContextHolder() { --AOPcontextDepth; };
 
+        /// before() 得到的上下文。
+        [[nodiscard]] const InvocationContext& context() const { return _context; };
+
+        /// after() 得到的上下文，location 为 unknown 时换成被调用函数中 AOP_FUN_MARK 记录的位置。
+        const InvocationContext& finish() {
+#ifdef AOP_WILL_USE_SOURCE_LOCATION
+            if (_context.location.is_unknown()) _context.location = AOPthreadLoc;
+#endif
+            return _context;
+        };
+
+    private:
+        InvocationContext _context;
+    };
+
+    /*
+     * invoke_async 对被调用函数返回值 R 的适配：is_async 为 true 时由 wrap(R, completion) 返回一个新的异步结果，
+     * 它在原来的结果完成时调用 completion.success([value])，失败时在 catch 块中调用 completion.failure(std::exception*)，
+     * Value 为完成后得到的值的类型。
+     * std::future 和（C++20 下）awaitable 的实现在 AsyncInvoke.hpp 中，没有包含它时 invoke_async 与 invoke_at 相同。
+     */
+    template <typename R, typename = void>
+    struct AOP_AsyncAdapter {
+        static constexpr bool is_async = false;
     };
 
 //------------------------------------------------------------------------------------------------
 
-    /// 检查 T 是否存在调用 before()、after()、error(std::exception_ptr)(这里不能为 exception_ptr &)、destroy()。
+    /// 只用于检查 around(next, args...) 是否存在，代替实际的 next（next() 的返回值类型为 R）。
+    template <typename R>
+    struct AOP_AroundProbe {
+        R operator()() const;
+    };
+
+    /*
+     * 只用于检查 before(const Args &...) 是否存在，代替类型为 T 的参数：它只能通过一次用户定义的转换得到 const T &，
+     * 之后不能再经过构造函数或转换函数得到其他类型的对象，因此 before(const std::string &) 不会匹配类型为 const char* 的参数
+     * （否则每次调用都要构造一个 std::string）。绑定到 T 的基类的引用、被推断为模板参数以及标量之间的转换不受影响。
+     */
+    template <typename T>
+    struct AOP_ExactArg {
+        operator const T&() const;
+    };
+
+    /// 检查 T 是否存在调用 before()、after()、error(std::exception_ptr)(这里不能为 exception_ptr &)、destroy()，
+    /// 以及 before(const Args &...)、after(const R &)、around(next, const Args &...)，error(const E &) 由 AOP_ErrorTypes 检查。
     template <typename T>
     class CallableExitChecker {
     private:
@@ -115,6 +342,51 @@ namespace Base {
         template <typename U>
         static std::false_type destroy_test(...);
 
+        template <typename U, typename...Args>
+        static auto before_args_test(int) -> decltype(std::declval<U>().before(
+                                                          std::declval<const AOP_ExactArg<Args>&>()...),
+            std::true_type());
+        template <typename U, typename...Args>
+        static std::false_type before_args_test(...);
+
+        template <typename U, typename R>
+        static auto after_result_test(int) -> decltype(std::declval<U>().after(std::declval<const R&>()),
+            std::true_type());
+        template <typename U, typename R>
+        static std::false_type after_result_test(...);
+
+        template <typename U, typename C, typename R>
+        static auto after_context_test(int) -> decltype(std::declval<U>().after(std::declval<const C&>(),
+                                                                                std::declval<const R&>()),
+            std::true_type());
+        template <typename U, typename C, typename R>
+        static std::false_type after_context_test(...);
+
+        template <typename U, typename R, typename...Args>
+        static auto around_test(int) -> decltype(std::declval<U>().around(std::declval<AOP_AroundProbe<R>&>(),
+                                                                          std::declval<const Args&>()...),
+            std::true_type());
+        template <typename U, typename R, typename...Args>
+        static std::false_type around_test(...);
+
+        template <typename U>
+        static auto before_batch_test(int) -> decltype(std::declval<U>().before_batch(std::size_t()),
+            std::true_type());
+        template <typename U>
+        static std::false_type before_batch_test(...);
+
+        template <typename U>
+        static auto after_batch_test(int) -> decltype(std::declval<U>().after_batch(std::size_t()),
+            std::true_type());
+        template <typename U>
+        static std::false_type after_batch_test(...);
+
+        template <typename U>
+        static auto merge_test(int) -> decltype(std::declval<U>().merge(std::declval<const std::remove_const_t<U>&>()),
+            std::true_type());
+        template <typename U>
+        static std::false_type merge_test(...);
+
     public:
         static constexpr bool has_before_callable = decltype(before_test<T>(0))::value;
 
@@ -124,46 +396,1135 @@ namespace Base {
 
         static constexpr bool has_destroy_callable = decltype(destroy_test<T>(0))::value;
 
+        static constexpr bool has_before_batch_callable = decltype(before_batch_test<T>(0))::value;
+
+        static constexpr bool has_after_batch_callable = decltype(after_batch_test<T>(0))::value;
+
+        static constexpr bool has_merge_callable = decltype(merge_test<T>(0))::value;
+
+        /// Args 为被调用函数的参数类型（不含引用），参数需为 const Args &（见 AOP_ExactArg），没有参数时等同于 has_before_callable。
+        template <typename...Args>
+        static constexpr bool has_before_args_callable() {
+            return decltype(before_args_test<T, Args...>(0))::value;
+        };
+
+        /// R 为被调用函数的返回值类型（不含引用），不能为 void。
+        template <typename R>
+        static constexpr bool has_after_result_callable() {
+            return decltype(after_result_test<T, R>(0))::value;
+        };
+
+        /// R 为被调用函数的返回值类型（可以为引用或 void），Args 为参数类型（不含引用）。
+        template <typename R, typename...Args>
+        static constexpr bool has_around_callable() {
+            return decltype(around_test<T, R, Args...>(0))::value;
+        };
+
+        /// 存在 before(const InvocationContext &, const Args &...)，Args 为空时即 before(const InvocationContext &)。
+        template <typename...Args>
+        static constexpr bool has_before_context_callable() {
+            return has_before_args_callable<InvocationContext, Args...>()
+                && !has_before_args_callable<AOP_NotContext, Args...>();
+        };
+
+        /// 存在 after(const InvocationContext &)。
+        static constexpr bool has_after_context_callable() {
+            return has_after_result_callable<InvocationContext>() && !has_after_result_callable<AOP_NotContext>();
+        };
+
+        /// 存在 after(const InvocationContext &, const R &)。
+        template <typename R>
+        static constexpr bool has_after_context_result_callable() {
+            return decltype(after_context_test<T, InvocationContext, R>(0))::value
+                && !decltype(after_context_test<T, AOP_NotContext, R>(0))::value;
+        };
+
+    };
+
+//------------------------------------------------------------------------------------------------
+
+    /// 成员函数 error 唯一的参数类型。
+    template <typename T>
+    struct AOP_ErrorParam {};
+
+    template <typename R, typename C, typename P>
+    struct AOP_ErrorParam<R (C::*)(P)> { using type = P; };
+
+    template <typename R, typename C, typename P>
+    struct AOP_ErrorParam<R (C::*)(P) const> { using type = P; };
+
+    template <typename R, typename C, typename P>
+    struct AOP_ErrorParam<R (C::*)(P) noexcept> { using type = P; };
+
+    template <typename R, typename C, typename P>
+    struct AOP_ErrorParam<R (C::*)(P) const noexcept> { using type = P; };
+
+    /*
+     * 获得 aspect 中 error(const E &) 可以处理的异常类型，结果为 std::tuple<E...>，排在前面的类型优先匹配。
+     * 优先使用 aspect 中的 using error_types = std::tuple<E...>，否则从唯一的（没有重载的）error 成员函数推断，
+     * 推断只接受 std::exception 的派生类，其余的异常类型需要通过 error_types 声明，
+     * 因此 AOP_ResultErrors 的 error(const R &)（R 如 std::optional<int>）不会被当作异常类型。
+     * error(std::exception_ptr) 不属于这里的类型，它作为没有匹配到任何类型时的兜底。
+     */
+    template <typename T>
+    class AOP_ErrorTypes {
+    private:
+        using Aspect = std::remove_const_t<T>;
+
+        template <typename U, typename P = std::__remove_cvref_t<typename AOP_ErrorParam<decltype(&U::error)>::type>>
+        static auto deduced(int) -> std::conditional_t<std::is_base_of_v<std::exception, P>, std::tuple<P>, std::tuple<>>;
+        template <typename U>
+        static std::tuple<> deduced(...);
+
+        template <typename U>
+        static auto declared(int) -> typename U::error_types;
+        template <typename U>
+        static auto declared(...) -> decltype(deduced<U>(0));
+
+        template <typename E, typename U = T>
+        static auto callable(int) -> decltype(std::declval<U&>().error(std::declval<const E&>()),
+            std::declval<std::tuple<E>>());
+        template <typename E>
+        static std::tuple<> callable(...);
+
+        template <typename...E>
+        static auto filter(std::tuple<E...>*) -> decltype(std::tuple_cat(std::declval<decltype(callable<E>(0))>()...));
+
+    public:
+        /// 只保留 T（包括 const）可以调用的类型。
+        using type = decltype(filter(static_cast<decltype(declared<Aspect>(0))*>(nullptr)));
+
+        static constexpr bool has_typed_error = std::tuple_size_v<type> > 0;
+
+    };
+
+//------------------------------------------------------------------------------------------------
+
+    /// Ts 中第一个与 T 相同的类型的下标，不存在时返回 sizeof...(Ts)。
+    template <typename T, typename...Ts>
+    constexpr std::size_t AOP_index_of() {
+        constexpr bool same[] = { std::is_same_v<T, Ts>..., false };
+        std::size_t index = 0;
+        while (index < sizeof...(Ts) && !same[index]) ++index;
+        return index;
+    };
+
+#ifdef AOP_HAS_EXCEPTIONS
+
+    /*
+     * notify_error 中正在处理的异常，Cached 为各个 aspect 需要匹配的异常类型（不重复）。
+     * 异常被 invoke 中的 catch (const std::exception &) 捕获时，多态的类型直接由它的指针 dynamic_cast 匹配，不需要重新抛出；
+     * 其余情况（非多态的类型，以及不能以 std::exception 捕获的异常，例如 std::exception 是有歧义的或私有的基类）
+     * 在第一次需要时重新抛出一次，由一组嵌套的 catch (const E &) 捕获，再从捕获到的对象得到其余可以匹配的多态类型，
+     * 因此每次 invoke 最多重新抛出一次。非多态的类型只有在它是第一个被捕获的类型时才会匹配。exception_ptr 只在第一次需要时创建。
+     */
+    template <typename...Cached>
+    class AOP_CurrentError {
+    public:
+        explicit AOP_CurrentError(const std::exception* std_error) noexcept : _std_error(std_error) {};
+
+        AOP_CurrentError(const AOP_CurrentError &) = delete;
+
+        AOP_CurrentError& operator=(const AOP_CurrentError &) = delete;
+
+        const std::exception_ptr& pointer() noexcept {
+            if (!_pointer) _pointer = std::current_exception();
+            return _pointer;
+        };
+
+        /// 当前异常能以 const E & 捕获时调用 fun(const E &) 并返回 true。
+        template <typename E, typename Fun>
+        bool visit(Fun &&fun) {
+            const E* error;
+            if constexpr (std::is_polymorphic_v<E>) {
+                error = _std_error ? dynamic_cast<const E*>(_std_error) : find<E>();
+            } else if constexpr (!std::is_class_v<E>) {
+                error = _std_error ? nullptr : find<E>();
+            } else {
+                error = find<E>();
+            }
+            if (error) fun(*error);
+            return error != nullptr;
+        };
+
+    private:
+        template <typename E>
+        const E* find() {
+            constexpr std::size_t index = AOP_index_of<E, Cached...>();
+            static_assert(index < sizeof...(Cached), "unknown error type");
+            if (!_rethrown) {
+                _rethrown = true;
+                try {
+                    rethrow<0>();
+                } catch (...) {}
+            }
+            return std::get<index>(_found);
+        };
+
+        template <std::size_t I>
+        using Type = std::tuple_element_t<I, std::tuple<Cached...>>;
+
+        /// Cached 中第 I 个类型的基类的个数，基类总是排在它的派生类之前被尝试。
+        template <std::size_t I, std::size_t...J>
+        static constexpr std::size_t depth(std::index_sequence<J...>) {
+            return ((I != J && std::is_base_of_v<Type<J>, Type<I>>) + ... + 0);
+        };
+
+        /// 第 P 个被尝试的类型在 Cached 中的下标。
+        template <std::size_t P, std::size_t...I>
+        static constexpr std::size_t order(std::index_sequence<I...> indices) {
+            constexpr std::size_t size = sizeof...(Cached);
+            const std::size_t depths[] = { depth<I>(indices)..., 0 };
+            std::size_t position = 0;
+            for (std::size_t d = 0; d < size; ++d) {
+                for (std::size_t i = 0; i < size; ++i) {
+                    if (depths[i] != d) continue;
+                    if (position == P) return i;
+                    ++position;
+                }
+            }
+            return size;
+        };
+
+        /*
+         * 嵌套的 try 中最内层的 catch 最先被尝试，因此第 P 层捕获第 size - 1 - P 个被尝试的类型，都不匹配时异常离开最外层。
+         * 基类先于派生类被尝试，捕获到的类型的基类已经确定不匹配，其余的多态类型通过 dynamic_cast 得到。
+         */
+        template <std::size_t P>
+        void rethrow() {
+            if constexpr (P == sizeof...(Cached)) {
+                throw;
+            } else {
+                using Caught = Type<order<sizeof...(Cached) - 1 - P>(std::index_sequence_for<Cached...>())>;
+                try {
+                    rethrow<P + 1>();
+                } catch (const Caught &error) {
+                    (found_from<Cached>(error), ...);
+                }
+            }
+        };
+
+        template <typename E, typename C>
+        void found_from(const C &caught) {
+            const E* &found = std::get<AOP_index_of<E, Cached...>()>(_found);
+            if constexpr (std::is_same_v<E, C>) {
+                found = &caught;
+            } else if constexpr (std::is_polymorphic_v<C> && std::is_polymorphic_v<E> && !std::is_base_of_v<E, C>) {
+                found = dynamic_cast<const E*>(&caught);
+            }
+        };
+
+        const std::exception* _std_error;
+        std::exception_ptr _pointer;
+        std::tuple<const Cached*...> _found {};
+        bool _rethrown = false;
+
+    };
+
+    template <typename Result, typename...E>
+    struct AOP_ErrorCache_ {
+        using type = Result;
+    };
+
+    template <typename...Cached, typename E, typename...Es>
+    struct AOP_ErrorCache_<AOP_CurrentError<Cached...>, E, Es...> :
+        AOP_ErrorCache_<std::conditional_t<(std::is_same_v<E, Cached> || ...),
+                                           AOP_CurrentError<Cached...>, AOP_CurrentError<Cached..., E>>, Es...> {};
+
+    /// 由所有 aspect 的 AOP_ErrorTypes 得到 notify_error 所用的 AOP_CurrentError 类型。
+    template <typename...Aspects>
+    struct AOP_ErrorCache {
+    private:
+        template <typename...E>
+        static AOP_ErrorCache_<AOP_CurrentError<>, E...> make(std::tuple<E...>*);
+
+        using Types = decltype(std::tuple_cat(std::declval<typename AOP_ErrorTypes<Aspects>::type>()...));
+
+        template <typename...E>
+        static constexpr bool any_std(std::tuple<E...>*) {
+            return (std::is_base_of_v<std::exception, E> || ...);
+        };
+
+    public:
+        using type = typename decltype(make(static_cast<Types*>(nullptr)))::type;
+
+        /// 是否需要在 invoke 中单独捕获 std::exception。
+        static constexpr bool catch_std = any_std(static_cast<Types*>(nullptr));
+    };
+
+#endif
+
+//------------------------------------------------------------------------------------------------
+
+    /// 默认的返回值失败判断：存在 has_value() 的类型（std::optional、std::expected 等）在其返回 false 时视为失败。
+    struct AOP_HasNoValue {
+        template <typename R>
+        constexpr bool operator()(const R &result) const {
+            if constexpr (decltype(has_value_test<R>(0))::value) {
+                return !result.has_value();
+            } else {
+                return false;
+            }
+        };
+
+    private:
+        template <typename R>
+        static auto has_value_test(int) -> decltype(bool(std::declval<const R&>().has_value()), std::true_type());
+        template <typename R>
+        static std::false_type has_value_test(...);
+    };
+
+    /*
+     * 返回值错误通道，作为 aspect 放到 AOP 的 Aspects 中启用（不占用空间、下标和构造参数，也不会被当作普通 aspect 调用）：
+     * 被调用函数的返回值 result 满足 Pred()(result) 时，由内向外调用 aspect 的 error(const R &)（R 为返回值去掉引用后的类型），
+     * 并且不再调用 after()，与抛出异常时的行为一致。不依赖异常，可以在 -fno-exceptions 下使用。
+     * 没有 aspect 可以处理该返回值时，invoke 不会进行任何额外的检查。
+     */
+    template <typename Pred = AOP_HasNoValue>
+    struct AOP_ResultErrors {
+        using Predicate = Pred;
+    };
+
+    /// Aspects 中的 AOP_ResultErrors，不存在时为 void。
+    template <typename...Aspects>
+    struct AOP_ResultPolicy {
+        using type = void;
+    };
+
+    template <typename Aspect, typename...Aspects>
+    struct AOP_ResultPolicy<Aspect, Aspects...> : AOP_ResultPolicy<Aspects...> {};
+
+    template <typename Pred, typename...Aspects>
+    struct AOP_ResultPolicy<AOP_ResultErrors<Pred>, Aspects...> {
+        using type = AOP_ResultErrors<Pred>;
+    };
+
+    template <typename Pred, typename...Aspects>
+    struct AOP_ResultPolicy<const AOP_ResultErrors<Pred>, Aspects...> {
+        using type = AOP_ResultErrors<Pred>;
+    };
+
+    /*
+     * 多个线程共享同一个 AOP 对象时使用的策略，与 AOP_ResultErrors 一样作为 aspect 放到 Aspects 中启用（不占用空间、下标和构造参数）：
+     * AOP_ConstOnly：所有调用都以 const 的方式进行（非 const 的 AOP 也一样），aspect 只能通过 const 的切入函数运行，
+     * 存在会被调用、却只有非 const 版本的切入函数时编译报错（而不是在 const 调用中被静默地跳过）。
+     * AOP_AlignedSlots：每个非空的 aspect 对齐到缓存行并独占整数个缓存行，相邻的 aspect 之间不会伪共享。
+     * 需要在每个线程中累计状态的 aspect 使用 PerThread<Aspect>（PerThread.hpp），它的切入函数都是 const 的。
+     * 用法：AOP_Wrapper<Service, AOP_ConstOnly, AOP_AlignedSlots, PerThread<Counter>, LatencyHistogram<>> wrapper { service };
+     */
+    struct AOP_ConstOnly {};
+
+    struct AOP_AlignedSlots {};
+
+    /// Aspects 中是否存在策略 Policy。
+    template <typename Policy, typename...Aspects>
+    constexpr bool AOP_has_policy() {
+        return (std::is_same_v<Policy, std::remove_const_t<Aspects>> || ...);
+    };
+
+    /// 放在 Aspects 中的策略，它们没有切入函数，也不占用 AOP_Slot，get_aspect 的下标和构造参数都不包括它们。
+    template <typename T>
+    struct AOP_IsPolicy : std::false_type {};
+
+    template <typename Pred>
+    struct AOP_IsPolicy<AOP_ResultErrors<Pred>> : std::true_type {};
+
+    template <>
+    struct AOP_IsPolicy<AOP_ConstOnly> : std::true_type {};
+
+    template <>
+    struct AOP_IsPolicy<AOP_AlignedSlots> : std::true_type {};
+
+    /// Aspects 中除策略以外的类型（即占用 AOP_Slot 的 aspect），结果为 std::tuple。Aspects 也可以是构造参数的类型。
+    template <typename...Aspects>
+    using AOP_SlotTuple = decltype(std::tuple_cat(std::declval<
+        std::conditional_t<AOP_IsPolicy<std::__remove_cvref_t<Aspects>>::value, std::tuple<>, std::tuple<Aspects>>>()...));
+
+    /// Aspects 中占用 AOP_Slot 的 aspect 的个数。
+    template <typename...Aspects>
+    constexpr std::size_t AOP_slot_count() {
+        return (std::size_t(!AOP_IsPolicy<std::__remove_cvref_t<Aspects>>::value) + ... + 0);
+    };
+
+    /// Aspects 中的策略，结果为 std::tuple。
+    template <typename...Aspects>
+    using AOP_PolicyTuple = decltype(std::tuple_cat(std::declval<
+        std::conditional_t<AOP_IsPolicy<std::__remove_cvref_t<Aspects>>::value, std::tuple<Aspects>, std::tuple<>>>()...));
+
+//------------------------------------------------------------------------------------------------
+
+    /// 调用单个 aspect 的各个切入函数（如果存在的话），只依赖 aspect 的类型。
+    struct AOP_Hooks {
+        /// 优先调用 before(const Args &...)，args 为转发给被调用函数的参数本身，不存在时调用 before()。
+        template <typename Aspect, typename...Args>
+        static constexpr void before(Aspect &aspect, const Args &...args) {
+            if constexpr (CallableExitChecker<Aspect>::template has_before_args_callable<Args...>())
+                aspect.before(args...);
+            else if constexpr (CallableExitChecker<Aspect>::has_before_callable)
+                aspect.before();
+        };
+
+        template <typename Aspect>
+        static constexpr void after(Aspect &aspect) {
+            if constexpr (CallableExitChecker<Aspect>::has_after_callable)
+                aspect.after();
+        };
+
+        /// aspect 是否存在 after(const R &)。
+        template <typename Aspect, typename R>
+        static constexpr bool has_after_result() {
+            return CallableExitChecker<Aspect>::template has_after_result_callable<R>();
+        };
+
+        /// aspect 是否存在 around(next, const Args &...)。
+        template <typename Aspect, typename R, typename...Args>
+        static constexpr bool has_around() {
+            return CallableExitChecker<Aspect>::template has_around_callable<R, std::__remove_cvref_t<Args>...>();
+        };
+
+        /// 被调用函数返回引用 R 时，around() 也必须返回同一类型的引用，否则 invoke 返回的引用指向 around() 返回的临时对象。
+        template <typename R, typename Around>
+        static constexpr bool around_result_valid() {
+            if constexpr (std::is_reference_v<R>)
+                return std::is_reference_v<Around> && std::is_same_v<std::__remove_cvref_t<Around>, std::__remove_cvref_t<R>>;
+            else
+                return true;
+        };
+
+        /// 优先调用 after(const R &)，不存在时调用 after()。
+        template <typename Aspect, typename R>
+        static constexpr void after(Aspect &aspect, const R &result) {
+            if constexpr (has_after_result<Aspect, R>())
+                aspect.after(result);
+            else
+                after(aspect);
+        };
+
+        /// aspect 是否存在 after(const InvocationContext &, const R &)，R 为 void 时为 false。
+        template <typename Aspect, typename R>
+        static constexpr bool has_after_context_result() {
+            if constexpr (std::is_void_v<R>)
+                return false;
+            else
+                return CallableExitChecker<Aspect>::template has_after_context_result_callable<std::__remove_cvref_t<R>>();
+        };
+
+        /// aspect 是否存在需要 InvocationContext 的 before() 或 after()。
+        template <typename Aspect, typename R, typename...Args>
+        static constexpr bool has_context() {
+            using Checker = CallableExitChecker<Aspect>;
+            return Checker::template has_before_context_callable<std::__remove_cvref_t<Args>...>()
+                || Checker::template has_before_context_callable<>()
+                || Checker::has_after_context_callable()
+                || has_after_context_result<Aspect, R>();
+        };
+
+        /// 依次尝试 before(context, args...)、before(context)，都不存在时与 before(aspect, args...) 相同。
+        template <typename Aspect, typename...Args>
+        static constexpr void before_in(Aspect &aspect, const InvocationContext &context, const Args &...args) {
+            if constexpr (CallableExitChecker<Aspect>::template has_before_context_callable<Args...>())
+                aspect.before(context, args...);
+            else if constexpr (CallableExitChecker<Aspect>::template has_before_context_callable<>())
+                aspect.before(context);
+            else
+                before(aspect, args...);
+        };
+
+        template <typename Aspect>
+        static constexpr void after_in(Aspect &aspect, const InvocationContext &context) {
+            if constexpr (CallableExitChecker<Aspect>::has_after_context_callable())
+                aspect.after(context);
+            else
+                after(aspect);
+        };
+
+        /// 依次尝试 after(context, result)、after(context)、after(result)、after()。
+        template <typename Aspect, typename R>
+        static constexpr void after_in(Aspect &aspect, const InvocationContext &context, const R &result) {
+            if constexpr (has_after_context_result<Aspect, R>())
+                aspect.after(context, result);
+            else if constexpr (CallableExitChecker<Aspect>::has_after_context_callable())
+                aspect.after(context);
+            else
+                after(aspect, result);
+        };
+
+        /// aspect 是否存在任一种 error()。
+        template <typename Aspect>
+        static constexpr bool has_error() {
+            return CallableExitChecker<Aspect>::has_error_callable || AOP_ErrorTypes<Aspect>::has_typed_error;
+        };
+
+        template <typename Aspect, typename R>
+        static auto result_error_test(int) -> decltype(std::declval<Aspect&>().error(std::declval<const R&>()),
+            std::true_type());
+        template <typename, typename>
+        static std::false_type result_error_test(...);
+
+        /// aspect 是否可以处理类型为 R 的返回值（即存在 error(const R &)）。
+        template <typename Aspect, typename R>
+        static constexpr bool has_result_error() {
+            return decltype(result_error_test<Aspect, R>(0))::value;
+        };
+
+        template <typename Aspect, typename R>
+        static constexpr void result_error(Aspect &aspect, const R &result) {
+            if constexpr (has_result_error<Aspect, R>())
+                aspect.error(result);
+        };
+
+#ifdef AOP_HAS_EXCEPTIONS
+        /// 调用第一个与当前异常匹配的 error(const E &)，都不匹配时调用 error(std::exception_ptr)（如果存在的话）。
+        template <typename Aspect, typename Current>
+        static void error(Aspect &aspect, Current &current) {
+            if constexpr (AOP_ErrorTypes<Aspect>::has_typed_error) {
+                if (typed_error(aspect, current, static_cast<typename AOP_ErrorTypes<Aspect>::type*>(nullptr)))
+                    return;
+            }
+            if constexpr (CallableExitChecker<Aspect>::has_error_callable)
+                aspect.error(current.pointer());
+        };
+
+        template <typename Aspect, typename Current, typename...E>
+        static bool typed_error(Aspect &aspect, Current &current, std::tuple<E...>*) {
+            return (current.template visit<E>([&aspect](const E &error) { aspect.error(error); }) || ...);
+        };
+#endif
+
+        /// aspect 是否存在 before_batch(std::size_t) 或 after_batch(std::size_t)，存在时 invoke_batch 只调用它们。
+        template <typename Aspect>
+        static constexpr bool has_batch() {
+            return CallableExitChecker<Aspect>::has_before_batch_callable
+                || CallableExitChecker<Aspect>::has_after_batch_callable;
+        };
+
+        template <typename Aspect>
+        static constexpr void before_batch(Aspect &aspect, std::size_t count) {
+            if constexpr (CallableExitChecker<Aspect>::has_before_batch_callable)
+                aspect.before_batch(count);
+        };
+
+        template <typename Aspect>
+        static constexpr void after_batch(Aspect &aspect, std::size_t count) {
+            if constexpr (CallableExitChecker<Aspect>::has_after_batch_callable)
+                aspect.after_batch(count);
+        };
+
+        /// aspect 是否存在 merge(const Aspect &)，存在时 invoke_parallel 中每个 worker 的 aspect 默认构造，结束后 merge 回原 aspect。
+        template <typename Aspect>
+        static constexpr bool has_merge() {
+            return CallableExitChecker<Aspect>::has_merge_callable;
+        };
+
+        template <typename Aspect>
+        static constexpr void merge(Aspect &aspect, const Aspect &other) {
+            if constexpr (CallableExitChecker<Aspect>::has_merge_callable)
+                aspect.merge(other);
+        };
+
+        /// aspect 存在任一版本的 destroy() 即可。
+        template <typename Aspect>
+        static constexpr void destroy(Aspect &aspect) {
+            if constexpr (CallableExitChecker<Aspect>::has_destroy_callable
+                || CallableExitChecker<const Aspect>::has_destroy_callable) {
+                aspect.destroy();
+            }
+        };
+
+        template <typename Aspect>
+        static auto idle_test(int) -> decltype(bool(std::declval<const Aspect&>().idle()), std::true_type());
+        template <typename>
+        static std::false_type idle_test(...);
+
+        /// aspect 是否存在 bool idle() const，它返回 true 时本次调用不需要运行该 aspect 的任何切入函数（例如空的 AOP_Dynamic）。
+        template <typename Aspect>
+        static constexpr bool has_idle() {
+            return decltype(idle_test<Aspect>(0))::value;
+        };
+
+        /// AOP_ConstOnly 下的检查：对于参数 Args 和返回值 R，aspect 中可以被调用的切入函数都存在 const 的版本。
+        template <typename Aspect, typename R, typename...Args>
+        static constexpr bool const_callable() {
+            using Mutable = CallableExitChecker<Aspect>;
+            using Const = CallableExitChecker<const Aspect>;
+            bool callable = (!Mutable::has_before_callable || Const::has_before_callable)
+                && (!Mutable::template has_before_args_callable<std::__remove_cvref_t<Args>...>()
+                    || Const::template has_before_args_callable<std::__remove_cvref_t<Args>...>())
+                && (!Mutable::has_after_callable || Const::has_after_callable)
+                && (!Mutable::has_error_callable || Const::has_error_callable)
+                && std::is_same_v<typename AOP_ErrorTypes<Aspect>::type, typename AOP_ErrorTypes<const Aspect>::type>
+                && (!has_around<Aspect, R, Args...>() || has_around<const Aspect, R, Args...>())
+                && (!has_context<Aspect, R, Args...>() || has_context<const Aspect, R, Args...>())
+                && (!Mutable::has_before_batch_callable || Const::has_before_batch_callable)
+                && (!Mutable::has_after_batch_callable || Const::has_after_batch_callable);
+            if constexpr (!std::is_void_v<R>) {
+                using Result = std::__remove_cvref_t<R>;
+                callable = callable && (!has_after_result<Aspect, Result>() || has_after_result<const Aspect, Result>())
+                    && (!has_result_error<Aspect, Result>() || has_result_error<const Aspect, Result>());
+            }
+            return callable;
+        };
+
+        /// 与 std::invoke 的规则一致：成员指针可以通过对象引用、指针、std::reference_wrapper
+        /// 或智能指针调用（不会复制对象），也可以是数据成员指针。
+        template <typename Fun, typename...Args>
+        static decltype(auto) call(Fun &&fun, Args &&...args) {
+            static_assert(std::is_invocable_v<Fun, Args...>, "unknown type or wrong input");
+            return std::invoke(std::forward<Fun>(fun), std::forward<Args>(args)...);
+        };
     };
 
 //------------------------------------------------------------------------------------------------
 
-    /// AOP 的实现类，以继承的方式实现。
-    template <std::size_t Index, typename Aspect_, typename...Res>
-    class AOP_impl : public AOP_impl<Index + 1, Res...> {
+    /*
+     * 在 around() 中运行另一个 aspect 的全部切入函数，用于每次调用只做一次判断的包装 aspect（Sampled、Switchable）：
+     * 依次调用它的 before()、around()（如果存在）或 next()、after() 或 error()，因此同一次调用的 before() 和 after() 总是成对出现。
+     * 需要 InvocationContext 的切入函数和 AOP_ResultErrors 的 error(const R &) 不会被调用。
+     */
+    struct AOP_AroundRun {
+        AOP_AroundRun() = delete;
+
+        /// 依次运行 before()、around() 或 next()、after()，异常时调用 error() 后重新抛出。
+        template <typename A, typename Next, typename...Args>
+        AOP_COLD static decltype(std::declval<Next&>()()) run(A &aspect, Next &next, const Args &...args) {
+            AOP_Hooks::before(aspect, args...);
+#ifdef AOP_HAS_EXCEPTIONS
+            if constexpr (AOP_ErrorCache<A>::catch_std) {
+                try {
+                    return call(aspect, next, args...);
+                } catch (const std::exception &error) {
+                    notify_error(aspect, &error);
+                    throw;
+                } catch (...) {
+                    notify_error(aspect, nullptr);
+                    throw;
+                }
+            } else if constexpr (AOP_Hooks::has_error<A>()) {
+                try {
+                    return call(aspect, next, args...);
+                } catch (...) {
+                    notify_error(aspect, nullptr);
+                    throw;
+                }
+            } else {
+                return call(aspect, next, args...);
+            }
+#else
+            return call(aspect, next, args...);
+#endif
+        };
+
+    private:
+        template <typename A, typename Next, typename...Args>
+        static decltype(std::declval<Next&>()()) call(A &aspect, Next &next, const Args &...args) {
+            using Result = decltype(next());
+            if constexpr (std::is_void_v<Result>) {
+                inner(aspect, next, args...);
+                AOP_Hooks::after(aspect);
+            } else {
+                Result result = inner(aspect, next, args...);
+                AOP_Hooks::after(aspect, result);
+                if constexpr (std::is_reference_v<Result>)
+                    return static_cast<Result>(result);
+                else
+                    return result;
+            }
+        };
+
+        /// Aspect 自身的 around() 或 next()。
+        template <typename A, typename Next, typename...Args>
+        static decltype(std::declval<Next&>()()) inner(A &aspect, Next &next, const Args &...args) {
+            using Result = decltype(next());
+            if constexpr (AOP_Hooks::has_around<A, Result, Args...>()) {
+                static_assert(AOP_Hooks::around_result_valid<Result, decltype(aspect.around(next, args...))>(),
+                              "around() must return a reference to the same type when the callee returns a reference");
+                return static_cast<Result>(aspect.around(next, args...));
+            } else
+                return next();
+        };
+
+#ifdef AOP_HAS_EXCEPTIONS
+        template <typename A>
+        static void notify_error(A &aspect, const std::exception* std_error) {
+            typename AOP_ErrorCache<A>::type current(std_error);
+            AOP_Hooks::error(aspect, current);
+        };
+#endif
+    };
+
+//------------------------------------------------------------------------------------------------
+
+    /// 把可调用对象（一般为成员函数指针）和对象绑定在一起，AOP_Wrapper 和 AOP_Object 用它调用成员函数，
+    /// 这样 before(const Args &...) 只会得到函数参数而不包括对象本身。只保存引用，只能在同一个表达式中使用。
+    template <typename Fun, typename Object>
+    class AOP_Bound {
+    public:
+        constexpr AOP_Bound(Fun &&fun, Object &&object) noexcept :
+            _fun(std::forward<Fun>(fun)), _object(std::forward<Object>(object)) {};
+
+        template <typename...Args>
+        constexpr auto operator()(Args &&...args) const
+            -> decltype(std::invoke(std::declval<Fun>(), std::declval<Object>(), std::declval<Args>()...)) {
+            return std::invoke(std::forward<Fun>(_fun), std::forward<Object>(_object), std::forward<Args>(args)...);
+        };
+
+    private:
+        Fun &&_fun;
+        Object &&_object;
+    };
+
+    template <typename Fun, typename Object>
+    constexpr AOP_Bound<Fun, Object> AOP_bind(Fun &&fun, Object &&object) noexcept {
+        return AOP_Bound<Fun, Object>(std::forward<Fun>(fun), std::forward<Object>(object));
+    };
+
+//------------------------------------------------------------------------------------------------
+
+    /// 编译期常量 Fun（函数指针或成员指针）对应的可调用对象，invoke<Fun>(args...) 通过它调用 Fun，调用总能被内联。
+    template <auto Fun>
+    struct AOP_Fun {
+        template <typename...Args>
+        constexpr auto operator()(Args &&...args) const
+            -> decltype(std::invoke(Fun, std::declval<Args>()...)) {
+            return std::invoke(Fun, std::forward<Args>(args)...);
+        };
+    };
+
+    /// 给可调用对象附加一个标签，供 AOP_Tagged 匹配：aop.invoke(AOP_tag<Audit>(&Service::save), service, x)。
+    /// 与 AOP_Bound 一样只保存引用，只能在同一个表达式中使用。
+    template <typename Tag, typename Fun>
+    class AOP_TaggedCall {
     public:
-        using ParentClass = AOP_impl<Index + 1, Res...>;
+        constexpr explicit AOP_TaggedCall(Fun &&fun) noexcept : _fun(std::forward<Fun>(fun)) {};
+
+        template <typename...Args>
+        constexpr auto operator()(Args &&...args) const
+            -> decltype(std::invoke(std::declval<Fun>(), std::declval<Args>()...)) {
+            return std::invoke(std::forward<Fun>(_fun), std::forward<Args>(args)...);
+        };
+
+    private:
+        Fun &&_fun;
+    };
+
+    template <typename Tag, typename Fun>
+    constexpr AOP_TaggedCall<Tag, Fun> AOP_tag(Fun &&fun) noexcept {
+        return AOP_TaggedCall<Tag, Fun>(std::forward<Fun>(fun));
+    };
+
+    /// pointcut 看到的被调用者：type 为去掉 AOP_Bound 和 AOP_TaggedCall 后的类型（一般为函数指针、成员函数指针或函数对象），
+    /// tag 为 AOP_tag 附加的标签，target 为 invoke<Fun> 的 AOP_Fun<Fun>，没有时都为 void。
+    template <typename Fun>
+    struct AOP_Callee_ {
+        using type = Fun;
+        using tag = void;
+        using target = void;
+    };
+
+    template <auto Fun>
+    struct AOP_Callee_<AOP_Fun<Fun>> {
+        using type = decltype(Fun);
+        using tag = void;
+        using target = AOP_Fun<Fun>;
+    };
+
+    template <typename Fun, typename Object>
+    struct AOP_Callee_<AOP_Bound<Fun, Object>> : AOP_Callee_<std::__remove_cvref_t<Fun>> {};
+
+    template <typename Tag, typename Fun>
+    struct AOP_Callee_<AOP_TaggedCall<Tag, Fun>> {
+        using type = typename AOP_Callee_<std::__remove_cvref_t<Fun>>::type;
+        using tag = Tag;
+        using target = typename AOP_Callee_<std::__remove_cvref_t<Fun>>::target;
+    };
 
-        using AOP_Type = AOP_impl;
+    template <typename Fun>
+    using AOP_Callee = AOP_Callee_<std::__remove_cvref_t<Fun>>;
+
+    /// 成员指针所属的类，不是成员指针时为 void。
+    template <typename T>
+    struct AOP_MemberClass {
+        using type = void;
+    };
+
+    template <typename M, typename C>
+    struct AOP_MemberClass<M C::*> {
+        using type = C;
+    };
+
+    /*
+     * pointcut：aspect 中的 using pointcut = P; 决定它作用于哪些被调用者，P::matches<Callee> 在编译期对 AOP_Callee 求值。
+     * 不匹配的 aspect 在这次调用中被完全去掉（所有切入函数都不会被实例化），所有 aspect 都不匹配时 invoke 直接调用被调用者。
+     * 没有声明 pointcut 的 aspect 匹配所有调用。*_Agent 宏传入的是 lambda，只能通过 AOP_Match 匹配。
+     */
+    struct AOP_Anywhere {
+        template <typename Callee>
+        static constexpr bool matches = true;
+    };
+
+    /// 匹配 Class 中任一个类的成员函数指针（包括通过 AOP_Wrapper、AOP_Object 调用的成员函数）。
+    template <typename...Class>
+    struct AOP_Within {
+        template <typename Callee>
+        static constexpr bool matches =
+            (std::is_same_v<typename AOP_MemberClass<typename Callee::type>::type, Class> || ...);
+    };
+
+    /// 匹配由 AOP_tag 附加了 Tag 中任一个标签的调用。
+    template <typename...Tag>
+    struct AOP_Tagged {
+        template <typename Callee>
+        static constexpr bool matches = (std::is_same_v<typename Callee::tag, Tag> || ...);
+    };
+
+    /// 匹配以 invoke<Fun> 调用 Funs 中任一个函数的调用（通过运行时的函数指针调用时无法匹配）。
+    template <auto...Funs>
+    struct AOP_Execution {
+        template <typename Callee>
+        static constexpr bool matches = (std::is_same_v<typename Callee::target, AOP_Fun<Funs>> || ...);
+    };
+
+    /// 匹配 Pred<被调用者类型>::value 为 true 的调用。
+    template <template <typename> class Pred>
+    struct AOP_Match {
+        template <typename Callee>
+        static constexpr bool matches = Pred<typename Callee::type>::value;
+    };
+
+    template <typename Pointcut>
+    struct AOP_Not {
+        template <typename Callee>
+        static constexpr bool matches = !Pointcut::template matches<Callee>;
+    };
+
+    template <typename...Pointcut>
+    struct AOP_AnyOf {
+        template <typename Callee>
+        static constexpr bool matches = (Pointcut::template matches<Callee> || ...);
+    };
+
+    template <typename...Pointcut>
+    struct AOP_AllOf {
+        template <typename Callee>
+        static constexpr bool matches = (Pointcut::template matches<Callee> && ...);
+    };
+
+    template <typename Aspect, typename = void>
+    struct AOP_PointcutOf_ {
+        using type = AOP_Anywhere;
+    };
+
+    template <typename Aspect>
+    struct AOP_PointcutOf_<Aspect, std::void_t<typename Aspect::pointcut>> {
+        using type = typename Aspect::pointcut;
+    };
+
+    /// Aspect 声明的 pointcut，没有声明时为 AOP_Anywhere。包装其他 aspect 的 aspect 可以用它转发内部 aspect 的 pointcut。
+    template <typename Aspect>
+    using AOP_PointcutOf = typename AOP_PointcutOf_<std::remove_const_t<Aspect>>::type;
+
+    /// Aspect 是否作用于对 Fun 的调用。
+    template <typename Aspect, typename Fun>
+    constexpr bool AOP_applies() {
+        return AOP_PointcutOf<Aspect>::template matches<AOP_Callee<Fun>>;
+    };
+
+    /// Keep 中为 true 的下标组成的 std::index_sequence。
+    template <bool...Keep>
+    struct AOP_KeptIndices {
+    private:
+        static constexpr std::size_t at(std::size_t n) {
+            constexpr bool keep[] = { Keep..., false };
+            std::size_t index = 0;
+            for (;; ++index) {
+                if (keep[index] && n-- == 0) return index;
+            }
+        };
+
+        template <std::size_t...N>
+        static std::index_sequence<at(N)...> make(std::index_sequence<N...>);
+
+    public:
+        using type = decltype(make(std::make_index_sequence<(std::size_t(Keep) + ... + 0)>()));
+    };
+
+//------------------------------------------------------------------------------------------------
+
+    /// invoke_batch 不保存返回值时使用的输出。
+    struct AOP_NoOutput {};
+
+    /// invoke_batch 中作为参数列表展开的元素类型（std::tuple 和 std::pair），其他类型的元素作为唯一的参数。
+    template <typename T>
+    struct AOP_IsArgPack : std::false_type {};
+
+    template <typename...Args>
+    struct AOP_IsArgPack<std::tuple<Args...>> : std::true_type {};
+
+    template <typename First, typename Second>
+    struct AOP_IsArgPack<std::pair<First, Second>> : std::true_type {};
+
+    /// 以 element（展开后）的左值为参数调用 call。
+    template <typename Call, typename Element>
+    constexpr decltype(auto) AOP_apply_element(Call &&call, Element &element) {
+        if constexpr (AOP_IsArgPack<std::remove_const_t<Element>>::value)
+            return std::apply(std::forward<Call>(call), element);
+        else
+            return std::forward<Call>(call)(element);
+    };
+
+    /*
+     * invoke_batch 逐个元素调用时代替 Aspect 的引用：存在批量切入函数（before_batch/after_batch）的 aspect 在这里没有任何切入函数，
+     * 其他 aspect 的 before()、after()、error()、around() 被原样转发。AOP_ResultErrors 等策略不需要转发，由 AOP_ElementOf 直接保留。
+     * Batch 为 false 时转发所有切入函数（包括批量切入函数），pointcut 过滤后的 AOP 以此引用匹配的 aspect。
+     */
+    template <typename Aspect, bool Batch = AOP_Hooks::has_batch<Aspect>()>
+    class AOP_ElementRef {
+    public:
+        explicit AOP_ElementRef(Aspect &) noexcept {};
+    };
+
+    template <typename Aspect>
+    class AOP_ElementRef<Aspect, false> {
+    public:
+        using error_types = typename AOP_ErrorTypes<Aspect>::type;
+
+        explicit AOP_ElementRef(Aspect &aspect) noexcept : _aspect(aspect) {};
+
+        template <typename...Args, typename A = Aspect>
+        auto before(const Args &...args) const -> decltype(void(std::declval<A&>().before(args...))) {
+            _aspect.before(args...);
+        };
+
+        template <typename...Args, typename A = Aspect>
+        auto after(const Args &...args) const -> decltype(void(std::declval<A&>().after(args...))) {
+            _aspect.after(args...);
+        };
+
+        template <typename E, typename A = Aspect>
+        auto error(const E &error) const -> decltype(void(std::declval<A&>().error(error))) {
+            _aspect.error(error);
+        };
+
+        template <typename Next, typename...Args, typename A = Aspect>
+        auto around(Next &next, const Args &...args) const -> decltype(std::declval<A&>().around(next, args...)) {
+            return _aspect.around(next, args...);
+        };
+
+        template <typename A = Aspect>
+        auto before_batch(std::size_t count) const -> decltype(void(std::declval<A&>().before_batch(count))) {
+            _aspect.before_batch(count);
+        };
+
+        template <typename A = Aspect>
+        auto after_batch(std::size_t count) const -> decltype(void(std::declval<A&>().after_batch(count))) {
+            _aspect.after_batch(count);
+        };
+
+    private:
+        Aspect &_aspect;
+    };
+
+    template <typename T>
+    struct AOP_IsElementRef : std::false_type {};
+
+    template <typename Aspect, bool Batch>
+    struct AOP_IsElementRef<AOP_ElementRef<Aspect, Batch>> : std::true_type {};
+
+    template <typename Aspect, bool Batch, bool = AOP_IsPolicy<std::remove_const_t<Aspect>>::value>
+    struct AOP_ElementOf_ {
+        using type = AOP_ElementRef<Aspect, Batch>;
+    };
+
+    template <typename Aspect, bool Batch>
+    struct AOP_ElementOf_<Aspect, Batch, true> {
+        using type = std::remove_const_t<Aspect>;
+    };
+
+    /// Aspect 在 invoke_batch 逐个元素调用时的替代类型。
+    template <typename Aspect>
+    using AOP_ElementOf = typename AOP_ElementOf_<Aspect, AOP_Hooks::has_batch<Aspect>()>::type;
+
+    /// Aspect 在 pointcut 过滤后的 AOP 中的替代类型。
+    template <typename Aspect>
+    using AOP_RefOf = typename AOP_ElementOf_<Aspect, false>::type;
+
+//------------------------------------------------------------------------------------------------
+
+    /// invoke_parallel 默认使用的线程池，定义在 WorkStealingPool.hpp 中。
+    class WorkStealingPool;
+
+    /// invoke_parallel 交给每个 worker 的一块 [first, last)。
+    template <typename Iterator>
+    struct AOP_Subrange {
+        Iterator first;
+        Iterator last;
+
+        Iterator begin() const { return first; };
+
+        Iterator end() const { return last; };
+    };
+
+    /// 构造 invoke_parallel 中 worker 自己的 AOP 时使用的标记。
+    struct AOP_WorkerCopy {};
+
+//------------------------------------------------------------------------------------------------
+
+    /// 用于按下标 O(1) 地查找类型，AOP_TypeList 的每个基类都对应 Ts 中的一个类型。
+    template <std::size_t Index, typename T>
+    struct AOP_IndexedType {
+        using type = T;
+    };
+
+    template <typename Indices, typename...Ts>
+    struct AOP_TypeList;
+
+    template <std::size_t...Index, typename...Ts>
+    struct AOP_TypeList<std::index_sequence<Index...>, Ts...> : AOP_IndexedType<Index, Ts>... {};
+
+    template <std::size_t Index, typename T>
+    AOP_IndexedType<Index, T> AOP_type_at(const AOP_IndexedType<Index, T>*);
+
+    /// Ts 中第 Index 个类型。
+    template <std::size_t Index, typename...Ts>
+    using AOP_TypeAt = typename decltype(AOP_type_at<Index>(
+        std::declval<AOP_TypeList<std::index_sequence_for<Ts...>, Ts...>*>()))::type;
+
+    template <std::size_t Index, typename Tuple>
+    struct AOP_TupleAt;
+
+    template <std::size_t Index, typename...Ts>
+    struct AOP_TupleAt<Index, std::tuple<Ts...>> {
+        using type = AOP_TypeAt<Index, Ts...>;
+    };
+
+    /// Aspects 中第 Index 个占用 AOP_Slot 的 aspect，策略不占用下标。
+    template <std::size_t Index, typename...Aspects>
+    using AOP_SlotType = typename AOP_TupleAt<Index, AOP_SlotTuple<Aspects...>>::type;
+
+//------------------------------------------------------------------------------------------------
+
+    /// Aligned 为 true 时使包含它的 AOP_Slot 对齐到缓存行（大小也随之成为缓存行的整数倍），每个下标各用一个类型以免影响空基类优化。
+    template <std::size_t Index, bool Aligned>
+    struct AOP_SlotAlign {};
+
+    template <std::size_t Index>
+    struct alignas(AOP_cache_line) AOP_SlotAlign<Index, true> {};
+
+    /// 保存 AOP 中第 Index 个 aspect 对象，空的 aspect 不占用空间。Aligned 见 AOP_AlignedSlots。
+    template <std::size_t Index, typename Aspect_, bool Aligned = false>
+    class AOP_Slot : AOP_SlotAlign<Index, Aligned> {
+    public:
+        using AOP_Type = AOP_Slot;
 
         using AOP_ConstType = const AOP_Type;
 
-        using Aspect = Aspect_;
+        using Aspect = Aspect_;
+
+        using ConstAspect = const Aspect_;
+
+        constexpr AOP_Slot(): _aspect() {};
+
+        template <typename Arg, typename = std::enable_if_t<!std::is_same_v<AOP_Slot, std::__remove_cvref_t<Arg>>>>
+        constexpr explicit AOP_Slot(Arg &&aspect) : _aspect(std::forward<Arg>(aspect)) {};
+
+        constexpr AOP_Slot(const AOP_Slot &) = default;
+
+        constexpr AOP_Slot& operator=(const AOP_Slot &) = default;
+
+        constexpr AOP_Slot(AOP_Slot &&) = default;
+
+        constexpr AOP_Slot& operator=(AOP_Slot &&) = default;
+
+        /// worker 使用的 aspect：存在 merge() 时默认构造，否则复制 other 中的 aspect。
+        constexpr AOP_Slot(AOP_WorkerCopy, const AOP_Slot &other) :
+            AOP_Slot(std::bool_constant<AOP_Hooks::has_merge<Aspect>()>(), other) {};
+
+        constexpr Aspect& get_aspect() {
+            return _aspect;
+        };
+
+        constexpr ConstAspect& get_aspect() const {
+            return _aspect;
+        };
+
+    private:
+        constexpr AOP_Slot(std::true_type, const AOP_Slot &) : _aspect() {};
+
+        constexpr AOP_Slot(std::false_type, const AOP_Slot &other) : _aspect(other._aspect) {};
+
+        AOP_NO_UNIQUE_ADDRESS Aspect _aspect;
+
+    };
+
+    /// 启用了 AOP_AlignedSlots 时非空的 aspect 独占缓存行。
+    template <typename Aspect, typename...Aspects>
+    constexpr bool AOP_slot_aligned() {
+        return AOP_has_policy<AOP_AlignedSlots, Aspects...>() && std::is_class_v<Aspect> && !std::is_empty_v<Aspect>;
+    };
+
+    /// Aspects 中第 Index 个 aspect（不包括策略）所在的 AOP_Slot。
+    template <std::size_t Index, typename...Aspects>
+    using AOP_SlotAt = AOP_Slot<Index, AOP_SlotType<Index, Aspects...>,
+                                AOP_slot_aligned<AOP_SlotType<Index, Aspects...>, Aspects...>()>;
+
+//------------------------------------------------------------------------------------------------
+
+    template <typename...Aspects>
+    class AOP;
+
+    template <typename Indices, typename...Aspects>
+    class AOP_impl;
+
+    /// AOP 的实现类，每个 aspect 保存在各自的 AOP_Slot 基类中，通过折叠表达式依次调用。
+    /// AOP_Slot 按下标从大到小继承，使 aspect 的构造（由内向外）与析构顺序保持不变。
+    /// Aspects 中的策略不占用 AOP_Slot，Index 只对应其余的 aspect。
+    template <std::size_t...Index, typename...Aspects>
+    class AOP_impl<std::index_sequence<Index...>, Aspects...> :
+        public AOP_SlotAt<sizeof...(Index) - 1 - Index, Aspects...>... {
+        template <typename T>
+        struct Is_AOP_impl : std::false_type {};
+
+        template <typename Indices, typename...Args>
+        struct Is_AOP_impl<AOP_impl<Indices, Args...>> : std::true_type {};
+
+        template <typename...Args>
+        static constexpr bool forwardable() {
+            return sizeof...(Args) == sizeof...(Index)
+                && !(sizeof...(Args) == 1 && std::__or_v<Is_AOP_impl<std::__remove_cvref_t<Args>>...>);
+        };
+
+        struct Forward {};
+
+        /// 初始化列表需与基类的声明顺序（下标从大到小）一致，因此先把参数打包，再按相同的顺序取出。
+        template <typename Tuple>
+        constexpr AOP_impl(Forward, Tuple &&args) :
+            AOP_SlotAt<sizeof...(Index) - 1 - Index, Aspects...>(
+                std::get<sizeof...(Index) - 1 - Index>(std::move(args)))... {};
 
-        using ConstAspect = const Aspect_;
+    public:
+        /// 第 I 个 aspect 所在的 AOP_Slot。
+        template <std::size_t I>
+        using Slot = AOP_SlotAt<I, Aspects...>;
 
-        constexpr AOP_impl(): ParentClass(), _aspect() {};
+        constexpr AOP_impl(): Slot<sizeof...(Index) - 1 - Index>()... {};
 
-        constexpr explicit AOP_impl(const Aspect &aspect, const Res &...res):
-            ParentClass(res...), _aspect(aspect) {};
+        constexpr explicit AOP_impl(const AOP_SlotType<Index, Aspects...> &...aspects) :
+            AOP_impl(Forward(), std::forward_as_tuple(aspects...)) {};
 
-        template <typename T, typename...Args,
-                  typename = std::enable_if_t<sizeof...(Res) == sizeof...(Args)>>
-        constexpr explicit AOP_impl(T &&aspect, Args &&...args) :
-            ParentClass(std::forward<Args>(args)...), _aspect(std::forward<T>(aspect)) {};
+        template <typename...Args, typename = std::enable_if_t<forwardable<Args...>()>>
+        constexpr explicit AOP_impl(Args &&...args) :
+            AOP_impl(Forward(), std::forward_as_tuple(std::forward<Args>(args)...)) {};
 
         template <typename...Args>
-        constexpr AOP_impl(const AOP_impl<Index, Args...> &other) :
-            ParentClass(static_cast<const typename AOP_impl<Index, Args...>::ParentClass&>(other)),
-            _aspect(other.get_aspect()) {};
+        constexpr AOP_impl(const AOP_impl<std::index_sequence<Index...>, Args...> &other) :
+            Slot<sizeof...(Index) - 1 - Index>(other.template get_aspect<sizeof...(Index) - 1 - Index>())... {};
 
         template <typename...Args>
-        constexpr AOP_impl(AOP_impl<Index, Args...> &&other) :
-            ParentClass(static_cast<typename AOP_impl<Index, Args...>::ParentClass&&>(other)),
-            _aspect(std::move(other.get_aspect())) {};
+        constexpr AOP_impl(AOP_impl<std::index_sequence<Index...>, Args...> &&other) :
+            Slot<sizeof...(Index) - 1 - Index>(
+                std::move(other.template get_aspect<sizeof...(Index) - 1 - Index>()))... {};
 
-        constexpr AOP_impl(const AOP_impl &other) :
-            ParentClass(static_cast<const ParentClass&>(other)), _aspect(other.get_aspect()) {};
+        constexpr AOP_impl(const AOP_impl &) = default;
 
         constexpr AOP_impl& operator=(const AOP_impl &) = default;
 
@@ -171,264 +1532,371 @@ namespace Base {
 
         constexpr AOP_impl& operator=(AOP_impl &&) = default;
 
-        constexpr Aspect& get_aspect() {
-            return _aspect;
+        constexpr AOP_impl(AOP_WorkerCopy, const AOP_impl &other) :
+            Slot<sizeof...(Index) - 1 - Index>(AOP_WorkerCopy(),
+                                               static_cast<const Slot<sizeof...(Index) - 1 - Index>&>(other))... {};
+
+        template <std::size_t I>
+        constexpr auto& get_aspect() {
+            return static_cast<Slot<I>&>(*this).get_aspect();
         };
 
-        constexpr ConstAspect& get_aspect() const {
-            return _aspect;
+        template <std::size_t I>
+        constexpr auto& get_aspect() const {
+            return static_cast<const Slot<I>&>(*this).get_aspect();
         };
 
     protected:
-        constexpr void invoke_before() {
-            if constexpr (CallableExitChecker<Aspect>::has_before_callable)
-                _aspect.before();
-            ParentClass::invoke_before();
+        /// Self 为 const 时第 I 个 aspect 也为 const。
+        template <std::size_t I, typename Self>
+        using AspectOf = std::conditional_t<std::is_const_v<Self>, const AOP_SlotType<I, Aspects...>,
+                                            AOP_SlotType<I, Aspects...>>;
+
+        /// 由外向内（下标从小到大）调用 before(const Args &...) 或 before()。
+        template <typename...Args>
+        constexpr void invoke_before(const Args &...args) {
+            (AOP_Hooks::before(Slot<Index>::get_aspect(), args...), ...);
         };
 
-        constexpr void invoke_before() const {
-            if constexpr (CallableExitChecker<const Aspect>::has_before_callable)
-                _aspect.before();
-            ParentClass::invoke_before();
+        template <typename...Args>
+        constexpr void invoke_before(const Args &...args) const {
+            (AOP_Hooks::before(Slot<Index>::get_aspect(), args...), ...);
         };
 
+        /// 由内向外（下标从大到小）调用 after()。
         constexpr void invoke_after() {
-            ParentClass::invoke_after();
-            if constexpr (CallableExitChecker<Aspect>::has_after_callable)
-                _aspect.after();
+            (AOP_Hooks::after(Slot<sizeof...(Index) - 1 - Index>::get_aspect()), ...);
         };
 
         constexpr void invoke_after() const {
-            ParentClass::invoke_after();
-            if constexpr (CallableExitChecker<const Aspect>::has_after_callable)
-                _aspect.after();
+            (AOP_Hooks::after(Slot<sizeof...(Index) - 1 - Index>::get_aspect()), ...);
+        };
+
+        /// 由内向外调用 after(const R &) 或 after()。
+        template <typename R>
+        constexpr void invoke_after(const R &result) {
+            (AOP_Hooks::after(Slot<sizeof...(Index) - 1 - Index>::get_aspect(), result), ...);
+        };
+
+        template <typename R>
+        constexpr void invoke_after(const R &result) const {
+            (AOP_Hooks::after(Slot<sizeof...(Index) - 1 - Index>::get_aspect(), result), ...);
         };
 
+        /// 与 invoke_before、invoke_after 相同，但会把 context 传给需要它的切入函数。
         template <typename...Args>
-        auto handle_error(Args &&...args) {
-            if constexpr (CallableExitChecker<Aspect>::has_error_callable) {
-                try {
-                    return ParentClass::handle_error(std::forward<Args>(args)...);
-                } catch (...) {
-                    _aspect.error(std::current_exception());
-                    throw;
-                }
+        constexpr void invoke_before_in(const InvocationContext &context, const Args &...args) {
+            (AOP_Hooks::before_in(Slot<Index>::get_aspect(), context, args...), ...);
+        };
+
+        template <typename...Args>
+        constexpr void invoke_before_in(const InvocationContext &context, const Args &...args) const {
+            (AOP_Hooks::before_in(Slot<Index>::get_aspect(), context, args...), ...);
+        };
+
+        constexpr void invoke_after_in(const InvocationContext &context) {
+            (AOP_Hooks::after_in(Slot<sizeof...(Index) - 1 - Index>::get_aspect(), context), ...);
+        };
+
+        constexpr void invoke_after_in(const InvocationContext &context) const {
+            (AOP_Hooks::after_in(Slot<sizeof...(Index) - 1 - Index>::get_aspect(), context), ...);
+        };
+
+        template <typename R>
+        constexpr void invoke_after_in(const InvocationContext &context, const R &result) {
+            (AOP_Hooks::after_in(Slot<sizeof...(Index) - 1 - Index>::get_aspect(), context, result), ...);
+        };
+
+        template <typename R>
+        constexpr void invoke_after_in(const InvocationContext &context, const R &result) const {
+            (AOP_Hooks::after_in(Slot<sizeof...(Index) - 1 - Index>::get_aspect(), context, result), ...);
+        };
+
+        /// 是否存在需要 InvocationContext 的切入函数，只有存在时 invoke 才会构造它。
+        template <typename Self, typename R, typename...Args>
+        static constexpr bool has_context() {
+            return (AOP_Hooks::has_context<std::conditional_t<std::is_const_v<Self>, const Aspects, Aspects>,
+                                           R, Args...>() || ...);
+        };
+
+        /*
+         * 由外向内（下标从 I 开始）调用 around(next, args...)，最内层为被调用函数，没有 around() 的 aspect 会被跳过。
+         * next() 继续调用内层的 around() 或被调用函数，可以调用零次或多次（每次都会重新转发 args，注意右值参数），
+         * around() 的返回值会被转换为被调用函数的返回值类型。所有 around() 都在 before() 之后、after() 之前运行，
+         * 其中抛出的异常与被调用函数抛出的异常一样交给 error() 处理。
+         */
+        template <std::size_t I, typename Self, typename Fun, typename...Args>
+        static decltype(auto) invoke_around(Self &self, Fun &&fun, Args &&...args) {
+            using Result = decltype(AOP_Hooks::call(std::forward<Fun>(fun), std::forward<Args>(args)...));
+            if constexpr (!has_around<I, Self, Result, Args...>()) {
+                return AOP_Hooks::call(std::forward<Fun>(fun), std::forward<Args>(args)...);
+            } else if constexpr (!AOP_Hooks::has_around<AspectOf<I, Self>, Result, Args...>()) {
+                return invoke_around<I + 1>(self, std::forward<Fun>(fun), std::forward<Args>(args)...);
             } else {
-                return ParentClass::handle_error(std::forward<Args>(args)...);
+                auto next = [&]() -> Result {
+                    return invoke_around<I + 1>(self, std::forward<Fun>(fun), std::forward<Args>(args)...);
+                };
+                static_assert(AOP_Hooks::around_result_valid<Result, decltype(self.template get_aspect<I>().around(
+                                                                 next, std::as_const(args)...))>(),
+                              "around() must return a reference to the same type when the callee returns a reference");
+                return static_cast<Result>(self.template get_aspect<I>().around(next, std::as_const(args)...));
             }
-        }
+        };
 
-        template <typename...Args>
-        auto handle_error(Args &&...args) const {
-            if constexpr (CallableExitChecker<const Aspect>::has_error_callable) {
-                try {
-                    return ParentClass::handle_error(std::forward<Args>(args)...);
-                } catch (...) {
-                    _aspect.error(std::current_exception());
-                    throw;
-                }
+        /// 下标不小于 I 的 aspect 中是否存在 around()。
+        template <std::size_t I, typename Self, typename R, typename...Args>
+        static constexpr bool has_around() {
+            if constexpr (I == sizeof...(Index)) {
+                return false;
             } else {
-                return ParentClass::handle_error(std::forward<Args>(args)...);
+                return AOP_Hooks::has_around<AspectOf<I, Self>, R, Args...>()
+                    || has_around<I + 1, Self, R, Args...>();
             }
-        }
+        };
 
-    private:
-        Aspect _aspect;
+        /// 存在 after(const R &) 时，invoke 需要先得到返回值再调用 after()。
+        template <typename Self, typename R>
+        static constexpr bool check_after() {
+            if constexpr (std::is_void_v<R>) {
+                return false;
+            } else {
+                return ((AOP_Hooks::has_after_result<std::conditional_t<std::is_const_v<Self>, const Aspects, Aspects>,
+                                                     std::__remove_cvref_t<R>>()
+                    || AOP_Hooks::has_after_context_result<std::conditional_t<std::is_const_v<Self>, const Aspects, Aspects>,
+                                                           R>()) || ...);
+            }
+        };
 
-    };
+        /// 由外向内调用 before_batch(count)。
+        constexpr void invoke_before_batch(std::size_t count) {
+            (AOP_Hooks::before_batch(Slot<Index>::get_aspect(), count), ...);
+        };
 
-    /// AOP_impl 继承终止。
-    template <std::size_t Index, typename Aspect_>
-    class AOP_impl<Index, Aspect_> {
-    public:
-        using AOP_Type = AOP_impl;
+        constexpr void invoke_before_batch(std::size_t count) const {
+            (AOP_Hooks::before_batch(Slot<Index>::get_aspect(), count), ...);
+        };
 
-        using AOP_ConstType = const AOP_Type;
+        /// 由内向外调用 after_batch(count)。
+        constexpr void invoke_after_batch(std::size_t count) {
+            (AOP_Hooks::after_batch(Slot<sizeof...(Index) - 1 - Index>::get_aspect(), count), ...);
+        };
 
-        using Aspect = Aspect_;
+        constexpr void invoke_after_batch(std::size_t count) const {
+            (AOP_Hooks::after_batch(Slot<sizeof...(Index) - 1 - Index>::get_aspect(), count), ...);
+        };
 
-        using ConstAspect = const Aspect_;
+        /// 是否存在批量切入函数。
+        template <typename Self>
+        static constexpr bool has_batch() {
+            return (AOP_Hooks::has_batch<std::conditional_t<std::is_const_v<Self>, const Aspects, Aspects>>() || ...);
+        };
 
-        constexpr AOP_impl(): _aspect() {};
+        /// 是否所有 aspect 都只有批量切入函数（策略除外），此时 invoke_batch 逐个元素调用时不需要运行任何切入函数。
+        template <typename Self>
+        static constexpr bool all_batch() {
+            return ((AOP_Hooks::has_batch<std::conditional_t<std::is_const_v<Self>, const Aspects, Aspects>>()
+                || AOP_IsPolicy<std::remove_const_t<Aspects>>::value) && ...);
+        };
 
-        constexpr explicit AOP_impl(const Aspect &aspect) : _aspect(aspect) {};
+        /// 存在批量切入函数的 aspect 中是否存在 error()。
+        template <typename Self>
+        static constexpr bool has_batch_error() {
+            return ((AOP_Hooks::has_batch<std::conditional_t<std::is_const_v<Self>, const Aspects, Aspects>>()
+                && AOP_Hooks::has_error<std::conditional_t<std::is_const_v<Self>, const Aspects, Aspects>>()) || ...);
+        };
 
-        template <typename Arg>
-        constexpr explicit AOP_impl(Arg &&aspect) : _aspect(std::forward<Arg>(aspect)) {};
+        /// invoke_batch 逐个元素调用时使用的 AOP，其中的 aspect 为本对象中 aspect 的引用。
+        template <typename Self>
+        using ElementView = AOP<AOP_ElementOf<std::conditional_t<std::is_const_v<Self>, const Aspects, Aspects>>...>;
 
-        template <typename Arg>
-        constexpr AOP_impl(const AOP_impl<Index, Arg> &other) : _aspect(other.get_aspect()) {};
+        template <typename Self>
+        static ElementView<Self> element_view(Self &self) {
+            return ElementView<Self>(self.template get_aspect<Index>()...);
+        };
 
-        template <typename Arg>
-        constexpr AOP_impl(AOP_impl<Index, Arg> &&other) : _aspect(std::move(other.get_aspect())) {};
+        /// 对于被调用者 Fun，是否所有 aspect 都匹配（没有声明 pointcut 的 aspect 总是匹配）。
+        template <typename Fun>
+        static constexpr bool all_apply() {
+            return (AOP_applies<AOP_SlotType<Index, Aspects...>, Fun>() && ...);
+        };
 
-        constexpr AOP_impl(const AOP_impl &other) : _aspect(other.get_aspect()) {};
+        /// 是否存在匹配 Fun 的 aspect，不存在时 invoke 直接调用 Fun。
+        template <typename Fun>
+        static constexpr bool any_apply() {
+            return (AOP_applies<AOP_SlotType<Index, Aspects...>, Fun>() || ...);
+        };
 
-        constexpr AOP_impl& operator=(const AOP_impl &other) {
-            _aspect = other.get_aspect();
-            return *this;
+        template <typename Self, typename Kept, typename Policies = AOP_PolicyTuple<Aspects...>>
+        struct PointcutView_;
+
+        template <typename Self, std::size_t...I, typename...Policies>
+        struct PointcutView_<Self, std::index_sequence<I...>, std::tuple<Policies...>> {
+            using type = AOP<AOP_RefOf<AspectOf<I, Self>>..., Policies...>;
+
+            static type make(Self &self) { return type(self.template get_aspect<I>()...); };
         };
 
-        constexpr AOP_impl(AOP_impl &&other)
-            noexcept(std::is_nothrow_move_constructible_v<Aspect>)
-            : _aspect(std::move(other.get_aspect())) {};
+        /// 只由匹配 Fun 的 aspect（以及策略）组成的 AOP，其中的 aspect 为本对象中 aspect 的引用。
+        template <typename Self, typename Fun>
+        using PointcutView = PointcutView_<Self, typename AOP_KeptIndices<
+            AOP_applies<AOP_SlotType<Index, Aspects...>, Fun>()...>::type>;
 
-        constexpr AOP_impl& operator=(AOP_impl &&other)
-            noexcept(std::is_nothrow_move_assignable_v<Aspect>) = default;
+        /// 是否存在 idle() 的 aspect，存在时 invoke 先检查它们是否都处于空闲状态。
+        static constexpr bool has_idle() {
+            return (AOP_Hooks::has_idle<AOP_SlotType<Index, Aspects...>>() || ...);
+        };
 
-        constexpr Aspect& get_aspect() {
-            return _aspect;
+        /// 是否所有 aspect 都存在 idle()，此时 BusyView 中没有 aspect。
+        static constexpr bool all_have_idle() {
+            return (AOP_Hooks::has_idle<AOP_SlotType<Index, Aspects...>>() && ...);
         };
 
-        constexpr ConstAspect& get_aspect() const {
-            return _aspect;
+        /// 存在 idle() 的 aspect 是否都处于空闲状态。
+        constexpr bool all_idle() const {
+            return (idle_at<Index>() && ...);
         };
 
-    protected:
-        constexpr void invoke_before() {
-            if constexpr (CallableExitChecker<Aspect>::has_before_callable)
-                _aspect.before();
+        template <std::size_t I>
+        constexpr bool idle_at() const {
+            if constexpr (AOP_Hooks::has_idle<AOP_SlotType<I, Aspects...>>())
+                return Slot<I>::get_aspect().idle();
+            else
+                return true;
         };
 
-        constexpr void invoke_before() const {
-            if constexpr (CallableExitChecker<const Aspect>::has_before_callable)
-                _aspect.before();
+        /// 去掉存在 idle() 的 aspect 后（保留策略）的 AOP，其中的 aspect 为本对象中 aspect 的引用。
+        template <typename Self>
+        using BusyView = PointcutView_<Self, typename AOP_KeptIndices<
+            !AOP_Hooks::has_idle<AOP_SlotType<Index, Aspects...>>()...>::type>;
+
+        /// 是否为 ElementView 或 PointcutView，它们只在一次调用中存在。
+        static constexpr bool is_view() {
+            return ((AOP_IsElementRef<Aspects>::value || AOP_IsPolicy<Aspects>::value) && ...);
         };
 
-        constexpr void invoke_after() {
-            if constexpr (CallableExitChecker<Aspect>::has_after_callable)
-                _aspect.after();
+        /// 把 other（worker 使用的 AOP）中存在 merge() 的 aspect 合并到本对象的 aspect 中。
+        constexpr void merge_from(const AOP_impl &other) {
+            (AOP_Hooks::merge(Slot<Index>::get_aspect(), static_cast<const Slot<Index>&>(other).get_aspect()), ...);
         };
 
-        constexpr void invoke_after() const {
-            if constexpr (CallableExitChecker<const Aspect>::has_after_callable)
-                _aspect.after();
+        /// 由内向外调用 destroy()。
+        constexpr void invoke_destroy() {
+            (AOP_Hooks::destroy(Slot<sizeof...(Index) - 1 - Index>::get_aspect()), ...);
         };
 
-        template <typename FunPtr, typename...Args>
-        auto handle_error(FunPtr &&ptr, Args &&...args) {
-            if constexpr (CallableExitChecker<Aspect>::has_error_callable) {
-                if constexpr (CallableChecker<FunPtr, Args...>::common_callable) {
-                    try {
-                        return ptr(std::forward<Args>(args)...);
-                    } catch (...) {
-                        _aspect.error(std::current_exception());
-                        throw;
-                    }
-                } else if (MemberFunPtrCallable<FunPtr, Args...>::callable) {
-                    try {
-                        return member_FunPtr_invoke(std::forward<FunPtr>(ptr), std::forward<Args>(args)...);
-                    } catch (...) {
-                        _aspect.error(std::current_exception());
-                        throw;
-                    }
-                } else {
-                    static_assert(CallableChecker<FunPtr, Args...>::common_callable ||
-                                  MemberFunPtrCallable<FunPtr, Args...>::callable,
-                                  "unknown type or wrong input");
-                }
-            } else {
-                if constexpr (CallableChecker<FunPtr, Args...>::common_callable) {
-                    return ptr(std::forward<Args>(args)...);
-                } else if (MemberFunPtrCallable<FunPtr, Args...>::callable) {
-                    return member_FunPtr_invoke(std::forward<FunPtr>(ptr), std::forward<Args>(args)...);
-                } else {
-                    static_assert(CallableChecker<FunPtr, Args...>::common_callable ||
-                                  MemberFunPtrCallable<FunPtr, Args...>::callable,
-                                  "unknown type or wrong input");
-                }
-            }
+        /// 是否启用了 AOP_ConstOnly，此时非 const 的调用也按 const 的方式进行。
+        static constexpr bool const_only() {
+            return AOP_has_policy<AOP_ConstOnly, Aspects...>();
         };
 
-        template <typename FunPtr, typename...Args>
-        auto handle_error(FunPtr &&ptr, Args &&...args) const {
-            if constexpr (CallableExitChecker<const Aspect>::has_error_callable) {
-                if constexpr (CallableChecker<FunPtr, Args...>::common_callable) {
-                    try {
-                        return ptr(std::forward<Args>(args)...);
-                    } catch (...) {
-                        _aspect.error(std::current_exception());
-                        throw;
-                    }
-                } else if (MemberFunPtrCallable<FunPtr, Args...>::callable) {
-                    try {
-                        return member_FunPtr_invoke(std::forward<FunPtr>(ptr), std::forward<Args>(args)...);
-                    } catch (...) {
-                        _aspect.error(std::current_exception());
-                        throw;
-                    }
-                } else {
-                    static_assert(CallableChecker<FunPtr, Args...>::common_callable ||
-                                  MemberFunPtrCallable<FunPtr, Args...>::callable,
-                                  "unknown type or wrong input");
-                }
-            } else {
-                if constexpr (CallableChecker<FunPtr, Args...>::common_callable) {
-                    return ptr(std::forward<Args>(args)...);
-                } else if (MemberFunPtrCallable<FunPtr, Args...>::callable) {
-                    return member_FunPtr_invoke(std::forward<FunPtr>(ptr), std::forward<Args>(args)...);
-                } else {
-                    static_assert(CallableChecker<FunPtr, Args...>::common_callable ||
-                                  MemberFunPtrCallable<FunPtr, Args...>::callable,
-                                  "unknown type or wrong input");
-                }
-            }
+        /// 对于参数 Args 和返回值 R，所有 aspect 中可以被调用的切入函数都存在 const 的版本。
+        template <typename R, typename...Args>
+        static constexpr bool const_callable() {
+            return (AOP_Hooks::const_callable<Aspects, R, Args...>() && ...);
         };
 
-        template <typename FunPtr, typename Invoker, typename...Args>
-        auto member_FunPtr_invoke(FunPtr fun_ptr, Invoker invoker, Args &&...args) {
-            if constexpr (MemberFunPtrCallable<FunPtr, Invoker, Args...>::ptr_callable) {
-                return (invoker->*fun_ptr)(std::forward<Args>(args)...);
-            } else {
-                return (invoker.*fun_ptr)(std::forward<Args>(args)...);
-            }
+        /// 是否存在 error()，只有存在时 invoke 才需要捕获异常。
+        template <typename Self>
+        static constexpr bool has_error() {
+            return (AOP_Hooks::has_error<std::conditional_t<std::is_const_v<Self>, const Aspects, Aspects>>()
+                || ...);
         };
 
-        template <typename FunPtr, typename Invoker, typename...Args>
-        auto member_FunPtr_invoke(FunPtr fun_ptr, Invoker invoker, Args &&...args) const {
-            if constexpr (MemberFunPtrCallable<FunPtr, Invoker, Args...>::ptr_callable) {
-                return (invoker->*fun_ptr)(std::forward<Args>(args)...);
+        /// 启用了 AOP_ResultErrors 且存在可以处理返回值 R 的 aspect 时，invoke 才需要检查返回值。
+        template <typename Self, typename R>
+        static constexpr bool check_result() {
+            if constexpr (std::is_void_v<typename AOP_ResultPolicy<Aspects...>::type> || std::is_void_v<R>) {
+                return false;
             } else {
-                return (invoker.*fun_ptr)(std::forward<Args>(args)...);
+                return (AOP_Hooks::has_result_error<std::conditional_t<std::is_const_v<Self>, const Aspects, Aspects>,
+                                                    std::__remove_cvref_t<R>>() || ...);
             }
         };
 
-    private:
-        Aspect _aspect;
+        /// 返回值是否被 AOP_ResultErrors 判断为失败。
+        template <typename R>
+        static constexpr bool result_failed(const R &result) {
+            return typename AOP_ResultPolicy<Aspects...>::type::Predicate()(result);
+        };
+
+        /// 由内向外调用 error(const R &)。
+        template <typename R>
+        constexpr void notify_result(const R &result) {
+            (AOP_Hooks::result_error(Slot<sizeof...(Index) - 1 - Index>::get_aspect(), result), ...);
+        };
+
+        template <typename R>
+        constexpr void notify_result(const R &result) const {
+            (AOP_Hooks::result_error(Slot<sizeof...(Index) - 1 - Index>::get_aspect(), result), ...);
+        };
+
+#ifdef AOP_HAS_EXCEPTIONS
+        /// 由 invoke 中 catch 到的异常调用 error() 时使用的 AOP_CurrentError。
+        template <typename Self>
+        using ErrorCache = AOP_ErrorCache<std::conditional_t<std::is_const_v<Self>, const Aspects, Aspects>...>;
+
+        /// 由内向外调用 error()，所有 aspect 共享同一个 AOP_CurrentError，异常只会在 invoke 中重新抛出一次。
+        /// 如果某个 error() 抛出了异常，剩余的 error() 不再被调用。该函数只在异常路径上运行，因此不内联并标记为冷代码。
+        AOP_COLD void notify_error(const std::exception* std_error) {
+            typename ErrorCache<AOP_impl>::type error(std_error);
+            (AOP_Hooks::error(Slot<sizeof...(Index) - 1 - Index>::get_aspect(), error), ...);
+        };
+
+        AOP_COLD void notify_error(const std::exception* std_error) const {
+            typename ErrorCache<const AOP_impl>::type error(std_error);
+            (AOP_Hooks::error(Slot<sizeof...(Index) - 1 - Index>::get_aspect(), error), ...);
+        };
+
+        /// invoke_batch 中的异常只通知存在批量切入函数的 aspect，其他 aspect 已经在逐个元素的 invoke 中得到了通知。
+        AOP_COLD void notify_batch_error(const std::exception* std_error) {
+            typename ErrorCache<AOP_impl>::type error(std_error);
+            (batch_error(Slot<sizeof...(Index) - 1 - Index>::get_aspect(), error), ...);
+        };
+
+        AOP_COLD void notify_batch_error(const std::exception* std_error) const {
+            typename ErrorCache<const AOP_impl>::type error(std_error);
+            (batch_error(Slot<sizeof...(Index) - 1 - Index>::get_aspect(), error), ...);
+        };
+
+        template <typename Aspect, typename Current>
+        static void batch_error(Aspect &aspect, Current &current) {
+            if constexpr (AOP_Hooks::has_batch<Aspect>())
+                AOP_Hooks::error(aspect, current);
+        };
+#endif
 
     };
 
 //------------------------------------------------------------------------------------------------
 
-    /// 用于转换 AOP 到指定位置的 AOP_impl。
-    template <std::size_t Index, typename Head, typename...Args>
-    constexpr typename AOP_impl<Index, Head, Args...>::AOP_Type&
-    AOP_cast(AOP_impl<Index, Head, Args...> &aop_impl) {
+    /// 用于转换 AOP 到指定位置的 AOP_Slot。
+    template <std::size_t Index, typename Indices, typename...Aspects>
+    constexpr typename AOP_impl<Indices, Aspects...>::template Slot<Index>&
+    AOP_cast(AOP_impl<Indices, Aspects...> &aop_impl) {
         return aop_impl;
     };
 
-    template <std::size_t Index, typename Head, typename...Args>
-    constexpr typename AOP_impl<Index, Head, Args...>::AOP_ConstType&
-    AOP_cast(const AOP_impl<Index, Head, Args...> &aop_impl) {
+    template <std::size_t Index, typename Indices, typename...Aspects>
+    constexpr const typename AOP_impl<Indices, Aspects...>::template Slot<Index>&
+    AOP_cast(const AOP_impl<Indices, Aspects...> &aop_impl) {
         return aop_impl;
     };
 
-    template <std::size_t Index, typename Head, typename...Args>
-    constexpr typename AOP_impl<Index, Head, Args...>::AOP_Type*
-    AOP_cast(AOP_impl<Index, Head, Args...>* aop_impl) {
+    template <std::size_t Index, typename Indices, typename...Aspects>
+    constexpr typename AOP_impl<Indices, Aspects...>::template Slot<Index>*
+    AOP_cast(AOP_impl<Indices, Aspects...>* aop_impl) {
         return aop_impl;
     };
 
-    template <std::size_t Index, typename Head, typename...Args>
-    constexpr typename AOP_impl<Index, Head, Args...>::AOP_ConstType*
-    AOP_cast(const AOP_impl<Index, Head, Args...>* aop_impl) {
+    template <std::size_t Index, typename Indices, typename...Aspects>
+    constexpr const typename AOP_impl<Indices, Aspects...>::template Slot<Index>*
+    AOP_cast(const AOP_impl<Indices, Aspects...>* aop_impl) {
         return aop_impl;
     };
 
-    template <std::size_t Index, typename Head, typename...Args>
+    template <std::size_t Index, typename...Aspects>
     struct AOP_traits {
-        using AOP_Type = typename std::remove_reference_t<
-            decltype(AOP_cast<Index>(std::declval<AOP_impl<0, Head, Args...>>()))>::AOP_Type;
+        using AOP_Type = AOP_SlotAt<Index, Aspects...>;
         using AOP_ConstType = typename AOP_Type::AOP_ConstType;
         using Aspect = typename AOP_Type::Aspect;
         using ConstAspect = typename AOP_Type::ConstAspect;
@@ -436,19 +1904,40 @@ namespace Base {
 
 //------------------------------------------------------------------------------------------------
 
-    /// 用于推断 AOP 的构造函数是否可以声明为 explict。
+    /// 以 Args 依次构造 Slots 时的检查，两者个数不同时都为 false。
+    template <typename Slots, typename Args, bool = std::tuple_size_v<Slots> == std::tuple_size_v<Args>>
+    struct AOP_SlotConstraints {
+        static constexpr bool constructible = false;
+        static constexpr bool convertible = false;
+        static constexpr bool nothrow = false;
+    };
+
+    template <typename...Slots, typename...Args>
+    struct AOP_SlotConstraints<std::tuple<Slots...>, std::tuple<Args...>, true> {
+        static constexpr bool constructible = std::__and_v<std::is_constructible<Slots, Args>...>;
+        static constexpr bool convertible = std::__and_v<std::is_convertible<Args, Slots>...>;
+        static constexpr bool nothrow = std::__and_v<std::is_nothrow_constructible<Slots, Args>...>;
+    };
+
+    /// 用于推断 AOP 的构造函数是否可以声明为 explict。策略不需要构造参数，Args 中的策略（例如另一个 AOP 的 Aspects 中的策略）被忽略。
     template <bool, typename...Aspects>
     struct AOPConstraints {
+        template <typename...Args>
+        using Slots = AOP_SlotConstraints<AOP_SlotTuple<Aspects...>, AOP_SlotTuple<Args...>>;
+
         template <typename...Args>
         static constexpr bool is_implicitly_constructible() {
-            return std::__and_v<std::is_constructible<Aspects, Args>...,
-                                std::is_convertible<Args, Aspects>...>;
+            return Slots<Args...>::constructible && Slots<Args...>::convertible;
         };
 
         template <typename...Args>
         static constexpr bool is_explicitly_constructible() {
-            return std::__and_v<std::is_constructible<Aspects, Args>...,
-                                std::__not_<std::__and_<std::is_convertible<Args, Aspects>...>>>;
+            return Slots<Args...>::constructible && !Slots<Args...>::convertible;
+        };
+
+        template <typename...Args>
+        static constexpr bool is_nothrow_constructible() {
+            return Slots<Args...>::nothrow;
         };
 
         static constexpr bool is_implicitly_default_constructible() {
@@ -479,7 +1968,7 @@ namespace Base {
 
     /// AOP 模板
     template <typename...Aspects>
-    class AOP : public AOP_impl<0, Aspects...> {
+    class AOP : public AOP_impl<std::make_index_sequence<AOP_slot_count<Aspects...>()>, Aspects...> {
         static_assert(sizeof...(Aspects) > 0, "AOP must have at least one argument");
 
         template <bool Cond>
@@ -519,14 +2008,492 @@ namespace Base {
             return !UseOther<OtherAOP>::value;
         };
 
-        template <typename Arg>
+        /// 参数与 aspect（不包括策略）一一对应，只有一个参数时不能是 AOP 本身（由复制/移动构造函数处理）。
+        template <typename...Args>
         static constexpr bool valid_args() {
-            return sizeof...(Aspects) == 1 && !std::is_same_v<AOP, std::__remove_cvref_t<Arg>>;
+            return AOP_slot_count<Aspects...>() == sizeof...(Args)
+                && (sizeof...(Args) != 1 || !(std::is_same_v<AOP, std::__remove_cvref_t<Args>> || ...));
         };
 
-        template <typename...Args>
-        static constexpr bool valid_args() {
-            return sizeof...(Aspects) == sizeof...(Args);
+        /// 在 invoke 的返回值构造完成后调用 after() 并恢复 AOPthreadLoc，
+        /// 这样 invoke 可以直接返回被调用函数的结果而不需要先保存它。只有被调用函数正常返回后才会调用 after()。
+        /// Context 为 true 时同时持有本次调用的 InvocationContext，并把它传给 before() 和 after()。
+        template <typename Self, bool Context>
+        class AfterGuard {
+        public:
+            AfterGuard(Self &self, const SourceLocation* location) noexcept : _self(self), _holder(location) {};
+
+            AfterGuard(const AfterGuard &) = delete;
+
+            AfterGuard& operator=(const AfterGuard &) = delete;
+
+            ~AfterGuard() noexcept(false) {
+                if (_armed) {
+                    if constexpr (Context)
+                        _self.invoke_after_in(_holder.finish());
+                    else
+                        _self.invoke_after();
+                }
+#ifdef AOP_WILL_USE_SOURCE_LOCATION
+                AOPthreadLoc = _save;
+#endif
+            };
+
+            template <typename...Args>
+            void before(const Args &...args) {
+                if constexpr (Context)
+                    _self.invoke_before_in(_holder.context(), args...);
+                else
+                    _self.invoke_before(args...);
+            };
+
+            /// 代替析构函数调用 after(const R &)。
+            template <typename R>
+            void after(const R &result) {
+                if constexpr (Context)
+                    _self.invoke_after_in(_holder.finish(), result);
+                else
+                    _self.invoke_after(result);
+            };
+
+            void arm() noexcept { _armed = true; };
+
+            /// 返回之前是否处于 armed 状态。
+            bool disarm() noexcept { return std::exchange(_armed, false); };
+
+        private:
+            Self &_self;
+            bool _armed = false;
+#ifdef AOP_WILL_USE_SOURCE_LOCATION
+            SourceLocation _save = AOPthreadLoc;
+#endif
+            AOP_NO_UNIQUE_ADDRESS AOP_ContextHolder<Context> _holder;
+        };
+
+        /// 启用了 AOP_ConstOnly 时非 const 的调用转为 const 的调用。
+        template <typename Self>
+        static constexpr bool as_const_call() {
+            return ParentClass::const_only() && !std::is_const_v<Self>;
+        };
+
+        /// invoke 和 invoke_at 的实现，location 为 nullptr 时调用位置未知。
+        template <typename Self, typename Fun, typename...FunArgs>
+        static decltype(auto) invoke_in(Self &self, const SourceLocation* location, Fun &&fun, FunArgs &&...args) {
+            using Result = decltype(AOP_Hooks::call(std::forward<Fun>(fun), std::forward<FunArgs>(args)...));
+            if constexpr (as_const_call<Self>()) {
+                return invoke_in(std::as_const(self), location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            } else {
+                if constexpr (ParentClass::const_only()) {
+                    static_assert(ParentClass::template const_callable<Result, FunArgs...>(),
+                                  "AOP_ConstOnly: an aspect has a hook that is callable only on a non-const aspect");
+                }
+                if constexpr (!ParentClass::template all_apply<Fun>()) {
+                    return invoke_pointcut(self, location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+                } else {
+                    if constexpr (ParentClass::has_idle()) {
+                        if (self.all_idle())
+                            return invoke_busy(self, location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+                    }
+                    AfterGuard<Self, ParentClass::template has_context<Self, Result, FunArgs...>()> guard(self, location);
+#ifdef AOP_WILL_USE_SOURCE_LOCATION
+                    if constexpr (!std::is_const_v<Self>)
+                        AOPthreadLoc = SourceLocation();
+#endif
+                    guard.before(args...);
+                    return invoke_target(self, guard, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+                }
+            }
+        };
+
+        /// 存在不匹配 Fun 的 pointcut 时由 PointcutView 代为调用，没有匹配的 aspect 时直接调用 Fun。
+        template <typename Self, typename Fun, typename...FunArgs>
+        static decltype(auto) invoke_pointcut(Self &self, const SourceLocation* location, Fun &&fun, FunArgs &&...args) {
+            if constexpr (!ParentClass::template any_apply<Fun>()) {
+                return AOP_Hooks::call(std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            } else {
+                using View = typename ParentClass::template PointcutView<Self, Fun>;
+                std::conditional_t<std::is_const_v<Self>, const typename View::type, typename View::type> view =
+                    View::make(self);
+                if (location)
+                    return view.invoke_at(*location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+                return view.invoke(std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            }
+        };
+
+        /// 存在 idle() 的 aspect 都处于空闲状态时，由不包含它们的 BusyView 代为调用，因此不需要为它们捕获异常或保存返回值。
+        template <typename Self, typename Fun, typename...FunArgs>
+        static decltype(auto) invoke_busy(Self &self, const SourceLocation* location, Fun &&fun, FunArgs &&...args) {
+            if constexpr (ParentClass::all_have_idle()) {
+                return AOP_Hooks::call(std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            } else {
+                using View = typename ParentClass::template BusyView<Self>;
+                std::conditional_t<std::is_const_v<Self>, const typename View::type, typename View::type> view =
+                    View::make(self);
+                if (location)
+                    return view.invoke_at(*location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+                return view.invoke(std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            }
+        };
+
+        /// invoke_async 交给 AOP_AsyncAdapter 的回调，与异步结果保存在一起（因此 Self 必须比异步操作活得更久），
+        /// 在异步操作完成的线程中调用 after() 或 error()，期间 AOPthreadLoc 为发起调用时的 location。
+        template <typename Self>
+        class AsyncCompletion {
+        public:
+            AsyncCompletion(Self &self, const InvocationContext &context) : _self(hold(self)), _context(context) {};
+
+            /// before() 也使用这里保存的上下文，这样 before() 中读取的 start() 随 completion 一起被复制。
+            [[nodiscard]] const InvocationContext& context() const { return _context; };
+
+            void success() {
+                LocationScope scope(_context.location);
+                self().invoke_after_in(_context);
+            };
+
+            /// 启用了 AOP_ResultErrors 且结果被判断为失败时调用 error(const R &)，不再调用 after()。
+            template <typename R>
+            void success(const R &result) {
+                LocationScope scope(_context.location);
+                if constexpr (ParentClass::template check_result<Self, R>()) {
+                    if (ParentClass::result_failed(result)) {
+                        self().notify_result(result);
+                        return;
+                    }
+                }
+                self().invoke_after_in(_context, result);
+            };
+
+#ifdef AOP_HAS_EXCEPTIONS
+            /// 只能在 catch 块中调用。
+            void failure(const std::exception* std_error) {
+                if constexpr (ParentClass::template has_error<Self>()) {
+                    LocationScope scope(_context.location);
+                    self().notify_error(std_error);
+                }
+            };
+#endif
+
+        private:
+            /// 在回调期间把 AOPthreadLoc 换成发起调用时的位置。
+            class LocationScope {
+            public:
+#ifdef AOP_WILL_USE_SOURCE_LOCATION
+                explicit LocationScope(const SourceLocation &location) : _save(AOPthreadLoc) {
+                    AOPthreadLoc = location;
+                };
+
+                ~LocationScope() { AOPthreadLoc = _save; };
+
+            private:
+                SourceLocation _save;
+#else
+                explicit LocationScope(const SourceLocation &) {};
+#endif
+            };
+
+            /// PointcutView 在 invoke_async 返回时就已销毁，因此按值保存（其中只有引用），其他 AOP 只保存指针。
+            static constexpr bool by_value = AOP_impl<std::make_index_sequence<AOP_slot_count<Aspects...>()>, Aspects...>::is_view();
+
+            using Holder = std::conditional_t<by_value, std::remove_const_t<Self>, Self*>;
+
+            static Holder hold(Self &self) {
+                if constexpr (by_value)
+                    return self;
+                else
+                    return &self;
+            };
+
+            Self& self() {
+                if constexpr (by_value)
+                    return _self;
+                else
+                    return *_self;
+            };
+
+            Holder _self;
+            InvocationContext _context;
+        };
+
+        /// invoke_async 和 invoke_async_at 的实现，返回值不是异步结果时与 invoke_in 相同。
+        /// 被调用函数同步抛出的异常与 invoke 一样交给 error()，之后的 after() 和 error() 由 AOP_AsyncAdapter 在异步结果完成时调用。
+        template <typename Self, typename Fun, typename...FunArgs>
+        static decltype(auto) invoke_async_in(Self &self, const SourceLocation* location, Fun &&fun, FunArgs &&...args) {
+            using Result = decltype(AOP_Hooks::call(std::forward<Fun>(fun), std::forward<FunArgs>(args)...));
+            using Adapter = AOP_AsyncAdapter<std::__remove_cvref_t<Result>>;
+            if constexpr (as_const_call<Self>()) {
+                return invoke_async_in(std::as_const(self), location, std::forward<Fun>(fun),
+                                       std::forward<FunArgs>(args)...);
+            } else if constexpr (!Adapter::is_async) {
+                return invoke_in(self, location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            } else if constexpr (!ParentClass::template all_apply<Fun>()) {
+                if constexpr (!ParentClass::template any_apply<Fun>()) {
+                    return AOP_Hooks::call(std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+                } else {
+                    using View = typename ParentClass::template PointcutView<Self, Fun>;
+                    std::conditional_t<std::is_const_v<Self>, const typename View::type, typename View::type> view =
+                        View::make(self);
+                    if (location)
+                        return view.invoke_async_at(*location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+                    return view.invoke_async(std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+                }
+            } else {
+                if constexpr (ParentClass::const_only()) {
+                    static_assert(ParentClass::template const_callable<typename Adapter::Value, FunArgs...>(),
+                                  "AOP_ConstOnly: an aspect has a hook that is callable only on a non-const aspect");
+                }
+                AOP_ContextHolder<true> holder(location);
+                AsyncCompletion<Self> completion(self, holder.context());
+                self.invoke_before_in(completion.context(), args...);
+                return wrap_async<Adapter>(self, completion, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            }
+        };
+
+        template <typename Adapter, typename Self, typename Completion, typename...FunArgs>
+        static auto wrap_async(Self &self, Completion &completion, FunArgs &&...args) {
+#ifdef AOP_HAS_EXCEPTIONS
+            try {
+                return Adapter::wrap(ParentClass::template invoke_around<0>(self, std::forward<FunArgs>(args)...),
+                                     completion);
+            } catch (const std::exception &error) {
+                completion.failure(&error);
+                throw;
+            } catch (...) {
+                completion.failure(nullptr);
+                throw;
+            }
+#else
+            return Adapter::wrap(ParentClass::template invoke_around<0>(self, std::forward<FunArgs>(args)...),
+                                 completion);
+#endif
+        };
+
+        /*
+         * invoke_batch 的实现：存在批量切入函数的 aspect 只在整批的前后各调用一次 before_batch(count) 和 after_batch(count)，
+         * 出现异常时调用它们的 error() 并且不再调用 after_batch()；其他 aspect 仍然对每个元素运行（通过 ElementView）。
+         * 所有 aspect 都是批量的时，逐个元素的循环中没有任何切入函数，被调用函数可以被内联和向量化。
+         */
+        template <typename Self, typename Fun, typename Range, typename Out>
+        static Out invoke_batch_in(Self &self, Fun &fun, Range &range, Out out) {
+            using std::begin;
+            using std::end;
+            auto first = begin(range);
+            auto last = end(range);
+            if constexpr (as_const_call<Self>()) {
+                return invoke_batch_in(std::as_const(self), fun, range, std::move(out));
+            } else if constexpr (!ParentClass::template all_apply<Fun>() && !ParentClass::template any_apply<Fun>()) {
+                auto call = [&fun](auto &...args) -> decltype(auto) { return AOP_Hooks::call(fun, args...); };
+                for (; first != last; ++first) {
+                    auto &&element = *first;
+                    out = write_element(out, call, element);
+                }
+                return out;
+            } else if constexpr (!ParentClass::template all_apply<Fun>()) {
+                using View = typename ParentClass::template PointcutView<Self, Fun>;
+                std::conditional_t<std::is_const_v<Self>, const typename View::type, typename View::type> view =
+                    View::make(self);
+                return view.invoke_batch(fun, range, std::move(out));
+            } else if constexpr (!ParentClass::template has_batch<Self>()) {
+                return invoke_elements(self, fun, first, last, out);
+            } else {
+                if constexpr (ParentClass::const_only()) {
+                    using Element = std::remove_reference_t<decltype(*first)>;
+                    static_assert(decltype(AOP_apply_element(ConstCallableProbe<Fun>(), std::declval<Element&>()))::value,
+                                  "AOP_ConstOnly: an aspect has a hook that is callable only on a non-const aspect");
+                }
+                std::size_t count = std::distance(first, last);
+                self.invoke_before_batch(count);
+#ifdef AOP_HAS_EXCEPTIONS
+                if constexpr (ParentClass::template has_batch_error<Self>()) {
+                    try {
+                        out = run_batch(self, fun, first, last, out);
+                    } catch (const std::exception &error) {
+                        self.notify_batch_error(&error);
+                        throw;
+                    } catch (...) {
+                        self.notify_batch_error(nullptr);
+                        throw;
+                    }
+                } else {
+                    out = run_batch(self, fun, first, last, out);
+                }
+#else
+                out = run_batch(self, fun, first, last, out);
+#endif
+                self.invoke_after_batch(count);
+                return out;
+            }
+        };
+
+        /// AOP_ConstOnly 时检查 invoke_batch 中每个元素的调用：ElementView 只能看到 const 的切入函数，因此对原来的 aspect 检查。
+        template <typename Fun>
+        struct ConstCallableProbe {
+            template <typename...Args>
+            std::bool_constant<AOP_impl<std::make_index_sequence<AOP_slot_count<Aspects...>()>, Aspects...>::template const_callable<
+                decltype(AOP_Hooks::call(std::declval<Fun&>(), std::declval<Args&>()...)), Args...>()>
+            operator()(Args &...) const { return {}; };
+        };
+
+        template <typename Self, typename Fun, typename Iterator, typename Out>
+        static Out run_batch(Self &self, Fun &fun, Iterator first, Iterator last, Out out) {
+            if constexpr (ParentClass::template all_batch<Self>()) {
+                auto call = [&fun](auto &...args) -> decltype(auto) { return AOP_Hooks::call(fun, args...); };
+                for (; first != last; ++first) {
+                    auto &&element = *first;
+                    out = write_element(out, call, element);
+                }
+                return out;
+            } else {
+                std::conditional_t<std::is_const_v<Self>, const typename ParentClass::template ElementView<Self>,
+                                   typename ParentClass::template ElementView<Self>> view =
+                    ParentClass::element_view(self);
+                return invoke_elements(view, fun, first, last, out);
+            }
+        };
+
+        /// 对每个元素调用 self.invoke(fun, args...)。
+        template <typename Self, typename Fun, typename Iterator, typename Out>
+        static Out invoke_elements(Self &self, Fun &fun, Iterator first, Iterator last, Out out) {
+            auto call = [&self, &fun](auto &...args) -> decltype(auto) { return self.invoke(fun, args...); };
+            for (; first != last; ++first) {
+                auto &&element = *first;
+                out = write_element(out, call, element);
+            }
+            return out;
+        };
+
+        /// 调用 call 并把返回值写入 out，Out 为 AOP_NoOutput 时丢弃返回值。
+        template <typename Out, typename Call, typename Element>
+        static Out write_element(Out out, Call &call, Element &element) {
+            if constexpr (std::is_same_v<Out, AOP_NoOutput>) {
+                AOP_apply_element(call, element);
+            } else {
+                *out = AOP_apply_element(call, element);
+                ++out;
+            }
+            return out;
+        };
+
+        /// invoke_parallel 中 worker 自己的 AOP。
+        AOP(AOP_WorkerCopy, const AOP &other) : ParentClass(AOP_WorkerCopy(), static_cast<const ParentClass&>(other)) {};
+
+        /*
+         * invoke_parallel 的实现：每个 worker 第一次得到任务时构造自己的 AOP，之后它的每一块都通过这个 AOP 调用 invoke_batch，
+         * 因此批量切入函数每块运行一次。所有块完成后（出现异常时也一样）把各 worker 的 aspect merge 回本对象，然后再重新抛出异常。
+         */
+        template <typename Pool, typename Fun, typename Range, typename Out>
+        Out invoke_parallel_in(Pool &pool, Fun &fun, Range &range, Out out) {
+            using std::begin;
+            using std::end;
+            auto first = begin(range);
+            std::size_t count = end(range) - first;
+            std::size_t workers = pool.size() > 0 ? pool.size() : 1;
+            std::vector<std::unique_ptr<AOP>> locals(workers);
+            auto run = [this, &locals, &fun, &first, &out](unsigned worker, std::size_t from, std::size_t to) {
+                std::unique_ptr<AOP> &local = locals[worker];
+                if (!local) local.reset(new AOP(AOP_WorkerCopy(), *this));
+                AOP_Subrange<decltype(first)> part { first + from, first + to };
+                if constexpr (std::is_same_v<Out, AOP_NoOutput>)
+                    local->invoke_batch(fun, part);
+                else
+                    local->invoke_batch(fun, part, out + from);
+            };
+#ifdef AOP_HAS_EXCEPTIONS
+            try {
+                pool.parallel_for(count, count / (workers * 8) + 1, run);
+            } catch (...) {
+                merge_locals(locals);
+                throw;
+            }
+#else
+            pool.parallel_for(count, count / (workers * 8) + 1, run);
+#endif
+            merge_locals(locals);
+            if constexpr (std::is_same_v<Out, AOP_NoOutput>)
+                return out;
+            else
+                return out + count;
+        };
+
+        void merge_locals(const std::vector<std::unique_ptr<AOP>> &locals) {
+            for (auto &local : locals)
+                if (local) ParentClass::merge_from(*local);
+        };
+
+        /// 检查返回值或调用 after(const R &) 时需要先把返回值保存在局部变量中，再从它返回，因此按值返回时它必须可以移动。
+        template <typename Self, typename Result>
+        static constexpr bool keep_result() {
+            return (ParentClass::template check_result<Self, Result>()
+                || ParentClass::template check_after<Self, Result>())
+                && (std::is_reference_v<Result> || std::is_move_constructible_v<Result>);
+        };
+
+        /// 运行被调用函数，启用了 AOP_ResultErrors 时检查返回值，失败时调用 error(const R &) 并且不再调用 after()。
+        /// 存在 after(const R &) 时返回值先保存在局部变量中（NRVO），由这里代替 AfterGuard 调用 after()。
+        /// 返回值不能移动时只能通过保证的复制消除直接返回，aspect 看不到返回值：返回值不被检查，只调用 after()。
+        template <typename Self, typename Guard, typename...FunArgs>
+        static decltype(auto) invoke_target(Self &self, Guard &guard, FunArgs &&...args) {
+            using Result = decltype(AOP_Hooks::call(std::forward<FunArgs>(args)...));
+            if constexpr (keep_result<Self, Result>()) {
+                Result result = call_target(self, guard, std::forward<FunArgs>(args)...);
+                if constexpr (ParentClass::template check_result<Self, Result>()) {
+                    if (ParentClass::result_failed(result) && guard.disarm())
+                        self.notify_result(result);
+                }
+                if constexpr (ParentClass::template check_after<Self, Result>()) {
+                    if (guard.disarm())
+                        guard.after(result);
+                }
+                if constexpr (std::is_reference_v<Result>)
+                    return static_cast<Result>(result);
+                else
+                    return result;
+            } else {
+                return call_target(self, guard, std::forward<FunArgs>(args)...);
+            }
+        };
+
+        /// 通过 invoke_around() 运行被调用函数。只有存在 error() 或需要就地构造返回值时才会产生一个 try/catch，
+        /// 异常时由 notify_error() 一次性通知所有 error()，然后重新抛出一次。
+        /// 存在 error(const E &) 且 E 派生自 std::exception 时，额外捕获 std::exception 以便直接得到它的指针。
+        template <typename Self, typename Guard, typename...FunArgs>
+        static decltype(auto) call_target(Self &self, Guard &guard, FunArgs &&...args) {
+#ifdef AOP_HAS_EXCEPTIONS
+            using Result = decltype(AOP_Hooks::call(std::forward<FunArgs>(args)...));
+            if constexpr (!ParentClass::template has_error<Self>() && std::is_void_v<Result>) {
+                ParentClass::template invoke_around<0>(self, std::forward<FunArgs>(args)...);
+                guard.arm();
+            } else if constexpr (!ParentClass::template has_error<Self>() && std::is_reference_v<Result>) {
+                Result result = ParentClass::template invoke_around<0>(self, std::forward<FunArgs>(args)...);
+                guard.arm();
+                return static_cast<Result>(result);
+            } else if constexpr (ParentClass::template ErrorCache<Self>::catch_std) {
+                guard.arm();
+                try {
+                    return ParentClass::template invoke_around<0>(self, std::forward<FunArgs>(args)...);
+                } catch (const std::exception &error) {
+                    guard.disarm();
+                    self.notify_error(&error);
+                    throw;
+                } catch (...) {
+                    guard.disarm();
+                    self.notify_error(nullptr);
+                    throw;
+                }
+            } else {
+                guard.arm();
+                try {
+                    return ParentClass::template invoke_around<0>(self, std::forward<FunArgs>(args)...);
+                } catch (...) {
+                    guard.disarm();
+                    if constexpr (ParentClass::template has_error<Self>())
+                        self.notify_error(nullptr);
+                    throw;
+                }
+            }
+#else
+            guard.arm();
+            return ParentClass::template invoke_around<0>(self, std::forward<FunArgs>(args)...);
+#endif
         };
 
     protected:
@@ -538,11 +2505,16 @@ namespace Base {
         /// 检查构造函数是否可以声明为 noexcept。
         template <typename...Args>
         static constexpr bool check_noexcept() {
-            return std::__and_v<std::is_nothrow_constructible<Aspects, Args>...>;
+            return Constraints<true>::template is_nothrow_constructible<Args...>();
+        };
+
+        /// Aspects 中是否没有策略，存在策略时构造参数与 Aspects 不一一对应。
+        static constexpr bool no_policy() {
+            return AOP_slot_count<Aspects...>() == sizeof...(Aspects);
         };
 
     public:
-        using ParentClass = AOP_impl<0, Aspects...>;
+        using ParentClass = AOP_impl<std::make_index_sequence<AOP_slot_count<Aspects...>()>, Aspects...>;
 
         /// 默认构造函数（如果存在的话）。
         template <typename O_o = void, ImplicitDefault<std::is_void_v<O_o>>  = true>
@@ -555,18 +2527,18 @@ namespace Base {
             noexcept(check_default_construct_noexcept())
             : ParentClass() {};
 
-        /// 复制构造函数，用来进行模板推断。
-        template <typename O_o = void, Implicit<std::is_void_v<O_o>, const Aspects&...>  = true>
+        /// 复制构造函数，用来进行模板推断（存在策略时不可用）。
+        template <typename O_o = void, Implicit<std::is_void_v<O_o> && no_policy(), const Aspects&...>  = true>
         constexpr AOP(const Aspects &...args)
             noexcept(check_noexcept<const Aspects&...>())
             : ParentClass(args...) {};
 
-        template <typename o_O = void, Explicit<std::is_void_v<o_O>, const Aspects&...>  = 0>
+        template <typename o_O = void, Explicit<std::is_void_v<o_O> && no_policy(), const Aspects&...>  = 0>
         constexpr explicit AOP(const Aspects &...args)
             noexcept(check_noexcept<const Aspects&...>())
             : ParentClass(args...) {};
 
-        /// 构造函数，注意 Args 的数目必须和 Aspects 一致。
+        /// 构造函数，注意 Args 的数目必须和 Aspects 中除策略以外的 aspect 一致。
         template <typename...Args, Implicit<valid_args<Args...>(), Args...>  = true>
         constexpr AOP(Args &&...args)
             noexcept(check_noexcept<Args...>())
@@ -578,28 +2550,28 @@ namespace Base {
             : ParentClass(std::forward<Args>(args)...) {};
 
         /// 当其他种类的 AOP 可以转化到本类时起作用。
-        template <typename...Args, Implicit<sizeof...(Aspects) == sizeof...(Args)
+        template <typename...Args, Implicit<AOP_slot_count<Aspects...>() == AOP_slot_count<Args...>()
                                             && other_cannot_convert_directly<const AOP<Args...>&>(),
                                             const Args&...>  = true>
         constexpr AOP(const AOP<Args...> &aop)
             noexcept(check_noexcept<const Args&...>())
             : ParentClass(static_cast<const typename AOP<Args...>::ParentClass&>(aop)) {};
 
-        template <typename...Args, Explicit<sizeof...(Aspects) == sizeof...(Args)
+        template <typename...Args, Explicit<AOP_slot_count<Aspects...>() == AOP_slot_count<Args...>()
                                             && other_cannot_convert_directly<const AOP<Args...>&>(),
                                             const Args&...>  = 0>
         constexpr explicit AOP(const AOP<Args...> &aop)
             noexcept(check_noexcept<const Args&...>())
             : ParentClass(static_cast<const typename AOP<Args...>::ParentClass&>(aop)) {};
 
-        template <typename...Args, Implicit<sizeof...(Aspects) == sizeof...(Args)
+        template <typename...Args, Implicit<AOP_slot_count<Aspects...>() == AOP_slot_count<Args...>()
                                             && other_cannot_convert_directly<AOP<Args...>&&>(),
                                             Args...>  = true>
         constexpr explicit AOP(AOP<Args...> &&aop)
             noexcept(check_noexcept<Args...>())
             : ParentClass(static_cast<typename AOP<Args...>::ParentClass&&>(aop)) {};
 
-        template <typename...Args, Explicit<sizeof...(Aspects) == sizeof...(Args)
+        template <typename...Args, Explicit<AOP_slot_count<Aspects...>() == AOP_slot_count<Args...>()
                                             && other_cannot_convert_directly<AOP<Args...>&&>(),
                                             Args...>  = 0>
         constexpr explicit AOP(AOP<Args...> &&aop)
@@ -619,67 +2591,136 @@ namespace Base {
          * 调用 Class 对象的成员函数时需传入成员函数指针和对应的函数参数。
          * 调用 Class 对象的静态函数时需传入静态函数指针和对应的函数参数。
          * 调用普通可调用对象或函数指针时需传入可调用对象或函数指针及其对应的函数参数。
+         * 返回类型与被调用函数完全一致（包括引用），按值返回时不会产生额外的复制或移动。
+         * aspect 的 before(const Args &...) 得到的是 args 本身（不包括 fun），after(const R &) 得到的是返回值本身。
          */
-        template <typename...FunArgs>
-        auto invoke(FunArgs &&...args) {
-#ifdef AOP_WILL_USE_SOURCE_LOCATION
-            SourceLocation save = AOPthreadLoc;
-            AOPthreadLoc = SourceLocation();
-#endif
-            ParentClass::invoke_before();
-            using ReturnType = decltype(ParentClass::handle_error(std::forward<FunArgs>(args)...));
-            if constexpr (std::is_same_v<ReturnType, void>) {
-                ParentClass::handle_error(std::forward<FunArgs>(args)...);
-                ParentClass::invoke_after();
-#ifdef AOP_WILL_USE_SOURCE_LOCATION
-                AOPthreadLoc = save;
-#endif
-            } else {
-                ReturnType result = ParentClass::handle_error(std::forward<FunArgs>(args)...);
-                ParentClass::invoke_after();
-#ifdef AOP_WILL_USE_SOURCE_LOCATION
-                AOPthreadLoc = save;
-#endif
-                return result;
-            }
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke(Fun &&fun, FunArgs &&...args) {
+            return invoke_in(*this, nullptr, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
         };
 
-        template <typename...FunArgs>
-        auto invoke(FunArgs &&...args) const {
-#ifdef AOP_WILL_USE_SOURCE_LOCATION
-            SourceLocation save = AOPthreadLoc;
-#endif
-            ParentClass::invoke_before();
-            using ReturnType = decltype(ParentClass::handle_error(std::forward<FunArgs>(args)...));
-            if constexpr (std::is_same_v<ReturnType, void>) {
-                ParentClass::handle_error(std::forward<FunArgs>(args)...);
-                ParentClass::invoke_after();
-#ifdef AOP_WILL_USE_SOURCE_LOCATION
-                AOPthreadLoc = save;
-#endif
-            } else {
-                ReturnType result = ParentClass::handle_error(std::forward<FunArgs>(args)...);
-                ParentClass::invoke_after();
-#ifdef AOP_WILL_USE_SOURCE_LOCATION
-                AOPthreadLoc = save;
-#endif
-                return result;
-            }
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke(Fun &&fun, FunArgs &&...args) const {
+            return invoke_in(*this, nullptr, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+        };
+
+        /*
+         * 被调用者为编译期常量 Fun（函数指针或成员指针），调用总能被内联：aop.invoke<&A::fun>(a, args...)。
+         * Fun 为重载的函数时用 Sig（函数指针或成员函数指针类型）选择：aop.invoke<int (A::*)(int) const, &A::fun>(a, 1)。
+         */
+        template <auto Fun, typename...FunArgs>
+        decltype(auto) invoke(FunArgs &&...args) {
+            return invoke_in(*this, nullptr, AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        template <auto Fun, typename...FunArgs>
+        decltype(auto) invoke(FunArgs &&...args) const {
+            return invoke_in(*this, nullptr, AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        template <typename Sig, Sig Fun, typename...FunArgs>
+        decltype(auto) invoke(FunArgs &&...args) {
+            return invoke_in(*this, nullptr, AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        template <typename Sig, Sig Fun, typename...FunArgs>
+        decltype(auto) invoke(FunArgs &&...args) const {
+            return invoke_in(*this, nullptr, AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        /// 与 invoke<Fun> 相同，location 为调用位置。
+        template <auto Fun, typename...FunArgs>
+        decltype(auto) invoke_at(const SourceLocation &location, FunArgs &&...args) {
+            return invoke_in(*this, &location, AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        template <auto Fun, typename...FunArgs>
+        decltype(auto) invoke_at(const SourceLocation &location, FunArgs &&...args) const {
+            return invoke_in(*this, &location, AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        /// 与 invoke 相同，location 为调用位置，会出现在 InvocationContext 中（例如传入 CURRENT_FUN_LOCATION）。
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_at(const SourceLocation &location, Fun &&fun, FunArgs &&...args) {
+            return invoke_in(*this, &location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+        };
+
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_at(const SourceLocation &location, Fun &&fun, FunArgs &&...args) const {
+            return invoke_in(*this, &location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+        };
+
+        /*
+         * 用于返回异步结果（std::future、C++20 的 awaitable，见 AsyncInvoke.hpp）的函数：before() 和 around() 在调用时运行，
+         * after(const R &)（R 为异步结果完成后得到的值）和 error() 在异步结果完成时运行，返回值为包装后的异步结果。
+         * 总是构造 InvocationContext，它随异步结果一起保存，而不依赖于 thread_local 的 AOPthreadLoc。
+         * 本对象必须比返回的异步结果活得更久。返回值不是异步结果时与 invoke 相同。
+         */
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_async(Fun &&fun, FunArgs &&...args) {
+            return invoke_async_in(*this, nullptr, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+        };
+
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_async(Fun &&fun, FunArgs &&...args) const {
+            return invoke_async_in(*this, nullptr, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+        };
+
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_async_at(const SourceLocation &location, Fun &&fun, FunArgs &&...args) {
+            return invoke_async_in(*this, &location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+        };
+
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_async_at(const SourceLocation &location, Fun &&fun, FunArgs &&...args) const {
+            return invoke_async_in(*this, &location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+        };
+
+        /*
+         * 对 range 中的每个元素调用 fun，std::tuple 或 std::pair 类型的元素被展开为参数列表，其他元素作为唯一的参数。
+         * 存在 before_batch(std::size_t)/after_batch(std::size_t) 的 aspect 每批只运行一次（count 为元素个数），
+         * 它的其他切入函数不会对单个元素调用；其余 aspect 与 invoke 一样对每个元素运行。
+         * 返回值依次写入输出迭代器 out，返回写完之后的 out；不传入 out 时丢弃返回值。range 至少为前向范围。
+         */
+        template <typename Fun, typename Range, typename Out = AOP_NoOutput>
+        Out invoke_batch(Fun &&fun, Range &&range, Out out = Out()) {
+            return invoke_batch_in(*this, fun, range, std::move(out));
+        };
+
+        template <typename Fun, typename Range, typename Out = AOP_NoOutput>
+        Out invoke_batch(Fun &&fun, Range &&range, Out out = Out()) const {
+            return invoke_batch_in(*this, fun, range, std::move(out));
+        };
+
+        /*
+         * 与 invoke_batch 相同，但 range 被分为若干块，由线程池（默认为 WorkStealingPool::instance()，需包含 WorkStealingPool.hpp）
+         * 中的 worker 并行地处理。每个 worker 使用自己的一份 aspect，各线程之间的 aspect 状态不需要同步：
+         * 存在 merge(const Aspect &) 的 aspect 在 worker 中默认构造，全部完成后依次 merge 回本对象；
+         * 其他 aspect 为本对象中 aspect 的副本，结束后被丢弃，因此只适合保存配置而不是累计的状态。
+         * range 和 out 必须是随机访问的，fun 会被多个线程同时调用。第一个异常在所有块结束后重新抛出，尚未开始的块被跳过。
+         */
+        template <typename Fun, typename Range, typename Out = AOP_NoOutput, typename Pool = WorkStealingPool>
+        Out invoke_parallel(Fun &&fun, Range &&range, Out out = Out()) {
+            return invoke_parallel_in(Pool::instance(), fun, range, std::move(out));
+        };
+
+        /// 与 invoke_parallel 相同，使用指定的线程池（提供 size() 和 parallel_for()，例如 WorkStealingPool）。
+        template <typename Pool, typename Fun, typename Range, typename Out = AOP_NoOutput>
+        Out invoke_parallel_on(Pool &pool, Fun &&fun, Range &&range, Out out = Out()) {
+            return invoke_parallel_in(pool, fun, range, std::move(out));
         };
 
-        /// 得到指定位置的 aspect 对象引用。
+        /// 得到指定位置的 aspect 对象引用，策略不占用下标。
         template <std::size_t Index>
-        constexpr auto get_aspect() ->
-            typename AOP_traits<Index, Aspects...>::Aspect& {
-            static_assert(Index < sizeof...(Aspects), "index out of range");
-            return AOP_cast<Index>(this)->get_aspect();
+        constexpr auto& get_aspect() {
+            static_assert(Index < AOP_slot_count<Aspects...>(), "index out of range");
+            return ParentClass::template get_aspect<Index>();
         };
 
         template <std::size_t Index>
-        constexpr auto get_aspect() const ->
-            typename AOP_traits<Index, Aspects...>::ConstAspect& {
-            static_assert(Index < sizeof...(Aspects), "index out of range");
-            return AOP_cast<Index>(this)->get_aspect();
+        constexpr auto& get_aspect() const {
+            static_assert(Index < AOP_slot_count<Aspects...>(), "index out of range");
+            return ParentClass::template get_aspect<Index>();
         };
 
     };
@@ -692,8 +2733,86 @@ namespace Base {
 
 //------------------------------------------------------------------------------------------------
 
-    /// 类对象指针包装器。
+    /// AOP_Wrapper 的第一个模板参数，表示保存 holder 本身而不是对象的引用：AOP_Wrapper<AOP_Hold<std::unique_ptr<T>>, Aspects...>。
+    template <typename Holder>
+    struct AOP_Hold {
+        using type = Holder;
+    };
+
+    /*
+     * AOP_Wrapper 以 holder 保存对象时使用的特性，只对 AOP_Hold<Holder> 和显式特化了本模板的类型生效，
+     * 其余类型（包括 T*、std::unique_ptr、std::shared_ptr 本身）与原来一样按引用包装。
+     * 特化需要提供 is_holder = true、element_type、get 和 owns：get 得到对象的指针，
+     * owns 判断 holder 是否独占对象，为 true 时 AOP_Wrapper 析构前先调用 destroy()。
+     */
+    template <typename Holder>
+    struct AOP_HolderTraits {
+        static constexpr bool is_holder = false;
+    };
+
+    /*
+     * AOP_Hold 支持原始指针以及存在 element_type 且可以解引用的 holder（std::unique_ptr、std::shared_ptr、intrusive_ptr 等），
+     * 存在 get() 时由它得到对象的指针。只有可以 release() 的 holder（独占所有权）在非空时 owns 为 true；
+     * 共享所有权的 holder 在析构时无法可靠地判断自己是否为最后一个所有者（其他线程可能同时复制或 lock()），owns 总为 false。
+     */
+    template <typename Holder>
+    struct AOP_HolderTraits<AOP_Hold<Holder>> {
+    private:
+        template <typename H, typename = void>
+        struct Element {
+            using type = typename H::element_type;
+        };
+
+        template <typename T>
+        struct Element<T*> {
+            using type = T;
+        };
+
+        template <typename H>
+        static auto get_test(int) -> decltype(std::declval<const H&>().get(), std::true_type());
+        template <typename H>
+        static std::false_type get_test(...);
+
+        template <typename H>
+        static auto release_test(int) -> decltype(std::declval<H&>().release(), std::true_type());
+        template <typename H>
+        static std::false_type release_test(...);
+
+    public:
+        static constexpr bool is_holder = true;
+
+        using element_type = typename Element<Holder>::type;
+
+        static element_type* get(const Holder &holder) noexcept {
+            if constexpr (std::is_pointer_v<Holder>)
+                return holder;
+            else if constexpr (decltype(get_test<Holder>(0))::value)
+                return holder.get();
+            else
+                return std::addressof(*holder);
+        };
+
+        static bool owns(const Holder &holder) noexcept {
+            if constexpr (decltype(release_test<Holder>(0))::value)
+                return static_cast<bool>(holder);
+            else
+                return false;
+        };
+    };
+
+    /// ObjectWrapper 中保存的 holder 类型。
     template <typename Class>
+    struct AOP_HolderType {
+        using type = Class;
+    };
+
+    template <typename Holder>
+    struct AOP_HolderType<AOP_Hold<Holder>> {
+        using type = Holder;
+    };
+
+    /// 类对象指针包装器，Class 为 holder 时保存 holder 本身（见 AOP_HolderTraits）。
+    template <typename Class, bool = AOP_HolderTraits<Class>::is_holder>
     class ObjectWrapper {
     public:
         using ClassPtr = Class *;
@@ -715,6 +2834,37 @@ namespace Base {
 
     };
 
+    /// 保存 holder 的版本（Class 为 AOP_Hold<Holder> 或特化了 AOP_HolderTraits 的 holder），每次调用只通过 holder 解引用一次。
+    template <typename Class>
+    class ObjectWrapper<Class, true> {
+    public:
+        using Holder = typename AOP_HolderType<Class>::type;
+        using Traits = AOP_HolderTraits<Class>;
+        using ClassPtr = typename Traits::element_type *;
+        using ConstClassPtr = const typename Traits::element_type *;
+
+        template <typename H, typename = std::enable_if_t<std::is_constructible_v<Holder, H&&>>>
+        explicit ObjectWrapper(H &&holder) noexcept(std::is_nothrow_constructible_v<Holder, H&&>) :
+            _holder(std::forward<H>(holder)) {};
+
+        ClassPtr get_class_ptr() { return Traits::get(_holder); };
+
+        ConstClassPtr get_class_ptr() const { return Traits::get(_holder); };
+
+        Holder& get_holder() { return _holder; };
+
+        const Holder& get_holder() const { return _holder; };
+
+        void reset_holder(Holder holder) { _holder = std::move(holder); };
+
+        /// holder 是否为对象唯一的所有者。
+        [[nodiscard]] bool owns_object() const { return Traits::owns(_holder); };
+
+    private:
+        Holder _holder;
+
+    };
+
 //------------------------------------------------------------------------------------------------
 
     /// 推断 AOP_Wrapper 的构造函数是否可以声明为 explict。
@@ -722,16 +2872,23 @@ namespace Base {
     struct AOP_WrapperConstraints : AOPConstraints<true, Aspects...> {
         using ParentClass = AOPConstraints<true, Aspects...>;
 
+        /// 保存 holder 时 C 需要可以转换为 holder，否则需要可以转换为 Class&。
+        template <typename C>
+        static constexpr bool wraps() {
+            if constexpr (AOP_HolderTraits<Class>::is_holder)
+                return std::is_convertible_v<C, typename AOP_HolderType<Class>::type>;
+            else
+                return std::is_convertible_v<C, Class&>;
+        };
+
         template <typename C, typename...Args>
         static constexpr bool is_implicitly_constructible() {
-            return std::is_convertible_v<C, Class&>
-                && ParentClass::template is_implicitly_constructible<Args...>();
+            return wraps<C>() && ParentClass::template is_implicitly_constructible<Args...>();
         };
 
         template <typename C, typename...Args>
         static constexpr bool is_explicitly_constructible() {
-            return std::is_convertible_v<C, Class&>
-                && ParentClass::template is_explicitly_constructible<Args...>();
+            return wraps<C>() && ParentClass::template is_explicitly_constructible<Args...>();
         };
     };
 
@@ -741,7 +2898,12 @@ namespace Base {
 
 //------------------------------------------------------------------------------------------------
 
-    /// AOP_Wrapper 不掌握对象生命周期，第一个参数需传入对象的引用（non-const)进行构造。
+    /*
+     * AOP_Wrapper 不掌握对象生命周期，第一个参数需传入对象的引用（non-const)进行构造。
+     * Class 为 AOP_Hold<Holder>（Holder 为 T*、std::unique_ptr<T>、std::shared_ptr<T> 等）或特化了 AOP_HolderTraits 的 holder 时，
+     * 第一个参数为 holder 的右值，AOP_Wrapper 保存 holder 本身，成员函数直接通过它调用；
+     * 析构时如果 holder 独占对象，与 AOP_Object 一样先调用 destroy()。
+     */
     template <typename Class, typename...Aspects>
     class AOP_Wrapper : public ObjectWrapper<Class>, public AOP<Aspects...> {
         using Wrapper = ObjectWrapper<Class>;
@@ -766,8 +2928,38 @@ namespace Base {
 
         template <typename C, typename...Args>
         static constexpr bool other_cannot_convert_directly() {
-            return sizeof...(Aspects) == sizeof...(Args)
-                && !std::__and_v<std::is_same<Class, C>, std::is_same<Aspects, Args>...>;
+            return AOP_slot_count<Aspects...>() == AOP_slot_count<Args...>()
+                && !std::is_same_v<AOP_Wrapper, AOP_Wrapper<C, Args...>>;
+        };
+
+        static constexpr bool is_holder = AOP_HolderTraits<Class>::is_holder;
+
+        /// 由 AOP_Wrapper<C, ...> 转换构造时 Wrapper 的参数类型：按引用包装时为 C&，保存 holder 时为另一个 AOP_Wrapper 的 holder。
+        template <typename C, bool Rvalue, bool = is_holder && AOP_HolderTraits<C>::is_holder>
+        struct Source {
+            using type = C&;
+        };
+
+        template <typename C, bool Rvalue>
+        struct Source<C, Rvalue, true> {
+            using Holder = typename AOP_HolderType<C>::type;
+            using type = std::conditional_t<Rvalue, Holder&&, const Holder&>;
+        };
+
+        template <typename C, typename...Args>
+        static decltype(auto) source(const AOP_Wrapper<C, Args...> &aop) {
+            if constexpr (is_holder)
+                return aop.get_holder();
+            else
+                return *const_cast<typename AOP_Wrapper<C, Args...>::ClassPtr>(aop.get_class_ptr());
+        };
+
+        template <typename C, typename...Args>
+        static decltype(auto) source(AOP_Wrapper<C, Args...> &&aop) {
+            if constexpr (is_holder)
+                return std::move(aop.get_holder());
+            else
+                return *aop.get_class_ptr();
         };
 
         template <typename...Args>
@@ -776,14 +2968,16 @@ namespace Base {
         };
 
     public:
-        /// 用于辅助推断模板。
-        template <typename O_o = void, Implicit<std::is_void_v<O_o>,
+        /// 用于辅助推断模板（存在策略时不可用）。
+        template <typename O_o = void, Implicit<std::is_void_v<O_o> && ParentClass::no_policy()
+                                                && !AOP_HolderTraits<Class>::is_holder,
                                                 Class&, const Aspects&...>  = true>
         constexpr AOP_Wrapper(Class &object, const Aspects &...aspects)
             noexcept(check_noexcept<const Aspects&...>())
             : Wrapper(object), ParentClass(aspects...) {};
 
-        template <typename o_O = void, Explicit<std::is_void_v<o_O>,
+        template <typename o_O = void, Explicit<std::is_void_v<o_O> && ParentClass::no_policy()
+                                                && !AOP_HolderTraits<Class>::is_holder,
                                                 Class&, const Aspects&...>  = 0>
         constexpr explicit AOP_Wrapper(Class &object, const Aspects &...aspects)
             noexcept(check_noexcept<const Aspects&...>())
@@ -791,37 +2985,51 @@ namespace Base {
 
         /// Args 用于构造 AOP。
         template <typename Object, typename...Args,
-                  typename = std::enable_if_t<!Is_AOP_Wrapper<Object>::value>>
+                  typename = std::enable_if_t<!AOP_HolderTraits<Class>::is_holder && !Is_AOP_Wrapper<Object>::value>>
         constexpr AOP_Wrapper(Object &object, Args &&...args) :
             Wrapper(object), ParentClass(std::forward<Args>(args)...) {};
 
+        /// 保存 holder 时以 holder 构造，Args 用于构造 AOP。holder 必须是右值（可以平凡复制的 holder 除外，例如原始指针），
+        /// 左值的 std::shared_ptr 等不会被隐式复制，需要时显式地复制或 std::move。
+        template <typename H, typename...Args,
+                  typename = std::enable_if_t<AOP_HolderTraits<Class>::is_holder && !Is_AOP_Wrapper<H>::value
+                                              && std::is_constructible_v<typename AOP_HolderType<Class>::type, H&&>>>
+        constexpr AOP_Wrapper(H &&holder, Args &&...args) :
+            Wrapper(std::forward<H>(holder)), ParentClass(std::forward<Args>(args)...) {
+            static_assert(!std::is_lvalue_reference_v<H>
+                          || std::is_trivially_copyable_v<typename AOP_HolderType<Class>::type>,
+                          "AOP_Wrapper does not copy an lvalue holder, pass a copy or std::move it");
+        };
+
         /// 当其他种类的 AOP_Wrapper 可以转换到本类时起作用。
         template <typename C, typename...Args,
-                  Implicit<other_cannot_convert_directly<C, Args...>(), C&, const Args&...>  = true>
+                  Implicit<other_cannot_convert_directly<C, Args...>(), typename Source<C, false>::type,
+                           const Args&...>  = true>
         constexpr AOP_Wrapper(const AOP_Wrapper<C, Args...> &aop)
             noexcept(check_noexcept<const Args&...>())
-            : Wrapper(*const_cast<typename AOP_Wrapper<C, Args...>::ClassPtr>(aop.get_class_ptr())),
+            : Wrapper(source(aop)),
             ParentClass(static_cast<const AOP<Args...>&>(aop)) {};
 
         template <typename C, typename...Args,
-                  Explicit<other_cannot_convert_directly<C, Args...>(), C&, const Args&...>  = 0>
+                  Explicit<other_cannot_convert_directly<C, Args...>(), typename Source<C, false>::type,
+                           const Args&...>  = 0>
         constexpr explicit AOP_Wrapper(const AOP_Wrapper<C, Args...> &aop)
             noexcept(check_noexcept<const Args&...>())
-            : Wrapper(*const_cast<typename AOP_Wrapper<C, Args...>::ClassPtr>(aop.get_class_ptr())),
+            : Wrapper(source(aop)),
             ParentClass(static_cast<const AOP<Args...>&>(aop)) {};
 
         template <typename C, typename...Args,
-                  Implicit<other_cannot_convert_directly<C, Args...>(), C&, Args...>  = true>
+                  Implicit<other_cannot_convert_directly<C, Args...>(), typename Source<C, true>::type, Args...>  = true>
         constexpr AOP_Wrapper(AOP_Wrapper<C, Args...> &&aop)
             noexcept(check_noexcept<Args...>())
-            : Wrapper(*aop.get_class_ptr()),
+            : Wrapper(source(std::move(aop))),
             ParentClass(static_cast<AOP<Args...>&&>(aop)) {};
 
         template <typename C, typename...Args,
-                  Explicit<other_cannot_convert_directly<C, Args...>(), C&, Args...>  = 0>
+                  Explicit<other_cannot_convert_directly<C, Args...>(), typename Source<C, true>::type, Args...>  = 0>
         constexpr AOP_Wrapper(AOP_Wrapper<C, Args...> &&aop)
             noexcept(check_noexcept<Args...>())
-            : Wrapper(*aop.get_class_ptr()),
+            : Wrapper(source(std::move(aop))),
             ParentClass(static_cast<AOP<Args...>&&>(aop)) {};
 
         constexpr AOP_Wrapper(const AOP_Wrapper &) = default;
@@ -830,29 +3038,176 @@ namespace Base {
 
         constexpr AOP_Wrapper(AOP_Wrapper &&) = default;
 
-        constexpr AOP_Wrapper& operator=(AOP_Wrapper &&) = default;
+        /// 保存 holder 时，被替换的对象如果由本对象独占，先调用 destroy()。
+        constexpr AOP_Wrapper& operator=(AOP_Wrapper &&other)
+            noexcept(std::is_nothrow_move_assignable_v<Wrapper> && std::is_nothrow_move_assignable_v<ParentClass>) {
+            if constexpr (is_holder && sizeof...(Aspects) > 0) {
+                if (this != &other && Wrapper::owns_object()) ParentClass::invoke_destroy();
+            }
+            Wrapper::operator=(std::move(other));
+            ParentClass::operator=(std::move(other));
+            return *this;
+        };
+
+        ~AOP_Wrapper() {
+            if constexpr (is_holder && sizeof...(Aspects) > 0) {
+                if (Wrapper::owns_object()) ParentClass::invoke_destroy();
+            }
+        };
 
         /// 当调用类成员函数时会自动传入本对象的指针，同时也可以运行非成员函数对象。
         template <typename Fun, typename...FunArgs>
-        auto invoke(Fun &&fun, FunArgs &&...args) {
+        decltype(auto) invoke(Fun &&fun, FunArgs &&...args) {
             if constexpr (CallableChecker<Fun, FunArgs...>::common_callable) {
                 return ParentClass::invoke(std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
             } else {
-                return ParentClass::invoke(std::forward<Fun>(fun), Wrapper::get_class_ptr(),
+                return ParentClass::invoke(AOP_bind(std::forward<Fun>(fun), Wrapper::get_class_ptr()),
                                            std::forward<FunArgs>(args)...);
             }
         };
 
         template <typename Fun, typename...FunArgs>
-        auto invoke(Fun &&fun, FunArgs &&...args) const {
+        decltype(auto) invoke(Fun &&fun, FunArgs &&...args) const {
             if constexpr (CallableChecker<Fun, FunArgs...>::common_callable) {
                 return ParentClass::invoke(std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
             } else {
-                return ParentClass::invoke(std::forward<Fun>(fun), Wrapper::get_class_ptr(),
+                return ParentClass::invoke(AOP_bind(std::forward<Fun>(fun), Wrapper::get_class_ptr()),
                                            std::forward<FunArgs>(args)...);
             }
         };
 
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_at(const SourceLocation &location, Fun &&fun, FunArgs &&...args) {
+            if constexpr (CallableChecker<Fun, FunArgs...>::common_callable) {
+                return ParentClass::invoke_at(location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            } else {
+                return ParentClass::invoke_at(location, AOP_bind(std::forward<Fun>(fun), Wrapper::get_class_ptr()),
+                                              std::forward<FunArgs>(args)...);
+            }
+        };
+
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_at(const SourceLocation &location, Fun &&fun, FunArgs &&...args) const {
+            if constexpr (CallableChecker<Fun, FunArgs...>::common_callable) {
+                return ParentClass::invoke_at(location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            } else {
+                return ParentClass::invoke_at(location, AOP_bind(std::forward<Fun>(fun), Wrapper::get_class_ptr()),
+                                              std::forward<FunArgs>(args)...);
+            }
+        };
+
+        /// 被调用者为编译期常量 Fun，成员函数自动绑定本对象：invoke<&A::fun>(args...)；重载时为 invoke<int (A::*)(int) const, &A::fun>(args...)。
+        template <auto Fun, typename...FunArgs>
+        decltype(auto) invoke(FunArgs &&...args) {
+            return invoke(AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        template <auto Fun, typename...FunArgs>
+        decltype(auto) invoke(FunArgs &&...args) const {
+            return invoke(AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        template <typename Sig, Sig Fun, typename...FunArgs>
+        decltype(auto) invoke(FunArgs &&...args) {
+            return invoke(AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        template <typename Sig, Sig Fun, typename...FunArgs>
+        decltype(auto) invoke(FunArgs &&...args) const {
+            return invoke(AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        template <auto Fun, typename...FunArgs>
+        decltype(auto) invoke_at(const SourceLocation &location, FunArgs &&...args) {
+            return invoke_at(location, AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        template <auto Fun, typename...FunArgs>
+        decltype(auto) invoke_at(const SourceLocation &location, FunArgs &&...args) const {
+            return invoke_at(location, AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_async(Fun &&fun, FunArgs &&...args) {
+            if constexpr (CallableChecker<Fun, FunArgs...>::common_callable) {
+                return ParentClass::invoke_async(std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            } else {
+                return ParentClass::invoke_async(AOP_bind(std::forward<Fun>(fun), Wrapper::get_class_ptr()),
+                                                 std::forward<FunArgs>(args)...);
+            }
+        };
+
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_async(Fun &&fun, FunArgs &&...args) const {
+            if constexpr (CallableChecker<Fun, FunArgs...>::common_callable) {
+                return ParentClass::invoke_async(std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            } else {
+                return ParentClass::invoke_async(AOP_bind(std::forward<Fun>(fun), Wrapper::get_class_ptr()),
+                                                 std::forward<FunArgs>(args)...);
+            }
+        };
+
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_async_at(const SourceLocation &location, Fun &&fun, FunArgs &&...args) {
+            if constexpr (CallableChecker<Fun, FunArgs...>::common_callable) {
+                return ParentClass::invoke_async_at(location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            } else {
+                return ParentClass::invoke_async_at(location, AOP_bind(std::forward<Fun>(fun), Wrapper::get_class_ptr()),
+                                                    std::forward<FunArgs>(args)...);
+            }
+        };
+
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_async_at(const SourceLocation &location, Fun &&fun, FunArgs &&...args) const {
+            if constexpr (CallableChecker<Fun, FunArgs...>::common_callable) {
+                return ParentClass::invoke_async_at(location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            } else {
+                return ParentClass::invoke_async_at(location, AOP_bind(std::forward<Fun>(fun), Wrapper::get_class_ptr()),
+                                                    std::forward<FunArgs>(args)...);
+            }
+        };
+
+        template <typename Fun, typename Range, typename Out = AOP_NoOutput>
+        Out invoke_batch(Fun &&fun, Range &&range, Out out = Out()) {
+            if constexpr (std::is_member_pointer_v<std::decay_t<Fun>>) {
+                return ParentClass::invoke_batch(AOP_bind(std::forward<Fun>(fun), Wrapper::get_class_ptr()),
+                                                 std::forward<Range>(range), std::move(out));
+            } else {
+                return ParentClass::invoke_batch(std::forward<Fun>(fun), std::forward<Range>(range), std::move(out));
+            }
+        };
+
+        template <typename Fun, typename Range, typename Out = AOP_NoOutput>
+        Out invoke_batch(Fun &&fun, Range &&range, Out out = Out()) const {
+            if constexpr (std::is_member_pointer_v<std::decay_t<Fun>>) {
+                return ParentClass::invoke_batch(AOP_bind(std::forward<Fun>(fun), Wrapper::get_class_ptr()),
+                                                 std::forward<Range>(range), std::move(out));
+            } else {
+                return ParentClass::invoke_batch(std::forward<Fun>(fun), std::forward<Range>(range), std::move(out));
+            }
+        };
+
+        template <typename Fun, typename Range, typename Out = AOP_NoOutput>
+        Out invoke_parallel(Fun &&fun, Range &&range, Out out = Out()) {
+            if constexpr (std::is_member_pointer_v<std::decay_t<Fun>>) {
+                return ParentClass::invoke_parallel(AOP_bind(std::forward<Fun>(fun), Wrapper::get_class_ptr()),
+                                                    std::forward<Range>(range), std::move(out));
+            } else {
+                return ParentClass::invoke_parallel(std::forward<Fun>(fun), std::forward<Range>(range), std::move(out));
+            }
+        };
+
+        template <typename Pool, typename Fun, typename Range, typename Out = AOP_NoOutput>
+        Out invoke_parallel_on(Pool &pool, Fun &&fun, Range &&range, Out out = Out()) {
+            if constexpr (std::is_member_pointer_v<std::decay_t<Fun>>) {
+                return ParentClass::invoke_parallel_on(pool, AOP_bind(std::forward<Fun>(fun), Wrapper::get_class_ptr()),
+                                                       std::forward<Range>(range), std::move(out));
+            } else {
+                return ParentClass::invoke_parallel_on(pool, std::forward<Fun>(fun), std::forward<Range>(range),
+                                                       std::move(out));
+            }
+        };
+
     };
 
 //------------------------------------------------------------------------------------------------
@@ -934,8 +3289,8 @@ namespace Base {
 
         template <typename C, typename...Args>
         static constexpr bool other_cannot_convert_directly() {
-            return sizeof...(Aspects) == sizeof...(Args)
-                && !std::__and_v<std::is_same<Class, C>, std::is_same<Aspects, Args>...>;
+            return AOP_slot_count<Aspects...>() == AOP_slot_count<Args...>()
+                && !std::is_same_v<AOP_Object, AOP_Object<C, Args...>>;
         };
 
         static constexpr bool check_default_construct_noexcept() {
@@ -1030,59 +3385,182 @@ namespace Base {
 
         constexpr AOP_Object& operator=(AOP_Object &&) = default;
 
-        ~AOP_Object() { invoke_destroy<0>(); };
+        ~AOP_Object() { ParentClass::invoke_destroy(); };
 
         /// 当调用类成员函数时会自动传入本对象的指针，同时也可以运行非成员函数对象。
         template <typename Fun, typename...FunArgs>
-        auto invoke(Fun &&fun, FunArgs &&...args) {
+        decltype(auto) invoke(Fun &&fun, FunArgs &&...args) {
             if constexpr (CallableChecker<Fun, FunArgs...>::common_callable) {
                 return ParentClass::invoke(std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
             } else {
-                return ParentClass::invoke(std::forward<Fun>(fun), this,
+                return ParentClass::invoke(AOP_bind(std::forward<Fun>(fun), this),
                                            std::forward<FunArgs>(args)...);
             }
         };
 
         template <typename Fun, typename...FunArgs>
-        auto invoke(Fun &&fun, FunArgs &&...args) const {
+        decltype(auto) invoke(Fun &&fun, FunArgs &&...args) const {
             if constexpr (CallableChecker<Fun, FunArgs...>::common_callable) {
                 return ParentClass::invoke(std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
             } else {
-                return ParentClass::invoke(std::forward<Fun>(fun), this,
+                return ParentClass::invoke(AOP_bind(std::forward<Fun>(fun), this),
                                            std::forward<FunArgs>(args)...);
             }
         };
 
-    private:
-        /// 对象销毁时调用。
-        template <std::size_t Index>
-        constexpr void invoke_destroy() {
-            using Aspect = typename AOP_traits<Index, Aspects...>::Aspect;
-            using ConstAspect = typename AOP_traits<Index, Aspects...>::ConstAspect;
-            if constexpr (Index + 1 < sizeof...(Aspects)) {
-                this->invoke_destroy<Index + 1>();
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_at(const SourceLocation &location, Fun &&fun, FunArgs &&...args) {
+            if constexpr (CallableChecker<Fun, FunArgs...>::common_callable) {
+                return ParentClass::invoke_at(location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            } else {
+                return ParentClass::invoke_at(location, AOP_bind(std::forward<Fun>(fun), this),
+                                              std::forward<FunArgs>(args)...);
             }
-            if constexpr (CallableExitChecker<Aspect>::has_destroy_callable
-                || CallableExitChecker<ConstAspect>::has_destroy_callable) {
-                ParentClass::template get_aspect<Index>().destroy();
+        };
+
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_at(const SourceLocation &location, Fun &&fun, FunArgs &&...args) const {
+            if constexpr (CallableChecker<Fun, FunArgs...>::common_callable) {
+                return ParentClass::invoke_at(location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            } else {
+                return ParentClass::invoke_at(location, AOP_bind(std::forward<Fun>(fun), this),
+                                              std::forward<FunArgs>(args)...);
+            }
+        };
+
+        /// 被调用者为编译期常量 Fun，成员函数自动绑定本对象：invoke<&A::fun>(args...)；重载时为 invoke<int (A::*)(int) const, &A::fun>(args...)。
+        template <auto Fun, typename...FunArgs>
+        decltype(auto) invoke(FunArgs &&...args) {
+            return invoke(AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        template <auto Fun, typename...FunArgs>
+        decltype(auto) invoke(FunArgs &&...args) const {
+            return invoke(AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        template <typename Sig, Sig Fun, typename...FunArgs>
+        decltype(auto) invoke(FunArgs &&...args) {
+            return invoke(AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        template <typename Sig, Sig Fun, typename...FunArgs>
+        decltype(auto) invoke(FunArgs &&...args) const {
+            return invoke(AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        template <auto Fun, typename...FunArgs>
+        decltype(auto) invoke_at(const SourceLocation &location, FunArgs &&...args) {
+            return invoke_at(location, AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        template <auto Fun, typename...FunArgs>
+        decltype(auto) invoke_at(const SourceLocation &location, FunArgs &&...args) const {
+            return invoke_at(location, AOP_Fun<Fun>(), std::forward<FunArgs>(args)...);
+        };
+
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_async(Fun &&fun, FunArgs &&...args) {
+            if constexpr (CallableChecker<Fun, FunArgs...>::common_callable) {
+                return ParentClass::invoke_async(std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            } else {
+                return ParentClass::invoke_async(AOP_bind(std::forward<Fun>(fun), this),
+                                                 std::forward<FunArgs>(args)...);
+            }
+        };
+
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_async(Fun &&fun, FunArgs &&...args) const {
+            if constexpr (CallableChecker<Fun, FunArgs...>::common_callable) {
+                return ParentClass::invoke_async(std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            } else {
+                return ParentClass::invoke_async(AOP_bind(std::forward<Fun>(fun), this),
+                                                 std::forward<FunArgs>(args)...);
+            }
+        };
+
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_async_at(const SourceLocation &location, Fun &&fun, FunArgs &&...args) {
+            if constexpr (CallableChecker<Fun, FunArgs...>::common_callable) {
+                return ParentClass::invoke_async_at(location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            } else {
+                return ParentClass::invoke_async_at(location, AOP_bind(std::forward<Fun>(fun), this),
+                                                    std::forward<FunArgs>(args)...);
+            }
+        };
+
+        template <typename Fun, typename...FunArgs>
+        decltype(auto) invoke_async_at(const SourceLocation &location, Fun &&fun, FunArgs &&...args) const {
+            if constexpr (CallableChecker<Fun, FunArgs...>::common_callable) {
+                return ParentClass::invoke_async_at(location, std::forward<Fun>(fun), std::forward<FunArgs>(args)...);
+            } else {
+                return ParentClass::invoke_async_at(location, AOP_bind(std::forward<Fun>(fun), this),
+                                                    std::forward<FunArgs>(args)...);
+            }
+        };
+
+        template <typename Fun, typename Range, typename Out = AOP_NoOutput>
+        Out invoke_batch(Fun &&fun, Range &&range, Out out = Out()) {
+            if constexpr (std::is_member_pointer_v<std::decay_t<Fun>>) {
+                return ParentClass::invoke_batch(AOP_bind(std::forward<Fun>(fun), this),
+                                                 std::forward<Range>(range), std::move(out));
+            } else {
+                return ParentClass::invoke_batch(std::forward<Fun>(fun), std::forward<Range>(range), std::move(out));
+            }
+        };
+
+        template <typename Fun, typename Range, typename Out = AOP_NoOutput>
+        Out invoke_batch(Fun &&fun, Range &&range, Out out = Out()) const {
+            if constexpr (std::is_member_pointer_v<std::decay_t<Fun>>) {
+                return ParentClass::invoke_batch(AOP_bind(std::forward<Fun>(fun), this),
+                                                 std::forward<Range>(range), std::move(out));
+            } else {
+                return ParentClass::invoke_batch(std::forward<Fun>(fun), std::forward<Range>(range), std::move(out));
+            }
+        };
+
+        template <typename Fun, typename Range, typename Out = AOP_NoOutput>
+        Out invoke_parallel(Fun &&fun, Range &&range, Out out = Out()) {
+            if constexpr (std::is_member_pointer_v<std::decay_t<Fun>>) {
+                return ParentClass::invoke_parallel(AOP_bind(std::forward<Fun>(fun), this),
+                                                    std::forward<Range>(range), std::move(out));
+            } else {
+                return ParentClass::invoke_parallel(std::forward<Fun>(fun), std::forward<Range>(range), std::move(out));
+            }
+        };
+
+        template <typename Pool, typename Fun, typename Range, typename Out = AOP_NoOutput>
+        Out invoke_parallel_on(Pool &pool, Fun &&fun, Range &&range, Out out = Out()) {
+            if constexpr (std::is_member_pointer_v<std::decay_t<Fun>>) {
+                return ParentClass::invoke_parallel_on(pool, AOP_bind(std::forward<Fun>(fun), this),
+                                                       std::forward<Range>(range), std::move(out));
+            } else {
+                return ParentClass::invoke_parallel_on(pool, std::forward<Fun>(fun), std::forward<Range>(range),
+                                                       std::move(out));
             }
         };
+
     };
 
 //------------------------------------------------------------------------------------------------
 
 /// 仅能运行类的成员函数，和类的静态函数。
 #define AOP_MemberFun_Agent_(fun_name_) \
-    [] (auto &object__, auto &&...args__) \
+    [] (auto &object__, auto &&...args__) -> decltype(auto) \
     { return (object__).fun_name_(std::forward<decltype(args__)>(args__)...); }
 
+/// 宏调用处的位置（编译期常量），函数名为被调用的成员函数名。
+#define AOP_Agent_Location_(fun_name_) Base::SourceLocation(__FILE__, #fun_name_, __LINE__)
+
 /// 运行时AOP_Wrapper 的成员函数宏，object_ 为 AOP_Wrapper 的引用，fun_name_为调用的成员函数名，其余可视情况传入函数参数。
 #define AOP_Wrapper_Agent(object_, fun_name_, ...) \
-    object_.invoke(AOP_MemberFun_Agent_(fun_name_), *((object_).get_class_ptr()), ##__VA_ARGS__ )
+    object_.invoke_at(AOP_Agent_Location_(fun_name_), \
+                      Base::AOP_bind(AOP_MemberFun_Agent_(fun_name_), *((object_).get_class_ptr())), ##__VA_ARGS__ )
 
 /// 运行时AOP_Object 的成员函数宏，object_ 为 AOP_Object 的引用，fun_name_为调用的成员函数名，其余可视情况传入函数参数。
 #define AOP_Object_Agent(object_, fun_name_, ...) \
-    object_.invoke(AOP_MemberFun_Agent_(fun_name_), object_, ##__VA_ARGS__ )
+    object_.invoke_at(AOP_Agent_Location_(fun_name_), \
+                      Base::AOP_bind(AOP_MemberFun_Agent_(fun_name_), object_), ##__VA_ARGS__ )
 
 //------------------------------------------------------------------------------------------------
 
@@ -0,0 +1,316 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#ifndef ASYNCINVOKE_HPP
+#define ASYNCINVOKE_HPP
+
+#ifdef ASYNCINVOKE_HPP
+
+#include "AOP.hpp"
+
+#include <future>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#include <coroutine>
+#include <optional>
+#define AOP_HAS_COROUTINES /// C++20 下支持返回 awaitable 的函数，invoke_async 把它包装为 AOP_Task。
+#endif
+
+namespace Base {
+
+//------------------------------------------------------------------------------------------------
+
+    /*
+     * std::future 没有完成时的回调，invoke_async 以 std::launch::async 启动一个线程等待原来的 future，
+     * 它完成后在该线程中调用 after() 或 error()，然后才让返回的 future 就绪。因此调用者可以用 wait_for() 轮询，
+     * 不调用 get() 时切入函数也会运行。与 std::async 返回的 future 一样，返回的 future 析构时会等待该线程结束。
+     */
+    template <typename T>
+    struct AOP_AsyncAdapter<std::future<T>> {
+        static constexpr bool is_async = true;
+
+        using Value = T;
+
+        template <typename Completion>
+        static std::future<T> wrap(std::future<T> future, Completion completion) {
+            return std::async(std::launch::async, [future = std::move(future), completion]() mutable -> T {
+#ifdef AOP_HAS_EXCEPTIONS
+                try {
+                    return finish(future, completion);
+                } catch (const std::exception &error) {
+                    completion.failure(&error);
+                    throw;
+                } catch (...) {
+                    completion.failure(nullptr);
+                    throw;
+                }
+#else
+                return finish(future, completion);
+#endif
+            });
+        };
+
+    private:
+        /// after() 抛出的异常不会交给 error()，这里只是为了让 wrap 中的 catch 不包括 after()。
+        template <typename Completion>
+        static T finish(std::future<T> &future, Completion &completion) {
+            if constexpr (std::is_void_v<T>) {
+                future.get();
+                completion.success();
+            } else {
+                T result = future.get();
+                completion.success(result);
+                if constexpr (std::is_reference_v<T>)
+                    return static_cast<T>(result);
+                else
+                    return result;
+            }
+        };
+    };
+
+#ifdef AOP_HAS_COROUTINES
+
+//------------------------------------------------------------------------------------------------
+
+    /// AOP_Task 的返回值（或异常），T 为引用时保存指针。
+    template <typename T>
+    class AOP_TaskResult {
+    public:
+        template <typename U>
+        void return_value(U &&value) {
+            if constexpr (std::is_reference_v<T>)
+                _value = std::addressof(value);
+            else
+                _value.emplace(std::forward<U>(value));
+        };
+
+        void unhandled_exception() noexcept {
+#ifdef AOP_HAS_EXCEPTIONS
+            _error = std::current_exception();
+#else
+            std::terminate();
+#endif
+        };
+
+        T take() {
+#ifdef AOP_HAS_EXCEPTIONS
+            if (_error) std::rethrow_exception(_error);
+#endif
+            if constexpr (std::is_reference_v<T>)
+                return static_cast<T>(**_value);
+            else
+                return std::move(*_value);
+        };
+
+    private:
+        std::optional<std::conditional_t<std::is_reference_v<T>, std::remove_reference_t<T>*, T>> _value;
+#ifdef AOP_HAS_EXCEPTIONS
+        std::exception_ptr _error;
+#endif
+    };
+
+    template <>
+    class AOP_TaskResult<void> {
+    public:
+        void return_void() noexcept {};
+
+        void unhandled_exception() noexcept {
+#ifdef AOP_HAS_EXCEPTIONS
+            _error = std::current_exception();
+#else
+            std::terminate();
+#endif
+        };
+
+        void take() {
+#ifdef AOP_HAS_EXCEPTIONS
+            if (_error) std::rethrow_exception(_error);
+#endif
+        };
+
+    private:
+#ifdef AOP_HAS_EXCEPTIONS
+        std::exception_ptr _error;
+#endif
+    };
+
+    /*
+     * invoke_async 包装 awaitable 得到的协程：创建时不运行，被 co_await 时才开始等待原来的 awaitable，
+     * 完成后通过对称转移（symmetric transfer）恢复等待者，结果为原 awaitable 的 co_await 结果。
+     * 只能移动，只能被 co_await 一次，也可以作为普通的协程返回类型使用。
+     */
+    template <typename T>
+    class [[nodiscard]] AOP_Task {
+    public:
+        struct promise_type : AOP_TaskResult<T> {
+            AOP_Task get_return_object() noexcept {
+                return AOP_Task(std::coroutine_handle<promise_type>::from_promise(*this));
+            };
+
+            std::suspend_always initial_suspend() noexcept { return {}; };
+
+            /// 结束时恢复等待者（没有时什么也不做）。
+            struct FinalAwaiter {
+                bool await_ready() noexcept { return false; };
+
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                    std::coroutine_handle<> continuation = handle.promise().continuation;
+                    return continuation ? continuation : std::noop_coroutine();
+                };
+
+                void await_resume() noexcept {};
+            };
+
+            FinalAwaiter final_suspend() noexcept { return {}; };
+
+            std::coroutine_handle<> continuation;
+        };
+
+        AOP_Task(AOP_Task &&other) noexcept : _handle(std::exchange(other._handle, nullptr)) {};
+
+        AOP_Task& operator=(AOP_Task &&other) noexcept {
+            if (this != &other) {
+                if (_handle) _handle.destroy();
+                _handle = std::exchange(other._handle, nullptr);
+            }
+            return *this;
+        };
+
+        ~AOP_Task() {
+            if (_handle) _handle.destroy();
+        };
+
+        bool await_ready() const noexcept { return !_handle || _handle.done(); };
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+            _handle.promise().continuation = caller;
+            return _handle;
+        };
+
+        T await_resume() { return _handle.promise().take(); };
+
+    private:
+        explicit AOP_Task(std::coroutine_handle<promise_type> handle) noexcept : _handle(handle) {};
+
+        std::coroutine_handle<promise_type> _handle;
+    };
+
+//------------------------------------------------------------------------------------------------
+
+    template <typename R>
+    auto AOP_member_co_await_test(int) -> decltype(std::declval<R>().operator co_await(), std::true_type());
+    template <typename>
+    std::false_type AOP_member_co_await_test(...);
+
+    template <typename R>
+    auto AOP_free_co_await_test(int) -> decltype(operator co_await(std::declval<R>()), std::true_type());
+    template <typename>
+    std::false_type AOP_free_co_await_test(...);
+
+    /// 按 co_await 的规则得到 awaitable 的 awaiter：成员或非成员的 operator co_await，都不存在时为它本身。
+    template <typename R>
+    decltype(auto) AOP_get_awaiter(R &&awaitable) {
+        if constexpr (decltype(AOP_member_co_await_test<R>(0))::value)
+            return std::forward<R>(awaitable).operator co_await();
+        else if constexpr (decltype(AOP_free_co_await_test<R>(0))::value)
+            return operator co_await(std::forward<R>(awaitable));
+        else
+            return std::forward<R>(awaitable);
+    };
+
+    template <typename R>
+    auto AOP_awaiter_test(int) -> decltype(std::declval<R&>().await_ready(), std::declval<R&>().await_resume(),
+        std::true_type());
+    template <typename>
+    std::false_type AOP_awaiter_test(...);
+
+    /// R 的右值可以被 co_await（不考虑 await_transform）。
+    template <typename R>
+    constexpr bool AOP_is_awaitable() {
+        if constexpr (decltype(AOP_member_co_await_test<R>(0))::value || decltype(AOP_free_co_await_test<R>(0))::value)
+            return true;
+        else
+            return decltype(AOP_awaiter_test<R>(0))::value;
+    };
+
+    /// 转发 awaiter 的 await_*，await_suspend() 或 await_resume() 抛出异常时（即 awaitable 失败时）先调用 error()。
+    template <typename Awaiter, typename Completion>
+    class AOP_ObservedAwaiter {
+    public:
+        AOP_ObservedAwaiter(Awaiter &&awaiter, Completion &completion) :
+            _awaiter(std::forward<Awaiter>(awaiter)), _completion(completion) {};
+
+        bool await_ready() { return _awaiter.await_ready(); };
+
+        template <typename Promise>
+        decltype(auto) await_suspend(std::coroutine_handle<Promise> caller) {
+            return observe([&]() -> decltype(auto) { return _awaiter.await_suspend(caller); });
+        };
+
+        decltype(auto) await_resume() {
+            return observe([&]() -> decltype(auto) { return _awaiter.await_resume(); });
+        };
+
+    private:
+        template <typename Fun>
+        decltype(auto) observe(Fun &&fun) {
+#ifdef AOP_HAS_EXCEPTIONS
+            try {
+                return fun();
+            } catch (const std::exception &error) {
+                _completion.failure(&error);
+                throw;
+            } catch (...) {
+                _completion.failure(nullptr);
+                throw;
+            }
+#else
+            return fun();
+#endif
+        };
+
+        Awaiter _awaiter;
+        Completion &_completion;
+    };
+
+    /*
+     * 返回 awaitable（例如各种协程库的 task）的函数：invoke_async 返回一个 AOP_Task，它在被 co_await 时等待原来的 awaitable，
+     * 原 awaitable 完成后（可能已在另一个线程中恢复）调用 after(const R &) 或 error()，然后把结果交给等待者。
+     * InvocationContext 和 AOPthreadLoc 由 AOP_Task 的协程帧保存，不受恢复线程的影响。
+     */
+    template <typename R>
+    struct AOP_AsyncAdapter<R, std::enable_if_t<AOP_is_awaitable<R>()>> {
+        static constexpr bool is_async = true;
+
+        using Awaiter = decltype(AOP_get_awaiter(std::declval<R>()));
+
+        using Value = decltype(std::declval<std::remove_reference_t<Awaiter>&>().await_resume());
+
+        template <typename Completion>
+        static AOP_Task<Value> wrap(R awaitable, Completion completion) {
+            if constexpr (std::is_void_v<Value>) {
+                co_await AOP_ObservedAwaiter<Awaiter, Completion>(AOP_get_awaiter(std::move(awaitable)), completion);
+                completion.success();
+            } else {
+                Value result = co_await AOP_ObservedAwaiter<Awaiter, Completion>(
+                    AOP_get_awaiter(std::move(awaitable)), completion);
+                completion.success(result);
+                if constexpr (std::is_reference_v<Value>)
+                    co_return static_cast<Value>(result);
+                else
+                    co_return std::move(result);
+            }
+        };
+    };
+
+#endif
+
+}
+
+#endif
+
+#endif //ASYNCINVOKE_HPP
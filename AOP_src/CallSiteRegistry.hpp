@@ -0,0 +1,202 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#ifndef CALLSITEREGISTRY_HPP
+#define CALLSITEREGISTRY_HPP
+
+#ifdef CALLSITEREGISTRY_HPP
+
+#include "AOP.hpp"
+#include "LatencyHistogram.hpp"
+#include "SourceLocation.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <vector>
+
+namespace Base {
+
+//------------------------------------------------------------------------------------------------
+
+    /*
+     * 一个被标记函数的计数器，作为函数内的 static 对象存在，第一次执行到标记处时构造并登记到 CallSiteRegistry，之后不再登记。
+     * 每个线程第一次执行到标记处时在 AOP_ThreadBlocks 中分配自己的计数块（不使用原子读改写），读取时合并所有计数块。
+     * AOP_CALL_SITE_MARK 把当前线程的计数块缓存在函数内的 thread_local 指针中。
+     * 它是平凡析构的（计数块从不释放），程序退出时（其他静态对象析构期间）仍然可以被枚举。
+     */
+    class CallSite {
+    public:
+        explicit CallSite(const SourceLocation &location) noexcept;
+
+        CallSite(const CallSite &) = delete;
+
+        CallSite& operator=(const CallSite &) = delete;
+
+        /// 一个线程的计数器，只有该线程写入。
+        struct Counters {
+            /// 记录一次调用，elapsed 为 LatencyClock 的 tick 数。只能在该线程中调用。
+            void record(std::uint64_t elapsed, bool failed) noexcept {
+                calls.store(calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                ticks.store(ticks.load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+                if (failed) errors.store(errors.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            };
+
+            std::atomic<std::uint64_t> calls { 0 };
+            std::atomic<std::uint64_t> errors { 0 };
+            std::atomic<std::uint64_t> ticks { 0 };
+        };
+
+        /// 记录一次调用，ticks 为 LatencyClock 的 tick 数。
+        void record(std::uint64_t ticks, bool failed) noexcept {
+            local_counters().record(ticks, failed);
+        };
+
+        /// 当前线程的计数块，不经过缓存，需要遍历所有线程的计数块。
+        Counters &local_counters() noexcept { return _blocks.find(); };
+
+        [[nodiscard]] const SourceLocation &location() const { return _location; };
+
+        [[nodiscard]] std::uint64_t calls() const { return sum(&Counters::calls); };
+
+        [[nodiscard]] std::uint64_t errors() const { return sum(&Counters::errors); };
+
+        [[nodiscard]] std::uint64_t ticks() const { return sum(&Counters::ticks); };
+
+        /// 与记录同时进行时，正在进行的记录可能会丢失。
+        void reset() noexcept {
+            _blocks.for_each([](Counters &block) {
+                block.calls.store(0, std::memory_order_relaxed);
+                block.errors.store(0, std::memory_order_relaxed);
+                block.ticks.store(0, std::memory_order_relaxed);
+            });
+        };
+
+        [[nodiscard]] const CallSite* next() const { return _next; };
+
+    private:
+        friend class CallSiteRegistry;
+
+        std::uint64_t sum(std::atomic<std::uint64_t> Counters::* counter) const {
+            std::uint64_t result = 0;
+            _blocks.for_each([&](const Counters &block) { result += (block.*counter).load(std::memory_order_relaxed); });
+            return result;
+        };
+
+        SourceLocation _location;
+        AOP_ThreadBlocks<Counters, false> _blocks;
+        CallSite* _next = nullptr;
+    };
+
+    /// CallSiteRegistry::snapshot() 中的一行，时间单位为纳秒。
+    struct CallSiteStats {
+        SourceLocation location;
+        std::uint64_t calls = 0;
+        std::uint64_t errors = 0;
+        double total = 0;
+        double mean = 0;
+    };
+
+    /*
+     * 进程内所有 CallSite 组成的无锁链表（只增不减），可以在任意线程中随时枚举。
+     * 用法：在编译选项中定义 AOP_CALL_SITE_STATS，AOP_FUN_MARK 即会同时记录所在函数的调用次数、
+     * 以异常退出的次数和累计耗时（包含内部调用的其他函数）；也可以直接在函数开头使用 AOP_CALL_SITE_MARK。
+     * 然后通过 CallSiteRegistry::dump() 打印按累计耗时排序的热点函数表。
+     */
+    class CallSiteRegistry {
+    public:
+        CallSiteRegistry() = delete;
+
+        /// 第一个（最近登记的）CallSite，通过 CallSite::next() 遍历。
+        static const CallSite* first() { return _head.load(std::memory_order_acquire); };
+
+        template <typename Fun>
+        static void for_each(Fun &&fun) {
+            for (const CallSite* site = first(); site; site = site->next())
+                fun(*site);
+        };
+
+        /// 所有被调用过的 CallSite，按累计耗时从大到小排序。
+        static std::vector<CallSiteStats> snapshot() {
+            std::vector<CallSiteStats> result;
+            double scale = LatencyClock::nanos_per_tick();
+            for_each([&](const CallSite &site) {
+                std::uint64_t calls = site.calls();
+                if (calls == 0) return;
+                double total = double(site.ticks()) * scale;
+                result.push_back({ site.location(), calls, site.errors(), total, total / double(calls) });
+            });
+            std::sort(result.begin(), result.end(), [](const CallSiteStats &lhs, const CallSiteStats &rhs) {
+                return lhs.total > rhs.total;
+            });
+            return result;
+        };
+
+        /// 以表格形式打印 snapshot()。
+        static void dump(std::FILE* out = stderr) {
+            std::fprintf(out, "%12s %10s %14s %12s  %s\n", "calls", "errors", "total us", "mean ns", "function");
+            for (const CallSiteStats &stats : snapshot()) {
+                std::fprintf(out, "%12llu %10llu %14.1f %12.1f  %s (%s:%u)\n",
+                             static_cast<unsigned long long>(stats.calls),
+                             static_cast<unsigned long long>(stats.errors), stats.total / 1000, stats.mean,
+                             stats.location.function(), stats.location.file(), stats.location.line());
+            }
+        };
+
+        /// 清零所有计数器，与调用同时进行时可能有少量记录丢失。
+        static void reset() {
+            for (CallSite* site = _head.load(std::memory_order_acquire); site; site = site->_next)
+                site->reset();
+        };
+
+    private:
+        friend class CallSite;
+
+        static void add(CallSite &site) noexcept {
+            site._next = _head.load(std::memory_order_relaxed);
+            while (!_head.compare_exchange_weak(site._next, &site, std::memory_order_release,
+                                                std::memory_order_relaxed)) {}
+        };
+
+        static inline std::atomic<CallSite*> _head { nullptr };
+    };
+
+    inline CallSite::CallSite(const SourceLocation &location) noexcept : _location(location) {
+        CallSiteRegistry::add(*this);
+    }
+
+    /// 在被标记函数返回（或因异常退出）时把一次调用记入当前线程的计数块，local 为该线程缓存的计数块（为空时查找）。
+    class CallSiteScope {
+    public:
+        CallSiteScope(CallSite &site, CallSite::Counters* &local) noexcept :
+            _counters(local ? *local : *(local = &site.local_counters())),
+            _exceptions(std::uncaught_exceptions()), _start(LatencyClock::ticks()) {};
+
+        CallSiteScope(const CallSiteScope &) = delete;
+
+        CallSiteScope& operator=(const CallSiteScope &) = delete;
+
+        ~CallSiteScope() {
+            _counters.record(LatencyClock::ticks() - _start, std::uncaught_exceptions() > _exceptions);
+        };
+
+    private:
+        CallSite::Counters &_counters;
+        int _exceptions;
+        std::uint64_t _start;
+    };
+
+}
+
+/// 放到函数内部的开头（每个函数只能使用一次），把该函数登记到 CallSiteRegistry 并记录本次调用。
+#define AOP_CALL_SITE_MARK \
+    static Base::CallSite AOP_call_site_(CURRENT_FUN_LOCATION); \
+    static thread_local Base::CallSite::Counters* AOP_call_site_counters_ = nullptr; \
+    Base::CallSiteScope AOP_call_site_scope_(AOP_call_site_, AOP_call_site_counters_);
+
+#endif
+
+#endif //CALLSITEREGISTRY_HPP
@@ -0,0 +1,423 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#ifndef DYNAMICASPECT_HPP
+#define DYNAMICASPECT_HPP
+
+#ifdef DYNAMICASPECT_HPP
+
+#include "AOP.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Base {
+
+//------------------------------------------------------------------------------------------------
+
+    template <typename Signature>
+    class AOP_Dynamic;
+
+    /// AOP_Dynamic 中 after 的函数指针类型，Result 为 void 时没有返回值参数。
+    template <typename Result>
+    struct AOP_DynamicAfter {
+        using type = void (*)(void*, const Result &);
+    };
+
+    template <>
+    struct AOP_DynamicAfter<void> {
+        using type = void (*)(void*);
+    };
+
+    /*
+     * 在运行时 attach() / detach() 的 aspect 链（例如由配置决定的审计、租户配额），本身作为一个普通的 aspect 放入 AOP 中，
+     * 与其他静态 aspect 组合：AOP<Trace, AOP_Dynamic<int(int)>, Metrics>，静态 aspect 仍然被内联。
+     * Signature 为被调用函数的类型 R(Args...)，attach 的 aspect 只能使用 before()、before(const Args &...)、
+     * after()、after(const R &)、error(std::exception_ptr)、error(const E &) 和 destroy()（around() 和 InvocationContext 不可用）。
+     * 每个 aspect 的状态在不超过 buffer_size 且可以 noexcept 移动时直接保存在链中（小缓冲区），否则分配在堆上；
+     * 链中不使用虚函数，before、after、error 各自是一个连续的 { 函数指针, 状态 } 数组，只包含存在该切入函数的 aspect，
+     * 因此每个 aspect 的开销为一次间接调用。before 按 attach 的顺序调用，after 和 error 按相反的顺序调用。
+     * 链中没有任何切入函数时 idle() 为 true，invoke 此时不经过该 aspect（也不为它捕获异常或保存返回值）。
+     * 异常是 std::exception 时由 AOP 以 error(const std::exception &) 传入，链中的 error(const E &) 通过 dynamic_cast 匹配，
+     * 不需要重新抛出；其他异常只有在 aspect 声明了非 std::exception 的 error_types 时才会重新抛出，
+     * error_types 相同的 aspect 共享同一次重新抛出的结果。
+     * 与 std::function 相同，切入函数都是 const 的，但不会把 const 传递给 attach 的 aspect。
+     * attach()、detach() 和 clear() 不能与 invoke 同时进行；需要在其他线程调用时启用或停用的 aspect 可以 attach 一个
+     * Switchable<Aspect> 并切换它的开关。复制 AOP_Dynamic 时复制所有的 aspect，因此 aspect 必须可以复制。
+     */
+    template <typename R, typename...Args>
+    class AOP_Dynamic<R(Args...)> {
+    public:
+        /// attach() 的返回值，用于 detach() 和 target()，不会为 0。
+        using Handle = std::uint64_t;
+
+#ifdef AOP_HAS_EXCEPTIONS
+        using error_types = std::tuple<std::exception>;
+#endif
+
+        /// 直接保存在链中的 aspect 的最大大小。
+        static constexpr std::size_t buffer_size = 3 * sizeof(void*);
+
+        AOP_Dynamic() = default;
+
+        AOP_Dynamic(const AOP_Dynamic &other) : _aspects(other._aspects), _next(other._next) { rebuild(); };
+
+        AOP_Dynamic(AOP_Dynamic &&) noexcept = default;
+
+        AOP_Dynamic& operator=(const AOP_Dynamic &other) {
+            if (this != &other) {
+                _aspects = other._aspects;
+                _next = other._next;
+                rebuild();
+            }
+            return *this;
+        };
+
+        AOP_Dynamic& operator=(AOP_Dynamic &&) noexcept = default;
+
+        /// 把 aspect 加入链的末尾（最内层）。
+        template <typename Aspect>
+        Handle attach(Aspect &&aspect) {
+            using Type = std::decay_t<Aspect>;
+            static_assert(std::is_copy_constructible_v<Type>, "AOP_Dynamic: an attached aspect must be copyable");
+            Handle handle = ++_next;
+            _aspects.emplace_back(handle, static_cast<Type*>(nullptr), std::forward<Aspect>(aspect));
+            rebuild();
+            return handle;
+        };
+
+        /// 移除 handle 对应的 aspect，不存在时返回 false。
+        bool detach(Handle handle) {
+            for (auto it = _aspects.begin(); it != _aspects.end(); ++it) {
+                if (it->handle != handle) continue;
+                _aspects.erase(it);
+                rebuild();
+                return true;
+            }
+            return false;
+        };
+
+        void clear() {
+            _aspects.clear();
+            rebuild();
+        };
+
+        [[nodiscard]] std::size_t size() const { return _aspects.size(); };
+
+        [[nodiscard]] bool empty() const { return _aspects.empty(); };
+
+        /// 链中没有 before、after 和 error，本次调用不需要经过该 aspect。
+        [[nodiscard]] bool idle() const noexcept { return _before.empty() && _after.empty() && _error.empty(); };
+
+        /// handle 对应的 aspect，不存在或类型不是 Aspect 时返回 nullptr。
+        template <typename Aspect>
+        Aspect* target(Handle handle) {
+            for (auto &entry : _aspects) {
+                if (entry.handle == handle)
+                    return entry.ops == Model<Aspect>::ops() ? Model<Aspect>::get(entry.storage) : nullptr;
+            }
+            return nullptr;
+        };
+
+        template <typename Aspect>
+        const Aspect* target(Handle handle) const {
+            return const_cast<AOP_Dynamic*>(this)->template target<Aspect>(handle);
+        };
+
+        void before(const std::__remove_cvref_t<Args> &...args) const {
+            for (auto &call : _before)
+                call.fun(call.state, args...);
+        };
+
+        template <typename T = R, std::enable_if_t<std::is_void_v<T>, int> = 0>
+        void after() const {
+            for (auto &call : _after)
+                call.fun(call.state);
+        };
+
+        template <typename T = R, std::enable_if_t<!std::is_void_v<T>, int> = 0>
+        void after(const std::__remove_cvref_t<T> &result) const {
+            for (auto &call : _after)
+                call.fun(call.state, result);
+        };
+
+#ifdef AOP_HAS_EXCEPTIONS
+        /// 只在 AOP 的 catch 块中被调用。
+        void error(const std::exception &error) const {
+            ErrorScope scope(&error);
+            for (auto &call : _error)
+                call.fun(call.state, scope);
+        };
+
+        void error(const std::exception_ptr &) const {
+            ErrorScope scope(nullptr);
+            for (auto &call : _error)
+                call.fun(call.state, scope);
+        };
+#endif
+
+        /// 由内向外调用每个 aspect 的 destroy()。
+        void destroy() const {
+            for (auto it = _aspects.rbegin(); it != _aspects.rend(); ++it) {
+                if (it->ops->destroy) it->ops->destroy(it->ops->address(it->storage));
+            }
+        };
+
+    private:
+        using Result = std::conditional_t<std::is_void_v<R>, void, std::__remove_cvref_t<R>>;
+
+        using AfterFun = typename AOP_DynamicAfter<Result>::type;
+
+        using BeforeFun = void (*)(void*, const std::__remove_cvref_t<Args> &...);
+
+#ifdef AOP_HAS_EXCEPTIONS
+        /// 一次 error 中链上的 aspect 共享的 AOP_CurrentError，error_types 相同的 aspect 使用同一个，
+        /// 因此异常最多为每组不同的 error_types 重新抛出一次。
+        class ErrorScope {
+        public:
+            /// std_error 为当前异常（不是 std::exception 时为 nullptr）。
+            explicit ErrorScope(const std::exception* std_error) noexcept : _std_error(std_error) {};
+
+            ErrorScope(const ErrorScope &) = delete;
+
+            ErrorScope& operator=(const ErrorScope &) = delete;
+
+            ~ErrorScope() {
+                for (auto &entry : _currents)
+                    entry.drop(entry.current);
+            };
+
+            template <typename Current>
+            Current& current() {
+                for (auto &entry : _currents) {
+                    if (entry.drop == &drop<Current>) return *static_cast<Current*>(entry.current);
+                }
+                _currents.push_back({ nullptr, &drop<Current> });
+                auto current = new Current(_std_error);
+                _currents.back().current = current;
+                return *current;
+            };
+
+        private:
+            /// 地址同时用于区分 AOP_CurrentError 的类型。
+            template <typename Current>
+            static void drop(void* current) noexcept { delete static_cast<Current*>(current); };
+
+            struct Entry {
+                void* current;
+                void (*drop)(void*) noexcept;
+            };
+
+            const std::exception* _std_error;
+            std::vector<Entry> _currents;
+        };
+
+        /// 在 catch 块中调用。
+        using ErrorFun = void (*)(void*, ErrorScope &);
+#else
+        using ErrorFun = void (*)();
+#endif
+
+        struct alignas(std::max_align_t) Storage {
+            unsigned char bytes[buffer_size];
+        };
+
+        /// 每种 aspect 类型一份，没有对应切入函数时为 nullptr。
+        struct Ops {
+            BeforeFun before;
+            AfterFun after;
+            ErrorFun error;
+            void (*destroy)(void*);
+            void* (*address)(const Storage &);
+            void (*copy)(Storage &, const Storage &);
+            void (*move)(Storage &, Storage &) noexcept;
+            void (*drop)(Storage &) noexcept;
+        };
+
+        template <typename Aspect>
+        struct Model {
+            static constexpr bool local = sizeof(Aspect) <= buffer_size && alignof(Aspect) <= alignof(Storage)
+                && std::is_nothrow_move_constructible_v<Aspect>;
+
+            template <typename A>
+            static void create(Storage &storage, A &&aspect) {
+                if constexpr (local)
+                    ::new(static_cast<void*>(storage.bytes)) Aspect(std::forward<A>(aspect));
+                else
+                    ::new(static_cast<void*>(storage.bytes)) Aspect* (new Aspect(std::forward<A>(aspect)));
+            };
+
+            static Aspect* get(const Storage &storage) {
+                auto bytes = const_cast<unsigned char*>(storage.bytes);
+                if constexpr (local)
+                    return std::launder(reinterpret_cast<Aspect*>(bytes));
+                else
+                    return *std::launder(reinterpret_cast<Aspect**>(bytes));
+            };
+
+            static void* address(const Storage &storage) { return get(storage); };
+
+            static void copy(Storage &target, const Storage &source) { create(target, *get(source)); };
+
+            static void move(Storage &target, Storage &source) noexcept {
+                if constexpr (local) {
+                    ::new(static_cast<void*>(target.bytes)) Aspect(std::move(*get(source)));
+                    get(source)->~Aspect();
+                } else {
+                    ::new(static_cast<void*>(target.bytes)) Aspect* (get(source));
+                    *std::launder(reinterpret_cast<Aspect**>(source.bytes)) = nullptr;
+                }
+            };
+
+            static void drop(Storage &storage) noexcept {
+                if constexpr (local)
+                    get(storage)->~Aspect();
+                else
+                    delete get(storage);
+            };
+
+            static void before(void* state, const std::__remove_cvref_t<Args> &...args) {
+                AOP_Hooks::before(*static_cast<Aspect*>(state), args...);
+            };
+
+            static void after(void* state) {
+                AOP_Hooks::after(*static_cast<Aspect*>(state));
+            };
+
+            template <typename T>
+            static void after_result(void* state, const T &result) {
+                AOP_Hooks::after(*static_cast<Aspect*>(state), result);
+            };
+
+            static constexpr bool has_before = CallableExitChecker<Aspect>::has_before_callable
+                || CallableExitChecker<Aspect>::template has_before_args_callable<std::__remove_cvref_t<Args>...>();
+
+            static constexpr bool has_after() {
+                if constexpr (std::is_void_v<Result>)
+                    return CallableExitChecker<Aspect>::has_after_callable;
+                else
+                    return CallableExitChecker<Aspect>::has_after_callable
+                        || AOP_Hooks::has_after_result<Aspect, Result>();
+            };
+
+            static constexpr AfterFun after_fun() {
+                if constexpr (!has_after())
+                    return nullptr;
+                else if constexpr (std::is_void_v<Result>)
+                    return &Model::after;
+                else
+                    return &Model::template after_result<Result>;
+            };
+
+#ifdef AOP_HAS_EXCEPTIONS
+            /// 与 AOP 相同，以 AOP_CurrentError 调用第一个匹配的 error(const E &) 或 error(std::exception_ptr)。
+            static void error(void* state, ErrorScope &scope) {
+                using Current = typename AOP_ErrorCache<Aspect>::type;
+                AOP_Hooks::error(*static_cast<Aspect*>(state), scope.template current<Current>());
+            };
+
+            static constexpr ErrorFun error_fun() {
+                if constexpr (AOP_Hooks::has_error<Aspect>())
+                    return &Model::error;
+                else
+                    return nullptr;
+            };
+#else
+            static constexpr ErrorFun error_fun() { return nullptr; };
+#endif
+
+            static void destroy(void* state) {
+                AOP_Hooks::destroy(*static_cast<Aspect*>(state));
+            };
+
+            static constexpr bool has_destroy = CallableExitChecker<Aspect>::has_destroy_callable
+                || CallableExitChecker<const Aspect>::has_destroy_callable;
+
+            /// 地址同时用于 target() 判断类型。
+            static const Ops* ops() {
+                static constexpr Ops table {
+                    has_before ? &Model::before : nullptr, after_fun(), error_fun(),
+                    has_destroy ? &Model::destroy : nullptr, &Model::address, &Model::copy, &Model::move, &Model::drop
+                };
+                return &table;
+            };
+        };
+
+        /// 一个 attach 的 aspect，拥有它的状态。
+        struct Entry {
+            template <typename Type, typename Aspect>
+            Entry(Handle handle_, Type*, Aspect &&aspect) : handle(handle_), ops(Model<Type>::ops()) {
+                Model<Type>::create(storage, std::forward<Aspect>(aspect));
+            };
+
+            Entry(const Entry &other) : handle(other.handle), ops(other.ops) { ops->copy(storage, other.storage); };
+
+            Entry(Entry &&other) noexcept : handle(other.handle), ops(other.ops) { ops->move(storage, other.storage); };
+
+            Entry& operator=(const Entry &other) {
+                if (this != &other) {
+                    Entry copy(other);
+                    *this = std::move(copy);
+                }
+                return *this;
+            };
+
+            Entry& operator=(Entry &&other) noexcept {
+                if (this != &other) {
+                    ops->drop(storage);
+                    handle = other.handle;
+                    ops = other.ops;
+                    ops->move(storage, other.storage);
+                }
+                return *this;
+            };
+
+            ~Entry() { ops->drop(storage); };
+
+            Handle handle;
+            const Ops* ops;
+            Storage storage;
+        };
+
+        template <typename Fun>
+        struct Call {
+            Fun fun;
+            void* state;
+        };
+
+        /// 重新生成三个调用数组，_aspects 中的状态在修改后可能已经移动。
+        void rebuild() {
+            _before.clear();
+            _after.clear();
+            _error.clear();
+            for (auto &entry : _aspects) {
+                void* state = entry.ops->address(entry.storage);
+                if (entry.ops->before) _before.push_back({ entry.ops->before, state });
+            }
+            for (auto it = _aspects.rbegin(); it != _aspects.rend(); ++it) {
+                void* state = it->ops->address(it->storage);
+                if (it->ops->after) _after.push_back({ it->ops->after, state });
+                if (it->ops->error) _error.push_back({ it->ops->error, state });
+            }
+        };
+
+        std::vector<Entry> _aspects;
+        std::vector<Call<BeforeFun>> _before;
+        std::vector<Call<AfterFun>> _after;
+        std::vector<Call<ErrorFun>> _error;
+        Handle _next = 0;
+
+    };
+
+}
+
+#endif
+
+#endif //DYNAMICASPECT_HPP
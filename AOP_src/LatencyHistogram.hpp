@@ -0,0 +1,272 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+/// 放在保护宏之外：定义 AOP_CALL_SITE_STATS 时 AOP.hpp 会包含 CallSiteRegistry.hpp，后者需要本文件完整的定义。
+#include "AOP.hpp"
+
+#ifndef LATENCYHISTOGRAM_HPP
+#define LATENCYHISTOGRAM_HPP
+
+#ifdef LATENCYHISTOGRAM_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#include <x86intrin.h>
+#define AOP_LATENCY_TSC /// x86 上在 TSC 为 invariant 时使用 rdtsc 计时。
+#endif
+
+#if __has_include(<time.h>)
+#include <time.h>
+#endif
+
+namespace Base {
+
+//------------------------------------------------------------------------------------------------
+
+    /*
+     * LatencyHistogram 使用的时钟：TSC 为 invariant（频率恒定且各核心同步）时读取 rdtsc，
+     * 否则读取 clock_gettime(CLOCK_MONOTONIC)（没有时退化为 steady_clock），此时一个 tick 即为 1ns。
+     * TSC 的频率不在启动时测量，而是在需要换算时根据（程序启动或 LatencyHistogram 创建）以来经过的 tick 和纳秒数计算。
+     */
+    class LatencyClock {
+    public:
+        /// 当前的 tick 数。
+        static std::uint64_t ticks() noexcept {
+#ifdef AOP_LATENCY_TSC
+            if (use_tsc) return __rdtsc();
+#endif
+            return nanos();
+        };
+
+        /// 单调时钟的纳秒数。
+        static std::uint64_t nanos() noexcept {
+#if defined(CLOCK_MONOTONIC)
+            timespec time {};
+            ::clock_gettime(CLOCK_MONOTONIC, &time);
+            return std::uint64_t(time.tv_sec) * 1000000000ULL + std::uint64_t(time.tv_nsec);
+#else
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+        };
+
+        /// 是否在使用 TSC（为 false 时 tick 与纳秒相同）。
+        static bool uses_tsc() noexcept { return use_tsc; };
+
+        /// 根据程序启动以来经过的 tick 和纳秒数换算，不使用 TSC 时为 1。
+        static double nanos_per_tick() noexcept {
+            if (!use_tsc) return 1;
+            std::uint64_t ticks_passed = ticks() - start_ticks;
+            std::uint64_t nanos_passed = nanos() - start_nanos;
+            return ticks_passed > 0 && nanos_passed > 0 ? double(nanos_passed) / double(ticks_passed) : 1;
+        };
+
+    private:
+        static bool detect() noexcept {
+#ifdef AOP_LATENCY_TSC
+            unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+            if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007) return false;
+            __cpuid(0x80000007, eax, ebx, ecx, edx);
+            return (edx >> 8) & 1;
+#else
+            return false;
+#endif
+        };
+
+        static inline const bool use_tsc = detect();
+
+        static inline const std::uint64_t start_ticks = ticks();
+
+        static inline const std::uint64_t start_nanos = nanos();
+    };
+
+//------------------------------------------------------------------------------------------------
+
+    /// LatencyHistogram 合并所有线程的记录后得到的快照，时间单位均为纳秒。
+    struct LatencySnapshot {
+        std::uint64_t count = 0;
+        double mean = 0;
+        double max = 0;
+        double p50 = 0;
+        double p99 = 0;
+        double p999 = 0;
+    };
+
+    /*
+     * 记录被调用函数耗时的 aspect，通过 around() 织入，只测量被调用函数（以及内层的 around()）本身，抛出异常的调用同样会被记录。
+     * 每个线程第一次记录时在 AOP_ThreadBlocks 中分配一块属于自己的桶（之后不再加锁或分配内存），桶按 HDR 的方式对数-线性划分：
+     * 小于 2^SubBits 个 tick 的耗时精确记录，更大的耗时在每个 2 的幂区间内再线性地分为 2^SubBits 份（相对误差不超过 2^-SubBits）。
+     * 每块桶只有它的线程写入（relaxed 的 load + store），snapshot() 可以在任意线程中随时读取并合并，不会阻塞记录的线程。
+     */
+    template <unsigned SubBits = 5>
+    class LatencyHistogram {
+        static_assert(SubBits >= 1 && SubBits <= 10, "SubBits out of range");
+
+    public:
+        /// 可以区分的最大 tick 数为 2^MaxBits，更大的耗时计入最后一个桶。
+        static constexpr unsigned MaxBits = 40;
+
+        static constexpr std::size_t sub_count = std::size_t(1) << SubBits;
+
+        static constexpr std::size_t bucket_count = (MaxBits - SubBits + 2) * sub_count;
+
+        LatencyHistogram() : _start_ticks(LatencyClock::ticks()), _start_nanos(LatencyClock::nanos()) {};
+
+        LatencyHistogram(const LatencyHistogram &) = delete;
+
+        LatencyHistogram& operator=(const LatencyHistogram &) = delete;
+
+        template <typename Next, typename...Args>
+        decltype(auto) around(Next &next, const Args &...) const {
+            Recorder recorder(*this);
+            return next();
+        };
+
+        /// 记录一次耗时（单位为 LatencyClock 的 tick）。
+        void record(std::uint64_t ticks) const {
+            Buckets &block = _buckets.local();
+            std::atomic<std::uint64_t> &count = block.counts[bucket_of(ticks)];
+            count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            block.sum.store(block.sum.load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+            if (ticks > block.max.load(std::memory_order_relaxed))
+                block.max.store(ticks, std::memory_order_relaxed);
+        };
+
+        /// 合并所有线程的桶，得到各分位数（取所在桶的中点，并且不超过 max）。
+        [[nodiscard]] LatencySnapshot snapshot() const {
+            std::vector<std::uint64_t> merged(bucket_count);
+            LatencySnapshot result;
+            std::uint64_t sum = 0, max = 0;
+            _buckets.for_each([&](const Buckets &block) {
+                for (std::size_t i = 0; i < bucket_count; ++i) {
+                    std::uint64_t n = block.counts[i].load(std::memory_order_relaxed);
+                    merged[i] += n;
+                    result.count += n;
+                }
+                sum += block.sum.load(std::memory_order_relaxed);
+                std::uint64_t block_max = block.max.load(std::memory_order_relaxed);
+                if (block_max > max) max = block_max;
+            });
+            if (result.count == 0) return result;
+
+            double scale = nanos_per_tick();
+            result.mean = double(sum) / double(result.count) * scale;
+            result.max = double(max) * scale;
+            double* targets[] = { &result.p50, &result.p99, &result.p999 };
+            const double quantiles[] = { 0.5, 0.99, 0.999 };
+            std::size_t q = 0;
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i < bucket_count && q < 3; ++i) {
+                seen += merged[i];
+                while (q < 3 && double(seen) >= quantiles[q] * double(result.count)) {
+                    *targets[q] = double(bucket_value(i)) * scale;
+                    if (*targets[q] > result.max) *targets[q] = result.max;
+                    ++q;
+                }
+            }
+            return result;
+        };
+
+        /// 清空所有桶。与记录同时进行时，正在进行的记录可能会丢失。
+        void reset() const {
+            _buckets.for_each([](Buckets &block) {
+                for (auto &count : block.counts)
+                    count.store(0, std::memory_order_relaxed);
+                block.sum.store(0, std::memory_order_relaxed);
+                block.max.store(0, std::memory_order_relaxed);
+            });
+        };
+
+        /// 把 other 的所有记录计入当前线程的桶，invoke_parallel 用它合并每个 worker 各自的 LatencyHistogram。
+        void merge(const LatencyHistogram &other) const {
+            Buckets &block = _buckets.local();
+            other._buckets.for_each([&block](const Buckets &from) {
+                for (std::size_t i = 0; i < bucket_count; ++i) {
+                    std::uint64_t n = from.counts[i].load(std::memory_order_relaxed);
+                    if (n) block.counts[i].store(block.counts[i].load(std::memory_order_relaxed) + n,
+                                                 std::memory_order_relaxed);
+                }
+                block.sum.store(block.sum.load(std::memory_order_relaxed) + from.sum.load(std::memory_order_relaxed),
+                                std::memory_order_relaxed);
+                std::uint64_t from_max = from.max.load(std::memory_order_relaxed);
+                if (from_max > block.max.load(std::memory_order_relaxed))
+                    block.max.store(from_max, std::memory_order_relaxed);
+            });
+        };
+
+        /// 耗时所在的桶。
+        static constexpr std::size_t bucket_of(std::uint64_t ticks) {
+            if (ticks < sub_count) return std::size_t(ticks);
+            unsigned msb = 63 - unsigned(count_leading_zeros(ticks));
+            if (msb >= MaxBits) return bucket_count - 1;
+            std::uint64_t top = ticks >> (msb - SubBits);
+            return std::size_t(msb - SubBits + 1) * sub_count + std::size_t(top - sub_count);
+        };
+
+        /// 桶所代表的耗时（桶内区间的中点）。
+        static constexpr std::uint64_t bucket_value(std::size_t bucket) {
+            if (bucket < 2 * sub_count) return bucket;
+            unsigned shift = unsigned(bucket / sub_count) - 1;
+            std::uint64_t low = (sub_count + bucket % sub_count) << shift;
+            return low + (std::uint64_t(1) << shift) / 2;
+        };
+
+    private:
+        /// 一个线程的桶，只有该线程写入。
+        struct Buckets {
+            std::atomic<std::uint64_t> counts[bucket_count] {};
+            std::atomic<std::uint64_t> sum { 0 };
+            std::atomic<std::uint64_t> max { 0 };
+        };
+
+        /// 在 around() 返回（或抛出异常）时记录耗时。
+        class Recorder {
+        public:
+            explicit Recorder(const LatencyHistogram &histogram) noexcept :
+                _histogram(histogram), _start(LatencyClock::ticks()) {};
+
+            Recorder(const Recorder &) = delete;
+
+            ~Recorder() { _histogram.record(LatencyClock::ticks() - _start); };
+
+        private:
+            const LatencyHistogram &_histogram;
+            std::uint64_t _start;
+        };
+
+        static constexpr int count_leading_zeros(std::uint64_t value) {
+#if defined(__clang__) || defined(__GNUC__)
+            return __builtin_clzll(value);
+#else
+            int n = 0;
+            for (std::uint64_t bit = std::uint64_t(1) << 63; !(value & bit); bit >>= 1) ++n;
+            return n;
+#endif
+        };
+
+        /// 根据创建以来经过的 tick 和纳秒数换算，不使用 TSC 时为 1。
+        double nanos_per_tick() const {
+            if (!LatencyClock::uses_tsc()) return 1;
+            std::uint64_t ticks = LatencyClock::ticks() - _start_ticks;
+            std::uint64_t nanos = LatencyClock::nanos() - _start_nanos;
+            return ticks > 0 && nanos > 0 ? double(nanos) / double(ticks) : 1;
+        };
+
+        std::uint64_t _start_ticks;
+        std::uint64_t _start_nanos;
+        AOP_ThreadBlocks<Buckets> _buckets;
+
+    };
+
+}
+
+#endif
+
+#endif //LATENCYHISTOGRAM_HPP
@@ -0,0 +1,236 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#ifndef MEMOIZE_HPP
+#define MEMOIZE_HPP
+
+#ifdef MEMOIZE_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+namespace Base {
+
+//------------------------------------------------------------------------------------------------
+
+    /// Memoize 默认使用的哈希函数，依次组合参数元组中每个元素的 std::hash。
+    struct MemoizeHash {
+        template <typename...Ts>
+        std::size_t operator()(const std::tuple<Ts...> &key) const {
+            return std::apply([](const Ts &...values) {
+                std::size_t seed = 0;
+                ((seed ^= std::hash<Ts>()(values) + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2)), ...);
+                return seed;
+            }, key);
+        };
+    };
+
+    /// Memoize 的配置。
+    struct MemoizeConfig {
+        /// 所有分片合计最多缓存的结果数目（平均分配到各个分片）。
+        std::size_t capacity = 1024;
+        /// 结果的有效期，为 0 时永不过期。
+        std::chrono::nanoseconds ttl = std::chrono::nanoseconds::zero();
+        /// 分片数目，会向上取整为 2 的幂，每个分片各自持有一把锁。
+        std::size_t shards = 16;
+    };
+
+    /// Memoize 的计数器快照。
+    struct MemoizeStats {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        /// 因容量不足被淘汰的结果数目。
+        std::uint64_t evictions = 0;
+        /// 因超过有效期被丢弃的结果数目（同时也计入 misses）。
+        std::uint64_t expirations = 0;
+        std::size_t size = 0;
+    };
+
+//------------------------------------------------------------------------------------------------
+
+    template <typename Signature, typename Hash = MemoizeHash, typename Clock = std::chrono::steady_clock>
+    class Memoize;
+
+    /*
+     * 记忆化 aspect，通过 around() 织入：以参数（去掉引用和 cv 后保存为元组）为键缓存被调用函数的返回值，
+     * 命中时直接返回缓存的结果而不调用被调用函数。只有参数可以构造 std::tuple<std::decay_t<Args>...>
+     * 且返回值可以转换为 R 的调用才会被缓存，其他调用不受影响。
+     * 缓存按哈希值分片，每个分片为一个带锁的 LRU，可以被多个线程同时使用；未命中时在锁外调用被调用函数，
+     * 因此多个线程可能同时计算同一个键。缓存不区分被调用的函数，一个 Memoize 只应织入签名相同的同一个函数。
+     * 用法：AOP_Wrapper<Service, Memoize<int(int, std::string)>> wrapper { service, MemoizeConfig { 4096 } };
+     */
+    template <typename R, typename...Args, typename Hash, typename Clock>
+    class Memoize<R(Args...), Hash, Clock> {
+        static_assert(!std::is_void_v<R> && !std::is_reference_v<R>, "Memoize can only cache values");
+
+    public:
+        using Key = std::tuple<std::decay_t<Args>...>;
+
+        Memoize() : Memoize(MemoizeConfig()) {};
+
+        explicit Memoize(const MemoizeConfig &config) :
+            _shard_count(round_up(config.shards)), _ttl(config.ttl),
+            _shards(std::make_unique<Shard[]>(_shard_count)) {
+            std::size_t capacity = (config.capacity + _shard_count - 1) / _shard_count;
+            for (std::size_t i = 0; i < _shard_count; ++i)
+                _shards[i].capacity = capacity > 0 ? capacity : 1;
+        };
+
+        /// 被移动后的 Memoize 没有分片，around() 直接调用 next()。
+        Memoize(Memoize &&other) noexcept :
+            _shard_count(std::exchange(other._shard_count, 0)), _ttl(other._ttl),
+            _shards(std::move(other._shards)) {};
+
+        Memoize& operator=(Memoize &&other) noexcept {
+            if (this != &other) {
+                _shard_count = std::exchange(other._shard_count, 0);
+                _ttl = other._ttl;
+                _shards = std::move(other._shards);
+            }
+            return *this;
+        };
+
+        /// 命中时返回缓存结果的副本，否则调用 next() 并缓存它的返回值。
+        template <typename Next, typename...A,
+                  typename = std::enable_if_t<std::is_constructible_v<Key, const A&...>
+                      && std::is_convertible_v<decltype(std::declval<Next&>()()), R>>>
+        R around(Next &next, const A &...args) const {
+            if (_shard_count == 0) return next();
+            Entry key { Key(args...), 0 };
+            key.hash = Hash()(key.key);
+            Shard &shard = _shards[key.hash & (_shard_count - 1)];
+            typename Clock::time_point now = expiring() ? Clock::now() : typename Clock::time_point();
+            if (std::optional<R> value = shard.find(key, now))
+                return std::move(*value);
+            R result = next();
+            shard.insert(std::move(key), result,
+                         expiring() ? now + std::chrono::duration_cast<typename Clock::duration>(_ttl) : now);
+            return result;
+        };
+
+        /// 所有分片计数器的和。
+        [[nodiscard]] MemoizeStats stats() const {
+            MemoizeStats stats;
+            for (std::size_t i = 0; i < _shard_count; ++i) {
+                std::lock_guard<std::mutex> lock(_shards[i].mutex);
+                stats.hits += _shards[i].stats.hits;
+                stats.misses += _shards[i].stats.misses;
+                stats.evictions += _shards[i].stats.evictions;
+                stats.expirations += _shards[i].stats.expirations;
+                stats.size += _shards[i].index.size();
+            }
+            return stats;
+        };
+
+        /// 清空缓存，计数器保持不变。
+        void clear() const {
+            for (std::size_t i = 0; i < _shard_count; ++i) {
+                std::lock_guard<std::mutex> lock(_shards[i].mutex);
+                _shards[i].index.clear();
+                _shards[i].lru.clear();
+            }
+        };
+
+    private:
+        /// 参数元组和它的哈希值，哈希值只计算一次。
+        struct Entry {
+            Key key;
+            std::size_t hash;
+        };
+
+        struct Node {
+            Entry entry;
+            R value;
+            typename Clock::time_point expire;
+        };
+
+        struct EntryHash {
+            std::size_t operator()(const Entry* entry) const { return entry->hash; };
+        };
+
+        struct EntryEqual {
+            bool operator()(const Entry* lhs, const Entry* rhs) const {
+                return lhs->hash == rhs->hash && lhs->key == rhs->key;
+            };
+        };
+
+        /// 一个分片：lru 按最近使用的顺序保存结果（最近的在前），index 指向 lru 中各节点的键。
+        /// 对齐到 64 字节，避免相邻分片的锁落在同一缓存行上。
+        struct alignas(64) Shard {
+            using List = std::list<Node>;
+
+            std::optional<R> find(const Entry &key, typename Clock::time_point now) {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto iter = index.find(&key);
+                if (iter == index.end()) {
+                    ++stats.misses;
+                    return std::nullopt;
+                }
+                typename List::iterator node = iter->second;
+                if (now > node->expire) {
+                    index.erase(iter);
+                    lru.erase(node);
+                    ++stats.expirations;
+                    ++stats.misses;
+                    return std::nullopt;
+                }
+                lru.splice(lru.begin(), lru, node);
+                ++stats.hits;
+                return node->value;
+            };
+
+            void insert(Entry &&key, const R &value, typename Clock::time_point expire) {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto iter = index.find(&key);
+                if (iter != index.end()) {
+                    iter->second->value = value;
+                    iter->second->expire = expire;
+                    lru.splice(lru.begin(), lru, iter->second);
+                    return;
+                }
+                if (index.size() >= capacity) {
+                    index.erase(&lru.back().entry);
+                    lru.pop_back();
+                    ++stats.evictions;
+                }
+                lru.push_front(Node { std::move(key), value, expire });
+                index.emplace(&lru.front().entry, lru.begin());
+            };
+
+            mutable std::mutex mutex;
+            List lru;
+            std::unordered_map<const Entry*, typename List::iterator, EntryHash, EntryEqual> index;
+            std::size_t capacity = 1;
+            MemoizeStats stats;
+        };
+
+        static std::size_t round_up(std::size_t n) {
+            std::size_t result = 1;
+            while (result < n) result <<= 1;
+            return result;
+        };
+
+        [[nodiscard]] bool expiring() const { return _ttl != std::chrono::nanoseconds::zero(); };
+
+        std::size_t _shard_count;
+        std::chrono::nanoseconds _ttl;
+        std::unique_ptr<Shard[]> _shards;
+
+    };
+
+}
+
+#endif
+
+#endif //MEMOIZE_HPP
@@ -0,0 +1,113 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#ifndef PERTHREAD_HPP
+#define PERTHREAD_HPP
+
+#ifdef PERTHREAD_HPP
+
+#include "AOP.hpp"
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace Base {
+
+//------------------------------------------------------------------------------------------------
+
+    /*
+     * 每个线程各自持有一个 Aspect 的 aspect：Aspect 的切入函数（包括 around()、各种 error() 和批量切入函数）
+     * 在调用线程自己的实例上运行，因此有状态的 aspect 不需要同步，多个线程可以共享同一个 AOP 对象。
+     * 实例保存在 AOP_ThreadBlocks 中（线程第一次调用时默认构造，PerThread 销毁时释放），复制得到的 PerThread 没有任何实例。
+     * PerThread 自身的切入函数都是 const 的，可以用于 const 的 AOP 和 AOP_ConstOnly。
+     * for_each(fun) 依次以各线程的实例调用 fun(const Aspect &)，Aspect 存在 merge(const Aspect &) 时 merged() 返回合并后的结果；
+     * 需要精确结果时应在其他线程停止调用之后读取。
+     * 用法：AOP_Wrapper<Service, AOP_ConstOnly, PerThread<CallCounter>> wrapper { service };
+     */
+    template <typename Aspect>
+    class PerThread {
+    public:
+        using error_types = typename AOP_ErrorTypes<Aspect>::type;
+
+        using pointcut = AOP_PointcutOf<Aspect>;
+
+        /// 当前线程的实例，不存在时创建。
+        Aspect& local() const { return _instances.local(); };
+
+        /// 以每个线程的实例调用 fun(const Aspect &)，顺序与线程第一次调用的顺序相反。
+        template <typename Fun>
+        void for_each(Fun &&fun) const {
+            _instances.for_each([&fun](Aspect &aspect) { fun(static_cast<const Aspect&>(aspect)); });
+        };
+
+        /// 已经创建的实例数目。
+        [[nodiscard]] std::size_t size() const {
+            std::size_t count = 0;
+            for_each([&count](const Aspect &) { ++count; });
+            return count;
+        };
+
+        /// 默认构造一个 Aspect，依次 merge 每个线程的实例。
+        template <typename A = Aspect>
+        auto merged() const -> decltype(void(std::declval<A&>().merge(std::declval<const A&>())), A()) {
+            A result;
+            for_each([&result](const Aspect &aspect) { result.merge(aspect); });
+            return result;
+        };
+
+        /// 把 other 的所有实例合并到当前线程的实例中，invoke_parallel 用它合并每个 worker 各自的 PerThread。
+        template <typename A = Aspect>
+        auto merge(const PerThread &other) const -> decltype(void(std::declval<A&>().merge(std::declval<const A&>()))) {
+            Aspect &target = local();
+            other.for_each([&target](const Aspect &aspect) { target.merge(aspect); });
+        };
+
+        template <typename...Args, typename A = Aspect>
+        auto before(const Args &...args) const -> decltype(void(std::declval<A&>().before(args...))) {
+            local().before(args...);
+        };
+
+        template <typename...Args, typename A = Aspect>
+        auto after(const Args &...args) const -> decltype(void(std::declval<A&>().after(args...))) {
+            local().after(args...);
+        };
+
+        /// 包括 error(std::exception_ptr)、error(const E &) 和 AOP_ResultErrors 的 error(const R &)。
+        template <typename E, typename A = Aspect>
+        auto error(const E &error) const -> decltype(void(std::declval<A&>().error(error))) {
+            local().error(error);
+        };
+
+        template <typename Next, typename...Args, typename A = Aspect>
+        auto around(Next &next, const Args &...args) const -> decltype(std::declval<A&>().around(next, args...)) {
+            return local().around(next, args...);
+        };
+
+        template <typename A = Aspect>
+        auto before_batch(std::size_t count) const -> decltype(void(std::declval<A&>().before_batch(count))) {
+            local().before_batch(count);
+        };
+
+        template <typename A = Aspect>
+        auto after_batch(std::size_t count) const -> decltype(void(std::declval<A&>().after_batch(count))) {
+            local().after_batch(count);
+        };
+
+        /// 对每个线程的实例调用 destroy()。
+        template <typename A = Aspect>
+        auto destroy() const -> decltype(void(std::declval<A&>().destroy())) {
+            _instances.for_each([](Aspect &aspect) { aspect.destroy(); });
+        };
+
+    private:
+        AOP_ThreadBlocks<Aspect> _instances;
+
+    };
+
+}
+
+#endif
+
+#endif //PERTHREAD_HPP
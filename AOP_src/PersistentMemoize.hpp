@@ -0,0 +1,339 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#ifndef PERSISTENTMEMOIZE_HPP
+#define PERSISTENTMEMOIZE_HPP
+
+#ifdef PERSISTENTMEMOIZE_HPP
+
+#if __has_include(<sys/mman.h>) && __has_include(<sys/file.h>) && __has_include(<unistd.h>)
+/// 只在 POSIX 系统上可用（需要 mmap 和 flock）。
+#define AOP_HAS_PERSISTENT_MEMOIZE
+#endif
+
+#ifdef AOP_HAS_PERSISTENT_MEMOIZE
+
+#include "Memoize.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Base {
+
+//------------------------------------------------------------------------------------------------
+
+    /// PersistentMemoize 的配置。
+    struct PersistentMemoizeConfig {
+        /// 缓存文件的路径，不存在时会被创建。
+        std::string path;
+        /// 槽位数目，会向上取整为 2 的幂。文件大小固定为 64 + slots * 槽位大小 字节。
+        std::size_t slots = 1 << 16;
+        /// 使用者定义的版本号，被调用函数的语义改变时应修改它，与文件中的版本号不同时旧的结果会被丢弃。
+        std::uint32_t version = 0;
+    };
+
+    template <typename Signature>
+    class PersistentMemoize;
+
+    /*
+     * 结果保存在内存映射文件中的记忆化 aspect，进程重启后重新映射同一个文件即可直接命中之前缓存的结果。
+     * 文件是一个固定布局的开放寻址哈希表：64 字节的文件头（魔数、格式版本、使用者版本号、参数和返回值的大小、槽位数目）
+     * 之后是 slots 个槽位，任何一项与当前程序不一致时整个文件被清空重建。
+     * 参数和返回值必须是平凡可复制的类型（返回值还必须可以默认构造）。参数按字节比较和哈希，因此参数的类型必须满足
+     * std::has_unique_object_representations：值相等时字节也相同（含有填充字节的类型和浮点数都不满足，例如 -0.0 == 0.0）。
+     * 每个槽位由一个 seqlock 保护：读取不加锁，写入时如果槽位正被其他线程（或进程）写入则放弃本次缓存。
+     * 哈希冲突时最多探测 probe_limit 个槽位，都被占用时覆盖第一个（计入 evictions），没有 LRU 和有效期。
+     * 每个 PersistentMemoize 在析构前持有文件的共享锁（flock）。只有独占打开文件时才会重建文件或清理上一个进程未写完的槽位，
+     * 文件正被其他进程使用且文件头或大小与当前程序不一致时不使用该文件。
+     * 打开的过程由旁边的 path + ".lock" 文件上的独占锁串行化（该文件不会被删除），
+     * 因此独占锁降级为共享锁时其他进程不会在两次 flock 之间误以为自己独占了文件。
+     * 文件无法打开、加锁或映射时 is_open() 为 false，此时该 aspect 不缓存任何结果。
+     */
+    template <typename R, typename...Args>
+    class PersistentMemoize<R(Args...)> {
+        static_assert(std::is_trivially_copyable_v<R> && std::is_default_constructible_v<R> && !std::is_reference_v<R>,
+                      "PersistentMemoize can only cache trivially copyable and default constructible values");
+        static_assert((std::is_trivially_copyable_v<std::decay_t<Args>> && ...),
+                      "PersistentMemoize only supports trivially copyable arguments");
+        static_assert((std::has_unique_object_representations_v<std::decay_t<Args>> && ...),
+                      "PersistentMemoize compares arguments byte by byte, so they must have no padding and no floating point");
+        static_assert(std::atomic<std::uint32_t>::is_always_lock_free
+                      && std::atomic<std::uint64_t>::is_always_lock_free, "lock-free atomics are required");
+
+    public:
+        /// 文件格式的版本，槽位布局改变时修改。
+        static constexpr std::uint32_t format = 1;
+
+        static constexpr std::size_t probe_limit = 4;
+
+        explicit PersistentMemoize(const PersistentMemoizeConfig &config) {
+            open(config);
+        };
+
+        PersistentMemoize(PersistentMemoize &&other) noexcept :
+            _header(std::exchange(other._header, nullptr)), _slots(std::exchange(other._slots, nullptr)),
+            _mask(other._mask), _bytes(other._bytes), _fd(std::exchange(other._fd, -1)), _version(other._version),
+            _warm(other._warm) {};
+
+        PersistentMemoize& operator=(PersistentMemoize &&) = delete;
+
+        ~PersistentMemoize() {
+            if (_header) ::munmap(_header, _bytes);
+            if (_fd >= 0) ::close(_fd);
+        };
+
+        /// 命中时直接返回文件中的结果，否则调用 next() 并把返回值写入文件。
+        template <typename Next, typename...A,
+                  typename = std::enable_if_t<sizeof...(A) == sizeof...(Args)
+                      && std::is_convertible_v<decltype(std::declval<Next&>()()), R>>>
+        R around(Next &next, const A &...args) const {
+            if (!_header) return next();
+            unsigned char key[key_size] {};
+            pack(key, std::make_index_sequence<sizeof...(Args)>(), args...);
+            std::uint64_t hash = hash_bytes(key);
+            if (std::optional<R> value = find(key, hash)) {
+                _hits.fetch_add(1, std::memory_order_relaxed);
+                return *value;
+            }
+            _misses.fetch_add(1, std::memory_order_relaxed);
+            R result = next();
+            insert(key, hash, result);
+            return result;
+        };
+
+        [[nodiscard]] bool is_open() const { return _header != nullptr; };
+
+        /// 打开时文件中已经存在有效的缓存。
+        [[nodiscard]] bool is_warm() const { return _warm; };
+
+        /// 本进程中的计数器，size 为文件中已被占用的槽位数目（需要遍历整个表）。
+        [[nodiscard]] MemoizeStats stats() const {
+            MemoizeStats stats;
+            stats.hits = _hits.load(std::memory_order_relaxed);
+            stats.misses = _misses.load(std::memory_order_relaxed);
+            stats.evictions = _evictions.load(std::memory_order_relaxed);
+            if (_header) {
+                for (std::size_t i = 0; i <= _mask; ++i)
+                    stats.size += _slots[i].hash.load(std::memory_order_relaxed) != 0;
+            }
+            return stats;
+        };
+
+        /// 把映射的内容同步写回文件（正常情况下由内核负责写回）。
+        bool flush() const {
+            return _header && ::msync(_header, _bytes, MS_SYNC) == 0;
+        };
+
+    private:
+        static constexpr std::size_t arg_size = (std::size_t(0) + ... + sizeof(std::decay_t<Args>));
+
+        /// 参数依次按字节拼接为键，没有参数时占用一个字节。
+        static constexpr std::size_t key_size = arg_size > 0 ? arg_size : 1;
+
+        struct Header {
+            char magic[8];
+            std::uint32_t format;
+            std::uint32_t version;
+            std::uint64_t key_size;
+            std::uint64_t value_size;
+            std::uint64_t slot_count;
+        };
+
+        static constexpr std::size_t header_size = 64;
+
+        static_assert(sizeof(Header) <= header_size);
+
+        /// seq 为奇数时槽位正在被写入，hash 为 0 时槽位为空。
+        struct Slot {
+            std::atomic<std::uint32_t> seq;
+            std::uint32_t reserved;
+            std::atomic<std::uint64_t> hash;
+            unsigned char key[key_size];
+            unsigned char value[sizeof(R)];
+        };
+
+        static constexpr char magic[8] = { 'A', 'O', 'P', 'M', 'E', 'M', 'O', '\0' };
+
+        template <std::size_t...I, typename...A>
+        static void pack(unsigned char* key, std::index_sequence<I...>, const A &...args) {
+            std::size_t offset = 0;
+            ((pack_one<std::decay_t<std::tuple_element_t<I, std::tuple<Args...>>>>(key, offset, args)), ...);
+        };
+
+        template <typename T, typename A>
+        static void pack_one(unsigned char* key, std::size_t &offset, const A &arg) {
+            T value(arg);
+            std::memcpy(key + offset, &value, sizeof(T));
+            offset += sizeof(T);
+        };
+
+        /// FNV-1a，结果不为 0。
+        static std::uint64_t hash_bytes(const unsigned char* key) {
+            std::uint64_t hash = 0xcbf29ce484222325ULL;
+            for (std::size_t i = 0; i < key_size; ++i) {
+                hash ^= key[i];
+                hash *= 0x100000001b3ULL;
+            }
+            return hash ? hash : 1;
+        };
+
+        std::optional<R> find(const unsigned char* key, std::uint64_t hash) const {
+            for (std::size_t i = 0; i < probe_limit; ++i) {
+                Slot &slot = _slots[(hash + i) & _mask];
+                std::uint32_t seq = slot.seq.load(std::memory_order_acquire);
+                std::uint64_t slot_hash = slot.hash.load(std::memory_order_relaxed);
+                if (slot_hash == 0) return std::nullopt;
+                if (seq & 1 || slot_hash != hash) continue;
+                unsigned char copy[key_size];
+                R value;
+                std::memcpy(copy, slot.key, key_size);
+                std::memcpy(&value, slot.value, sizeof(R));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.seq.load(std::memory_order_relaxed) != seq) continue;
+                if (std::memcmp(copy, key, key_size) == 0)
+                    return value;
+            }
+            return std::nullopt;
+        };
+
+        void insert(const unsigned char* key, std::uint64_t hash, const R &result) const {
+            Slot* target = nullptr;
+            for (std::size_t i = 0; i < probe_limit && !target; ++i) {
+                Slot &slot = _slots[(hash + i) & _mask];
+                std::uint64_t slot_hash = slot.hash.load(std::memory_order_relaxed);
+                if (slot_hash == 0 || (slot_hash == hash && std::memcmp(slot.key, key, key_size) == 0))
+                    target = &slot;
+            }
+            if (!target) {
+                target = &_slots[hash & _mask];
+                _evictions.fetch_add(1, std::memory_order_relaxed);
+            }
+            std::uint32_t seq = target->seq.load(std::memory_order_relaxed);
+            if (seq & 1 || !target->seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire))
+                return;
+            std::atomic_thread_fence(std::memory_order_release);
+            std::memcpy(target->key, key, key_size);
+            std::memcpy(target->value, &result, sizeof(R));
+            target->hash.store(hash, std::memory_order_relaxed);
+            target->seq.store(seq + 2, std::memory_order_release);
+        };
+
+        bool valid_header() const {
+            return std::memcmp(_header->magic, magic, sizeof(magic)) == 0
+                && _header->format == format && _header->version == _version
+                && _header->key_size == key_size && _header->value_size == sizeof(R)
+                && _header->slot_count == _mask + 1;
+        };
+
+        void open(const PersistentMemoizeConfig &config) {
+            std::size_t slots = 1;
+            while (slots < config.slots) slots <<= 1;
+            _mask = slots - 1;
+            _version = config.version;
+            _bytes = header_size + slots * sizeof(Slot);
+
+            /// 持有初始化锁期间没有其他进程正在打开该文件，缓存文件上的独占锁只可能来自这里。
+            int init = ::open((config.path + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (init < 0) return;
+            if (::flock(init, LOCK_EX) == 0) open_locked(config.path, slots);
+            ::close(init);
+        };
+
+        /// 在初始化锁中打开并映射文件，失败时 _header 仍为 nullptr。
+        void open_locked(const std::string &path, std::size_t slots) {
+            int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0) return;
+            /// 拿到独占锁说明没有其他进程在使用该文件，否则以共享锁打开（其他进程只持有共享锁，不会阻塞）。
+            bool exclusive = ::flock(fd, LOCK_EX | LOCK_NB) == 0;
+            if (!exclusive && ::flock(fd, LOCK_SH) != 0) {
+                ::close(fd);
+                return;
+            }
+            struct stat info {};
+            bool same_size = ::fstat(fd, &info) == 0 && std::size_t(info.st_size) == _bytes;
+            if (!same_size && (!exclusive || ::ftruncate(fd, off_t(_bytes)) != 0)) {
+                ::close(fd);
+                return;
+            }
+            void* address = ::mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (address == MAP_FAILED) {
+                ::close(fd);
+                return;
+            }
+            _header = static_cast<Header*>(address);
+            _slots = reinterpret_cast<Slot*>(static_cast<unsigned char*>(address) + header_size);
+
+            if (same_size && valid_header()) {
+                _warm = true;
+                if (exclusive) recover();
+            } else if (!exclusive) {
+                ::munmap(address, _bytes);
+                ::close(fd);
+                _header = nullptr;
+                _slots = nullptr;
+                return;
+            } else {
+                std::memset(address, 0, _bytes);
+                _header->format = format;
+                _header->version = _version;
+                _header->key_size = key_size;
+                _header->value_size = sizeof(R);
+                _header->slot_count = slots;
+                std::memcpy(_header->magic, magic, sizeof(magic));
+            }
+            /// flock 的降级不是原子的，但其他进程需要先拿到初始化锁才会尝试独占锁。
+            if (exclusive && ::flock(fd, LOCK_SH) != 0) {
+                ::munmap(address, _bytes);
+                ::close(fd);
+                _header = nullptr;
+                _slots = nullptr;
+                return;
+            }
+            _fd = fd;
+        };
+
+        /// 清空上一个进程中未写完（seq 为奇数）的槽位，只在独占文件时调用，此时没有其他进程正在写入。
+        void recover() {
+            for (std::size_t i = 0; i <= _mask; ++i) {
+                std::uint32_t seq = _slots[i].seq.load(std::memory_order_relaxed);
+                if (seq & 1) {
+                    _slots[i].hash.store(0, std::memory_order_relaxed);
+                    _slots[i].seq.store(seq + 1, std::memory_order_release);
+                }
+            }
+        };
+
+        Header* _header = nullptr;
+        Slot* _slots = nullptr;
+        std::size_t _mask = 0;
+        std::size_t _bytes = 0;
+        int _fd = -1;
+        std::uint32_t _version = 0;
+        bool _warm = false;
+        mutable std::atomic<std::uint64_t> _hits { 0 };
+        mutable std::atomic<std::uint64_t> _misses { 0 };
+        mutable std::atomic<std::uint64_t> _evictions { 0 };
+
+    };
+
+}
+
+#endif
+
+#endif
+
+#endif //PERSISTENTMEMOIZE_HPP
@@ -0,0 +1,134 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#ifndef SAMPLED_HPP
+#define SAMPLED_HPP
+
+#ifdef SAMPLED_HPP
+
+#include "AOP.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+namespace Base {
+
+//------------------------------------------------------------------------------------------------
+
+    /*
+     * 每 N 次调用采样一次（每个线程中第 1、N + 1、2N + 1 ... 次调用），每个线程有一个倒计数器。
+     * 计数器由所有使用同一个 SampleEvery<N, Tag> 的 Sampled 共享，交替调用的函数之间可能产生偏差
+     * （例如两个函数交替调用且 N = 2 时总是只采样其中一个），需要独立计数时使用不同的 Tag 或 SampleRandom。
+     */
+    template <std::uint32_t N, typename Tag = void>
+    class SampleEvery {
+        static_assert(N > 0, "N must be positive");
+
+    public:
+        static bool sample() noexcept {
+            if (--_countdown != 0) return false;
+            _countdown = N;
+            return true;
+        };
+
+    private:
+        static inline thread_local std::uint32_t _countdown = 1;
+    };
+
+    /*
+     * 平均每 N 次调用采样一次，两次采样的间隔服从几何分布（即每次调用独立地以 1/N 的概率被采样），
+     * 间隔只在采样时由每个线程各自的 xorshift 随机数生成，未被采样的调用与 SampleEvery 一样只有一次递减和分支。
+     */
+    template <std::uint32_t N, typename Tag = void>
+    class SampleRandom {
+        static_assert(N > 0, "N must be positive");
+
+    public:
+        static bool sample() noexcept {
+            if (--_countdown != 0) return false;
+            _countdown = next_gap();
+            return true;
+        };
+
+    private:
+        static std::uint32_t next_gap() noexcept {
+            if constexpr (N == 1) {
+                return 1;
+            } else {
+                double uniform = (double(next_random() >> 11) + 1) * (1.0 / 9007199254740992.0);
+                double gap = std::floor(std::log(uniform) / std::log1p(-1.0 / N)) + 1;
+                return gap < 4e9 ? std::uint32_t(gap) : 4000000000u;
+            }
+        };
+
+        static std::uint64_t next_random() noexcept {
+            if (_state == 0) {
+                _state = reinterpret_cast<std::uintptr_t>(&_state) * 0x9e3779b97f4a7c15ULL | 1;
+            }
+            _state ^= _state >> 12;
+            _state ^= _state << 25;
+            _state ^= _state >> 27;
+            return _state * 0x2545f4914f6cdd1dULL;
+        };
+
+        static inline thread_local std::uint32_t _countdown = 1;
+        static inline thread_local std::uint64_t _state = 0;
+    };
+
+//------------------------------------------------------------------------------------------------
+
+    /*
+     * 只在被 Policy::sample() 选中的调用中运行 Aspect 的 aspect，Policy 为 SampleEvery 或 SampleRandom 等。
+     * Sampled 通过 around() 织入：每次调用只判断一次是否采样，被选中时由 AOP_AroundRun 运行 Aspect 的切入函数，
+     * 因此同一次调用的 before() 和 after() 总是成对出现，嵌套的 invoke 也不会相互影响。
+     * 与直接织入 Aspect 的区别：Aspect 的 before() 在所有 aspect 的 before() 之后、Sampled 所在位置的 around() 中运行，
+     * after()/error() 也相应地在外层的 after()/error() 之前运行；需要 InvocationContext 的切入函数
+     * 和 AOP_ResultErrors 的 error(const R &) 不会被调用。destroy() 总是被调用。
+     * 用法：AOP_Wrapper<Service, Sampled<ArgCapture, SampleRandom<1000>>> wrapper { service };
+     */
+    template <typename Aspect, typename Policy>
+    class Sampled {
+    public:
+        using pointcut = AOP_PointcutOf<Aspect>;
+
+        Sampled() = default;
+
+        explicit Sampled(const Aspect &aspect) : _aspect(aspect) {};
+
+        explicit Sampled(Aspect &&aspect) : _aspect(std::move(aspect)) {};
+
+        Aspect& aspect() { return _aspect; };
+
+        const Aspect& aspect() const { return _aspect; };
+
+        template <typename Next, typename...Args>
+        decltype(auto) around(Next &next, const Args &...args) {
+            if (AOP_UNLIKELY(Policy::sample())) return AOP_AroundRun::run(_aspect, next, args...);
+            return next();
+        };
+
+        template <typename Next, typename...Args>
+        decltype(auto) around(Next &next, const Args &...args) const {
+            if (AOP_UNLIKELY(Policy::sample())) return AOP_AroundRun::run(_aspect, next, args...);
+            return next();
+        };
+
+        template <typename A = Aspect>
+        auto destroy() -> decltype(void(std::declval<A&>().destroy())) { _aspect.destroy(); };
+
+        template <typename A = Aspect>
+        auto destroy() const -> decltype(void(std::declval<const A&>().destroy())) { _aspect.destroy(); };
+
+    private:
+        AOP_NO_UNIQUE_ADDRESS Aspect _aspect;
+
+    };
+
+}
+
+#endif
+
+#endif //SAMPLED_HPP
@@ -0,0 +1,132 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#ifndef SWITCHABLE_HPP
+#define SWITCHABLE_HPP
+
+#ifdef SWITCHABLE_HPP
+
+#include "AOP.hpp"
+
+#include <atomic>
+#include <utility>
+
+namespace Base {
+
+//------------------------------------------------------------------------------------------------
+
+    /*
+     * 由 Key 类型标识的全局开关，所有 Switchable<Aspect, Key> 共享它，可以在任意线程中随时切换。
+     * 开关单独占用一个缓存行，平时只被读取（relaxed load），不会与其他数据产生伪共享。
+     */
+    template <typename Key>
+    class AspectSwitch {
+    public:
+        AspectSwitch() = delete;
+
+        static bool enabled() noexcept { return _flag.value.load(std::memory_order_relaxed); };
+
+        static void set_enabled(bool enabled) noexcept { _flag.value.store(enabled, std::memory_order_relaxed); };
+
+        static void enable() noexcept { set_enabled(true); };
+
+        static void disable() noexcept { set_enabled(false); };
+
+    private:
+        struct alignas(64) Flag {
+            std::atomic<bool> value { false };
+        };
+
+        static inline Flag _flag;
+    };
+
+    /// Switchable 的开关状态，Key 为 void 时每个对象各自持有一个开关。
+    template <typename Key>
+    struct AOP_SwitchState {
+        [[nodiscard]] bool enabled() const noexcept { return AspectSwitch<Key>::enabled(); };
+
+        void set_enabled(bool enabled) const noexcept { AspectSwitch<Key>::set_enabled(enabled); };
+    };
+
+    template <>
+    struct AOP_SwitchState<void> {
+        AOP_SwitchState() = default;
+
+        AOP_SwitchState(const AOP_SwitchState &other) noexcept : _flag(other.enabled()) {};
+
+        AOP_SwitchState& operator=(const AOP_SwitchState &other) noexcept {
+            set_enabled(other.enabled());
+            return *this;
+        };
+
+        [[nodiscard]] bool enabled() const noexcept { return _flag.load(std::memory_order_relaxed); };
+
+        void set_enabled(bool enabled) const noexcept { _flag.store(enabled, std::memory_order_relaxed); };
+
+    private:
+        mutable std::atomic<bool> _flag { false };
+    };
+
+//------------------------------------------------------------------------------------------------
+
+    /*
+     * 可以在运行时打开或关闭的 aspect：Aspect 的切入函数只在开关打开时被调用，默认处于关闭状态。
+     * Key 为 void 时开关属于该对象（通过 enable()/disable() 切换），否则由 AspectSwitch<Key> 统一控制。
+     * Switchable 与 Sampled 一样通过 around() 织入：每次调用只读取一次开关（一次 relaxed load 和一个容易预测的分支），
+     * 打开时由 AOP_AroundRun 运行 Aspect 的切入函数，因此切换可以与其他线程中的 invoke 同时进行，
+     * 同一次调用的 before() 和 after()/error() 总是成对出现。与直接织入 Aspect 的区别与 Sampled 相同。destroy() 不受开关影响。
+     * 用法：AOP_Wrapper<Service, Switchable<Trace, IncidentKey>> wrapper { service }; AspectSwitch<IncidentKey>::enable();
+     */
+    template <typename Aspect, typename Key = void>
+    class Switchable {
+    public:
+        using pointcut = AOP_PointcutOf<Aspect>;
+
+        Switchable() = default;
+
+        explicit Switchable(const Aspect &aspect) : _aspect(aspect) {};
+
+        explicit Switchable(Aspect &&aspect) : _aspect(std::move(aspect)) {};
+
+        [[nodiscard]] bool enabled() const noexcept { return _state.enabled(); };
+
+        void set_enabled(bool enabled) const noexcept { _state.set_enabled(enabled); };
+
+        void enable() const noexcept { set_enabled(true); };
+
+        void disable() const noexcept { set_enabled(false); };
+
+        Aspect& aspect() { return _aspect; };
+
+        const Aspect& aspect() const { return _aspect; };
+
+        template <typename Next, typename...Args>
+        decltype(auto) around(Next &next, const Args &...args) {
+            if (AOP_UNLIKELY(enabled())) return AOP_AroundRun::run(_aspect, next, args...);
+            return next();
+        };
+
+        template <typename Next, typename...Args>
+        decltype(auto) around(Next &next, const Args &...args) const {
+            if (AOP_UNLIKELY(enabled())) return AOP_AroundRun::run(_aspect, next, args...);
+            return next();
+        };
+
+        template <typename A = Aspect>
+        auto destroy() -> decltype(void(std::declval<A&>().destroy())) { _aspect.destroy(); };
+
+        template <typename A = Aspect>
+        auto destroy() const -> decltype(void(std::declval<const A&>().destroy())) { _aspect.destroy(); };
+
+    private:
+        AOP_NO_UNIQUE_ADDRESS Aspect _aspect;
+        AOP_NO_UNIQUE_ADDRESS AOP_SwitchState<Key> _state;
+
+    };
+
+}
+
+#endif
+
+#endif //SWITCHABLE_HPP
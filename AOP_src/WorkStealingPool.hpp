@@ -0,0 +1,215 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#ifndef WORKSTEALINGPOOL_HPP
+#define WORKSTEALINGPOOL_HPP
+
+#ifdef WORKSTEALINGPOOL_HPP
+
+#include "AOP.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Base {
+
+//------------------------------------------------------------------------------------------------
+
+    /*
+     * invoke_parallel 默认使用的线程池：每个 worker 有自己的任务队列（从尾部取出），自己的队列为空时从其他队列的头部窃取，
+     * 因此各 worker 先处理相邻的块，负载不均时再由空闲的 worker 分担。所有队列都为空时 worker 在条件变量上休眠。
+     * parallel_for 阻塞调用它的线程直到所有块完成；在本线程池的 worker 中调用（嵌套）时直接在当前线程中顺序运行，不会死锁。
+     */
+    class WorkStealingPool {
+    public:
+        /// 不是本线程池的 worker 时 worker_index() 的返回值。
+        static constexpr unsigned npos = ~0u;
+
+        explicit WorkStealingPool(unsigned threads = std::max(std::thread::hardware_concurrency(), 1u)) :
+            _size(threads), _queues(new Queue[threads]) {
+            _workers.reserve(threads);
+            for (unsigned i = 0; i < threads; ++i)
+                _workers.emplace_back([this, i] { work(i); });
+        };
+
+        WorkStealingPool(const WorkStealingPool &) = delete;
+
+        WorkStealingPool& operator=(const WorkStealingPool &) = delete;
+
+        ~WorkStealingPool() {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _wake.notify_all();
+            for (auto &worker : _workers)
+                worker.join();
+        };
+
+        /// 程序中共享的线程池，线程数为 hardware_concurrency()。
+        static WorkStealingPool& instance() {
+            static WorkStealingPool pool;
+            return pool;
+        };
+
+        /// worker 线程的数目。
+        [[nodiscard]] unsigned size() const { return _size; };
+
+        /// 当前线程在本线程池中的下标。
+        [[nodiscard]] unsigned worker_index() const { return _current_pool == this ? _current_index : npos; };
+
+        /*
+         * 把 [0, count) 按 grain 个一组分块，由各 worker 并行地调用 fun(worker, begin, end)，worker 小于 max(size(), 1)。
+         * 同一个 worker 中的调用是依次进行的。fun 抛出的第一个异常在所有块结束后重新抛出，此后尚未开始的块会被跳过。
+         */
+        template <typename Fun>
+        void parallel_for(std::size_t count, std::size_t grain, Fun &&fun) {
+            if (count == 0) return;
+            unsigned self = worker_index();
+            if (self != npos || _size == 0) {
+                fun(self != npos ? self : 0u, std::size_t(0), count);
+                return;
+            }
+            grain = std::max<std::size_t>(grain, 1);
+            Job job;
+            job.fun = std::addressof(fun);
+            job.run = [](void* fun, unsigned worker, std::size_t begin, std::size_t end) {
+                (*static_cast<std::remove_reference_t<Fun>*>(fun))(worker, begin, end);
+            };
+            std::size_t chunks = (count + grain - 1) / grain;
+            job.remaining = chunks;
+            for (std::size_t q = 0; q < _size; ++q) {
+                std::size_t first = chunks * q / _size, last = chunks * (q + 1) / _size;
+                if (first == last) continue;
+                std::lock_guard<std::mutex> lock(_queues[q].mutex);
+                for (std::size_t c = first; c < last; ++c)
+                    _queues[q].tasks.push_back({ &job, c * grain, std::min(count, (c + 1) * grain) });
+            }
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _pending += chunks;
+            }
+            _wake.notify_all();
+
+            std::unique_lock<std::mutex> lock(job.mutex);
+            job.done.wait(lock, [&job] { return job.remaining == 0; });
+#ifdef AOP_HAS_EXCEPTIONS
+            if (job.error) std::rethrow_exception(job.error);
+#endif
+        };
+
+    private:
+        /// 一次 parallel_for，保存在调用者的栈上。
+        struct Job {
+            void (*run)(void*, unsigned, std::size_t, std::size_t) = nullptr;
+            void* fun = nullptr;
+            std::mutex mutex;
+            std::condition_variable done;
+            std::size_t remaining = 0;
+            std::atomic<bool> failed { false };
+#ifdef AOP_HAS_EXCEPTIONS
+            std::exception_ptr error;
+#endif
+        };
+
+        struct Task {
+            Job* job;
+            std::size_t begin;
+            std::size_t end;
+        };
+
+        struct alignas(AOP_cache_line) Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        void work(unsigned index) {
+            _current_pool = this;
+            _current_index = index;
+            for (;;) {
+                Task task {};
+                if (pop(index, task)) {
+                    {
+                        std::lock_guard<std::mutex> lock(_mutex);
+                        --_pending;
+                    }
+                    execute(index, task);
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wake.wait(lock, [this] { return _stop || _pending > 0; });
+                if (_stop && _pending == 0) return;
+            }
+        };
+
+        /// 先从自己队列的尾部取，再从其他队列的头部窃取。
+        bool pop(unsigned index, Task &task) {
+            {
+                Queue &own = _queues[index];
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if (!own.tasks.empty()) {
+                    task = own.tasks.back();
+                    own.tasks.pop_back();
+                    return true;
+                }
+            }
+            for (unsigned i = 1; i < _size; ++i) {
+                Queue &victim = _queues[(index + i) % _size];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.tasks.empty()) {
+                    task = victim.tasks.front();
+                    victim.tasks.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        /// 最后一块完成时在持有 job.mutex 的情况下通知调用者，之后不再访问 job。
+        static void execute(unsigned index, const Task &task) {
+            Job &job = *task.job;
+            if (!job.failed.load(std::memory_order_relaxed)) {
+#ifdef AOP_HAS_EXCEPTIONS
+                try {
+                    job.run(job.fun, index, task.begin, task.end);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(job.mutex);
+                    if (!job.error) job.error = std::current_exception();
+                    job.failed.store(true, std::memory_order_relaxed);
+                }
+#else
+                job.run(job.fun, index, task.begin, task.end);
+#endif
+            }
+            std::lock_guard<std::mutex> lock(job.mutex);
+            if (--job.remaining == 0) job.done.notify_all();
+        };
+
+        /// worker 线程读取的是 _size 而不是 _workers.size()，后者在构造函数中仍在被修改。
+        const unsigned _size;
+        std::unique_ptr<Queue[]> _queues;
+        std::vector<std::thread> _workers;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::size_t _pending = 0;
+        bool _stop = false;
+
+        static inline thread_local const WorkStealingPool* _current_pool = nullptr;
+        static inline thread_local unsigned _current_index = 0;
+    };
+
+}
+
+#endif
+
+#endif //WORKSTEALINGPOOL_HPP
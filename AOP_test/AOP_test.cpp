@@ -4,9 +4,31 @@
 
 #include "AOP_test.hpp"
 #include "AOP_src/AOP.hpp"
+#include "AOP_src/AsyncInvoke.hpp"
+#include "AOP_src/CallSiteRegistry.hpp"
+#include "AOP_src/DynamicAspect.hpp"
+#include "AOP_src/LatencyHistogram.hpp"
+#include "AOP_src/Memoize.hpp"
+#include "AOP_src/PersistentMemoize.hpp"
+#include "AOP_src/PerThread.hpp"
+#include "AOP_src/Sampled.hpp"
+#include "AOP_src/Switchable.hpp"
+#include "AOP_src/WorkStealingPool.hpp"
 
 #include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 using namespace std;
 using namespace Base;
@@ -434,7 +456,7 @@ void Test::construct_test() {
 }
 
 static void example() {
-#ifdef AOP_WILL_USE_SOURCE_LOCATION /// 用于获得调用函数名称，可以不使用它（删除位于 AOP.hpp 的该宏）
+#ifdef AOP_WILL_USE_SOURCE_LOCATION /// 用于获得调用函数名称，可以不使用它（只有在编译选项中定义 AOP_LEGACY_THREAD_LOCATION 时才会定义该宏）
     using namespace std;
     using namespace Base;
     class A {
@@ -547,8 +569,1841 @@ static void example() {
 #endif
 }
 
+/// hook_order_test 中记录构造、切入函数和析构顺序的 aspect。
+namespace {
+    template <int I>
+    struct Step {
+        explicit Step(string* log) : log(log) { *log += "c" + to_string(I); };
+
+        Step(const Step &other) : log(other.log) { *log += "c" + to_string(I); };
+
+        ~Step() { *log += "~" + to_string(I); };
+
+        void before() { *log += "b" + to_string(I); };
+
+        void after() { *log += "a" + to_string(I); };
+
+        void error(const std::exception_ptr &) { *log += "e" + to_string(I); };
+
+        void destroy() { *log += "x" + to_string(I); };
+
+        string* log;
+    };
+}
+
+/// aspect 由内向外构造、由外向内析构；before() 由外向内调用，after()、error()、destroy() 由内向外调用。
+static void hook_order_test() {
+    struct Plain {
+        int value = 0;
+    };
+
+    string log;
+    {
+        AOP<Step<0>, Step<1>, Step<2>> aop(&log, &log, &log);
+        assert(log == "c2c1c0");
+        log.clear();
+        aop.invoke([&log] { log += "f"; });
+        assert(log == "b0b1b2fa2a1a0");
+        log.clear();
+        try {
+            aop.invoke([] { throw runtime_error("hook_order_test"); });
+            assert(false);
+        } catch (const runtime_error &) {}
+        assert(log == "b0b1b2e2e1e0");
+        log.clear();
+        AOP<Step<0>, Step<1>, Step<2>> copy = aop;
+        assert(log == "c2c1c0");
+        log.clear();
+    }
+    assert(log == "~0~1~2~0~1~2");
+    log.clear();
+    {
+        AOP_Object<Plain, Step<0>, Step<1>> object { AOP<Step<0>, Step<1>>(&log, &log) };
+        log.clear();
+    }
+    assert(log == "x1x0~0~1");
+}
+
+/// 成员指针按 std::invoke 的规则调用，不会复制目标对象。
+static void member_pointer_test() {
+    static int copies = 0;
+
+    struct Mark {
+        void before() { ++count; };
+
+        int count = 0;
+    };
+
+    struct Large {
+        Large() = default;
+
+        Large(const Large &other) : value(other.value) { ++copies; };
+
+        int add(int x) { return value += x; };
+
+        int get() const { return value; };
+
+        int value = 0;
+        char payload[4096] {};
+    };
+
+    AOP<Mark> aop;
+    Large large;
+    int (Large::*add)(int) = &Large::add;
+    int (Large::*get)() const = &Large::get;
+
+    assert(aop.invoke(add, large, 1) == 1);
+    assert(aop.invoke(add, &large, 1) == 2);
+    assert(aop.invoke(add, std::ref(large), 1) == 3);
+    assert(aop.invoke(get, std::cref(large)) == 3);
+    assert(large.value == 3);
+
+    unique_ptr<Large> unique = make_unique<Large>();
+    shared_ptr<Large> shared = make_shared<Large>();
+    assert(aop.invoke(add, unique, 2) == 2);
+    assert(aop.invoke(add, shared, 3) == 3);
+    assert(aop.invoke(get, std::as_const(shared)) == 3);
+
+    int &value = aop.invoke(&Large::value, large);
+    assert(&value == &large.value);
+    static_assert(is_same_v<decltype(aop.invoke(&Large::value, std::as_const(large))), const int&>);
+    static_assert(is_same_v<decltype(aop.invoke(&Large::value, std::move(large))), int&&>);
+    assert(aop.invoke(&Large::value, unique) == 2);
+
+    AOP_Wrapper<Large, Mark> wrapper { large };
+    assert(wrapper.invoke(add, 1) == 4);
+    assert(&wrapper.invoke(&Large::value) == &large.value);
+    assert(copies == 0);
+}
+
+/// error(const E &) 只会被匹配的异常类型调用，error(std::exception_ptr) 作为兜底。
+static void typed_error_test() {
+    static string trace;
+
+    struct OnRuntime {
+        void error(const runtime_error &error) { trace += string("runtime:") + error.what() + ' '; };
+    };
+
+    struct OnCode {
+        using error_types = tuple<int, logic_error>;
+
+        void error(int code) { trace += "code:" + to_string(code) + ' '; };
+
+        void error(const logic_error &) { trace += "logic "; };
+
+        void error(const std::exception_ptr &) { trace += "fallback "; };
+    };
+
+    struct OnConst {
+        void error(const std::exception &) const { trace += "const "; };
+    };
+
+    static_assert(is_same_v<AOP_ErrorTypes<OnRuntime>::type, tuple<runtime_error>>);
+    static_assert(is_same_v<AOP_ErrorTypes<OnCode>::type, tuple<int, logic_error>>);
+    static_assert(is_same_v<AOP_ErrorTypes<const OnCode>::type, tuple<>>);
+    static_assert(is_same_v<AOP_ErrorTypes<const OnConst>::type, tuple<std::exception>>);
+
+    AOP<OnCode, OnConst, OnRuntime> aop;
+    auto raise = [](auto error) { throw error; };
+
+    try {
+        aop.invoke(raise, runtime_error("oops"));
+    } catch (runtime_error &) {}
+    assert(trace == "runtime:oops const fallback ");
+
+    trace.clear();
+    try {
+        aop.invoke(raise, out_of_range("range"));
+    } catch (out_of_range &) {}
+    assert(trace == "const logic ");
+
+    trace.clear();
+    try {
+        aop.invoke(raise, 7);
+    } catch (int) {}
+    assert(trace == "code:7 ");
+
+    trace.clear();
+    try {
+        aop.invoke(raise, 7.0);
+    } catch (double) {}
+    assert(trace == "fallback ");
+
+    /// std::exception 是有歧义的或私有的基类时不能以 std::exception 捕获，但仍然可以匹配 error(const E &)。
+    struct Ambiguous : runtime_error, logic_error {
+        Ambiguous() : runtime_error("ambiguous"), logic_error("ambiguous") {};
+    };
+
+    struct Hidden : private std::exception {};
+
+    struct OnAmbiguous {
+        void error(const Ambiguous &) { trace += "ambiguous "; };
+    };
+
+    struct OnHidden {
+        using error_types = tuple<Hidden, int>;
+
+        void error(const Hidden &) { trace += "hidden "; };
+
+        void error(int) { trace += "int "; };
+    };
+
+    struct OnResult {
+        void error(const optional<int> &) { trace += "result "; };
+    };
+
+    static_assert(is_same_v<AOP_ErrorTypes<OnAmbiguous>::type, tuple<Ambiguous>>);
+    static_assert(is_same_v<AOP_ErrorTypes<OnResult>::type, tuple<>>);
+    static_assert(!AOP_Hooks::has_error<OnResult>());
+
+    AOP<OnConst, OnAmbiguous, OnHidden, OnRuntime, OnResult> bases;
+    trace.clear();
+    try {
+        bases.invoke(raise, Ambiguous());
+    } catch (const Ambiguous &) {}
+    assert(trace == "runtime:ambiguous ambiguous ");
+
+    trace.clear();
+    try {
+        bases.invoke(raise, Hidden());
+    } catch (const Hidden &) {}
+    assert(trace == "hidden ");
+
+    trace.clear();
+    try {
+        bases.invoke(raise, runtime_error("plain"));
+    } catch (const runtime_error &) {}
+    assert(trace == "runtime:plain const ");
+}
+
+/// error() 由内向外调用；某个 error() 抛出异常时，外层的 error() 不再被调用，抛出的是该 error() 的异常。
+static void error_order_test() {
+    static string trace;
+
+    struct Outer {
+        void error(const std::exception_ptr &) { trace += "outer "; };
+    };
+
+    struct Raise {
+        void error(const runtime_error &error) {
+            trace += string("raise:") + error.what() + ' ';
+            throw logic_error("raise");
+        };
+    };
+
+    struct Inner {
+        void error(const std::exception_ptr &) { trace += "inner "; };
+    };
+
+    auto raise = [](auto error) { throw error; };
+
+    AOP<Outer, Raise, Inner> aop;
+    try {
+        aop.invoke(raise, out_of_range("range"));
+        assert(false);
+    } catch (const out_of_range &) {}
+    assert(trace == "inner outer ");
+
+    trace.clear();
+    try {
+        aop.invoke(raise, runtime_error("oops"));
+        assert(false);
+    } catch (const logic_error &error) {
+        assert(string(error.what()) == "raise");
+    }
+    assert(trace == "inner raise:oops ");
+
+    trace.clear();
+    assert(aop.invoke([] { return 1; }) == 1);
+    assert(trace.empty());
+}
+
+/// AOP_ResultErrors：返回值被判断为失败时由内向外调用 error(const R &)，并且不再调用 after()。
+static void result_error_test() {
+    static string trace;
+
+    struct Inner {
+        void error(const optional<int> &) { trace += "inner "; };
+
+        void after() { trace += "after "; };
+    };
+
+    struct Outer {
+        void error(const optional<int> &) { trace += "outer "; };
+
+        void error(const int &code) { trace += "code:" + to_string(code) + ' '; };
+    };
+
+    struct Negative {
+        bool operator()(int result) const { return result < 0; };
+    };
+
+    auto find = [](int x) -> optional<int> {
+        if (x > 0) return x;
+        return nullopt;
+    };
+
+    /// 策略不占用下标，也不需要构造参数。
+    AOP<AOP_ResultErrors<>, Outer, Inner> aop { Outer(), Inner() };
+    static_assert(sizeof(aop) == 1);
+    static_assert(is_same_v<remove_reference_t<decltype(aop.get_aspect<1>())>, Inner>);
+    static_assert(!is_constructible_v<AOP<AOP_ResultErrors<>, Outer, Inner>, AOP_ResultErrors<>, Outer, Inner>);
+    assert(aop.invoke(find, 1) == 1);
+    assert(trace == "after ");
+    trace.clear();
+    assert(!aop.invoke(find, 0));
+    assert(trace == "inner outer ");
+
+    trace.clear();
+    AOP<Outer, AOP_ResultErrors<Negative>> codes;
+    int value = -2;
+    int &ref = codes.invoke([&]() -> int& { return value; });
+    assert(&ref == &value);
+    assert(codes.invoke([] { return 3; }) == 3);
+    assert(trace == "code:-2 ");
+
+    /// 没有 AOP_ResultErrors 时返回值不会被检查。
+    trace.clear();
+    AOP<Outer, Inner> plain;
+    assert(!plain.invoke(find, 0));
+    assert(trace == "after ");
+}
+
+/// invoke 的返回类型与被调用函数完全一致。
+static void invoke_return_test() {
+    struct Counter {
+        void after() { ++count; };
+
+        int count = 0;
+    };
+
+    struct Buffer {
+        int &at(int i) { return data[i]; };
+
+        const int &at(int i) const { return data[i]; };
+
+        int data[256] {};
+    };
+
+    struct Pinned {
+        explicit Pinned(int value) : value(value) {};
+
+        Pinned(const Pinned &) = delete;
+
+        Pinned(Pinned &&) = delete;
+
+        int value;
+    };
+
+    AOP<Counter> aop;
+    int x = 0;
+    int &ref = aop.invoke([&]() -> int& { return x; });
+    assert(&ref == &x);
+    auto get_const = [&]() -> const int& { return x; };
+    auto get_rvalue = [&]() -> int&& { return std::move(x); };
+    static_assert(is_same_v<decltype(aop.invoke(get_const)), const int&>);
+    static_assert(is_same_v<decltype(aop.invoke(get_rvalue)), int&&>);
+
+    unique_ptr<int> owner = aop.invoke([] { return make_unique<int>(1); });
+    assert(*owner == 1);
+    Pinned pinned = aop.invoke([] { return Pinned(2); });
+    assert(pinned.value == 2);
+    assert(aop.get_aspect<0>().count == 3);
+
+    try {
+        aop.invoke([]() -> int& { throw runtime_error("invoke_return_test"); });
+    } catch (runtime_error &) {}
+    try {
+        aop.invoke([]() -> Pinned { throw runtime_error("invoke_return_test"); });
+    } catch (runtime_error &) {}
+    assert(aop.get_aspect<0>().count == 3);
+
+    /// 在栈展开期间（析构函数中）调用时 after() 仍然被调用。
+    struct Unwinding {
+        ~Unwinding() { aop.invoke([] { return Pinned(3); }); };
+
+        AOP<Counter> &aop;
+    };
+    try {
+        Unwinding unwinding { aop };
+        throw runtime_error("invoke_return_test");
+    } catch (runtime_error &) {}
+    assert(aop.get_aspect<0>().count == 4);
+
+    /// 返回值不能移动时 after(const R &) 和 AOP_ResultErrors 看不到返回值，只调用 after()。
+    struct Observer {
+        void after() { ++plain; };
+
+        void after(const Pinned &) { ++observed; };
+
+        void error(const Pinned &) { ++failed; };
+
+        int plain = 0;
+        int observed = 0;
+        int failed = 0;
+    };
+
+    AOP<AOP_ResultErrors<>, Observer, Counter> checked;
+    Pinned checked_pinned = checked.invoke([] { return Pinned(5); });
+    assert(checked_pinned.value == 5);
+    assert(checked.get_aspect<0>().plain == 1 && checked.get_aspect<0>().observed == 0);
+    assert(checked.get_aspect<0>().failed == 0 && checked.get_aspect<1>().count == 1);
+
+    Buffer buffer;
+    AOP_Wrapper<Buffer, Counter> wrapper { buffer };
+    int &(Buffer::*at)(int) = &Buffer::at;
+    assert(&wrapper.invoke(at, 3) == &buffer.data[3]);
+    assert(&AOP_Wrapper_Agent(wrapper, at, 4) == &buffer.data[4]);
+
+    AOP_Object<Buffer, Counter> object { aop };
+    const auto &const_object = object;
+    const int &element = AOP_Object_Agent(const_object, at, 5);
+    assert(&element == &object.data[5]);
+}
+
+/// before(const Args &...) 和 after(const R &) 得到的是实际的参数和返回值，不会产生复制。
+static void advice_args_test() {
+    struct Copyable {
+        explicit Copyable(int value) : value(value) {};
+
+        Copyable(const Copyable &other) : value(other.value), copied(true) {};
+
+        Copyable(Copyable &&) = default;
+
+        int value;
+        bool copied = false;
+    };
+
+    struct Checker {
+        void before(const int &x, const Copyable &c) {
+            x_address = &x;
+            c_address = &c;
+        };
+
+        void before() { ++plain; };
+
+        void after(const Copyable &result) { result_value = result.value; };
+
+        void after(const int &result) { result_address = &result; };
+
+        void after() { ++plain; };
+
+        const int* x_address = nullptr;
+        const Copyable* c_address = nullptr;
+        const int* result_address = nullptr;
+        int result_value = 0;
+        int plain = 0;
+    };
+
+    struct Plain {
+        void before() { ++count; };
+
+        void after() { ++count; };
+
+        int count = 0;
+    };
+
+    AOP<Plain, Checker> aop;
+    int x = 1;
+    Copyable c(2);
+    Copyable r = aop.invoke([](int &x, const Copyable &c) { return Copyable(x + c.value); }, x, c);
+    assert(r.value == 3);
+    assert(!r.copied);
+    assert(aop.get_aspect<1>().x_address == &x);
+    assert(aop.get_aspect<1>().c_address == &c);
+    assert(aop.get_aspect<1>().result_value == 3);
+    assert(aop.get_aspect<1>().plain == 0);
+    assert(aop.get_aspect<0>().count == 2);
+
+    int &ref = aop.invoke([](int &x) -> int& { return x; }, x);
+    assert(aop.get_aspect<1>().result_address == &ref);
+    assert(aop.get_aspect<1>().plain == 1);
+
+    struct Target {
+        int fun(int value) { return base + value; };
+
+        int base = 10;
+    };
+
+    struct ArgRecorder {
+        void before(const int &value) { last = value; };
+
+        int last = 0;
+    };
+
+    Target target;
+    AOP_Wrapper<Target, ArgRecorder> wrapper { target };
+    assert(wrapper.invoke(&Target::fun, 5) == 15);
+    assert(wrapper.get_aspect<0>().last == 5);
+    assert(AOP_Wrapper_Agent(wrapper, fun, 6) == 16);
+    assert(wrapper.get_aspect<0>().last == 6);
+
+    /// before(const Args &...) 的参数类型必须与实参一致（或为其基类），需要构造其他类型的对象的 before 不会被调用。
+    struct Named {
+        void before(const string &name) { last = name; };
+
+        void before() { ++plain; };
+
+        string last;
+        int plain = 0;
+    };
+
+    struct Shape {};
+
+    struct Circle : Shape {};
+
+    struct Typed {
+        void before(const Shape &value) { shape = &value; };
+
+        void before(const long &) { ++wide; };
+
+        void before() { ++plain; };
+
+        const Shape* shape = nullptr;
+        int wide = 0;
+        int plain = 0;
+    };
+
+    static_assert(CallableExitChecker<Named>::has_before_args_callable<string>());
+    static_assert(!CallableExitChecker<Named>::has_before_args_callable<const char*>());
+    static_assert(!CallableExitChecker<Typed>::has_before_args_callable<string>());
+
+    AOP<Named, Typed> exact;
+    exact.invoke([](const char*) {}, "name");
+    assert(exact.get_aspect<0>().last.empty() && exact.get_aspect<0>().plain == 1);
+    exact.invoke([](const string &) {}, string("name"));
+    assert(exact.get_aspect<0>().last == "name" && exact.get_aspect<0>().plain == 1);
+
+    Circle circle;
+    exact.invoke([](const Circle &) {}, circle);
+    exact.invoke([](int) {}, 1);
+    exact.invoke([](const string &) {}, string("name"));
+    assert(exact.get_aspect<1>().shape == &circle);
+    assert(exact.get_aspect<1>().wide == 1 && exact.get_aspect<1>().plain == 3);
+
+    AOP_Object<Target, ArgRecorder> object { AOP<ArgRecorder>() };
+    assert(AOP_Object_Agent(object, fun, 7) == 17);
+    assert(object.get_aspect<0>().last == 7);
+
+    struct ResultChecker {
+        void after(const optional<int> &) { ++after_count; };
+
+        void error(const optional<int> &) { ++error_count; };
+
+        int after_count = 0;
+        int error_count = 0;
+    };
+
+    AOP<AOP_ResultErrors<>, ResultChecker> result_aop;
+    result_aop.invoke([] { return optional<int>(1); });
+    result_aop.invoke([] { return optional<int>(); });
+    assert(result_aop.get_aspect<0>().after_count == 1);
+    assert(result_aop.get_aspect<0>().error_count == 1);
+}
+
+/// around_test 使用的 aspect（局部类中不能声明成员模板）。
+namespace {
+    struct Cache {
+        template <typename Next>
+        int around(Next &next, const int &x) {
+            if (x == key) return value;
+            return next();
+        };
+
+        int key = 0;
+        int value = -1;
+    };
+
+    struct Retry {
+        template <typename Next, typename...Args>
+        decltype(auto) around(Next &next, const Args &...) {
+            for (int i = 1;; ++i) {
+                try {
+                    return next();
+                } catch (runtime_error &) {
+                    if (i == times) throw;
+                }
+            }
+        };
+
+        int times = 3;
+    };
+
+    struct Trace {
+        template <typename Next, typename...Args>
+        decltype(auto) around(Next &next, const Args &...) {
+            order.push_back(id);
+            return next();
+        };
+
+        void before() { order.push_back(id * 10); };
+
+        void after(const int &result) { last = result; };
+
+        void error(const exception_ptr &) { ++errors; };
+
+        vector<int> &order;
+        int id;
+        int last = 0;
+        int errors = 0;
+    };
+
+    struct Skip {
+        template <typename Next>
+        void around(Next &next, const int &x) {
+            if (x > 0) next();
+        };
+    };
+}
+
+/// around(next, args...) 可以不调用被调用函数而直接返回，也可以多次调用 next()。
+static void around_test() {
+    int calls = 0;
+    auto square = [&](int x) { ++calls; return x * x; };
+
+    vector<int> order;
+    AOP<Trace, Cache, Trace> aop { Trace { order, 1 }, Cache { 3, 100 }, Trace { order, 2 } };
+    assert(aop.invoke(square, 2) == 4);
+    assert(calls == 1);
+    assert(order == vector<int>({ 10, 20, 1, 2 }));
+    assert(aop.invoke(square, 3) == 100);
+    assert(calls == 1);
+    assert(order == vector<int>({ 10, 20, 1, 2, 10, 20, 1 }));
+    assert(aop.get_aspect<0>().last == 100);
+    assert(aop.get_aspect<2>().last == 100);
+
+    int failures = 0;
+    auto flaky = [&](int x) {
+        if (++failures < 3) throw runtime_error("around_test");
+        return x;
+    };
+    AOP<Trace, Retry> retry { Trace { order, 3 }, Retry() };
+    assert(retry.invoke(flaky, 7) == 7);
+    assert(failures == 3);
+    assert(retry.get_aspect<0>().errors == 0);
+    failures = -10;
+    try {
+        retry.invoke(flaky, 7);
+        assert(false);
+    } catch (runtime_error &) {}
+    assert(retry.get_aspect<0>().errors == 1);
+
+    struct Target {
+        void add(int x) { sum += x; };
+
+        int sum = 0;
+    };
+
+    Target target;
+    AOP_Wrapper<Target, Skip> wrapper { target };
+    wrapper.invoke(&Target::add, 5);
+    wrapper.invoke(&Target::add, -5);
+    AOP_Wrapper_Agent(wrapper, add, 2);
+    assert(target.sum == 7);
+
+    struct Named {
+        const string &name() const { return value; };
+
+        string value = "named";
+    };
+
+    Named named;
+    AOP<Trace> traced { Trace { order, 4 } };
+    assert(&traced.invoke([&]() -> const string & { return named.name(); }) == &named.value);
+    static_assert(AOP_Hooks::around_result_valid<const string &, const string &>());
+    static_assert(AOP_Hooks::around_result_valid<const string &, string &>());
+    static_assert(!AOP_Hooks::around_result_valid<const string &, string>());
+    static_assert(!AOP_Hooks::around_result_valid<const string &, const char *const &>());
+    static_assert(AOP_Hooks::around_result_valid<string, const string &>());
+}
+
+/// 由测试控制的时钟，用于检查 Memoize 的有效期。
+namespace {
+    struct ManualClock {
+        using duration = std::chrono::nanoseconds;
+        using rep = duration::rep;
+        using period = duration::period;
+        using time_point = std::chrono::time_point<ManualClock>;
+        static constexpr bool is_steady = true;
+
+        static time_point now() { return current; };
+
+        static inline time_point current;
+    };
+}
+
+/// Memoize 命中时不调用被调用函数，按 LRU 淘汰并在超过有效期后重新计算。
+static void memoize_test() {
+    struct Service {
+        int square(int x) {
+            ++calls;
+            return x * x;
+        };
+
+        string join(const string &a, int b) {
+            ++calls;
+            return a + to_string(b);
+        };
+
+        int calls = 0;
+    };
+
+    Service service;
+    AOP_Wrapper<Service, Memoize<int(int)>> wrapper { service, MemoizeConfig { 2, {}, 1 } };
+    assert(wrapper.invoke(&Service::square, 3) == 9);
+    assert(wrapper.invoke(&Service::square, 3) == 9);
+    assert(service.calls == 1);
+    wrapper.invoke(&Service::square, 4);
+    wrapper.invoke(&Service::square, 3);
+    wrapper.invoke(&Service::square, 5);
+    assert(wrapper.invoke(&Service::square, 3) == 9);
+    assert(service.calls == 3);
+    wrapper.invoke(&Service::square, 4);
+    assert(service.calls == 4);
+    MemoizeStats stats = wrapper.get_aspect<0>().stats();
+    assert(stats.hits == 3 && stats.misses == 4 && stats.evictions == 2 && stats.size == 2);
+
+    AOP_Wrapper<Service, Memoize<string(const string &, int), MemoizeHash, ManualClock>> join {
+        service, MemoizeConfig { 16, std::chrono::seconds(1) } };
+    service.calls = 0;
+    assert(AOP_Wrapper_Agent(join, join, string("a"), 1) == "a1");
+    assert(join.invoke(&Service::join, "a", 1) == "a1");
+    assert(join.invoke(&Service::join, "a", 2) == "a2");
+    assert(service.calls == 2);
+    ManualClock::current += std::chrono::seconds(2);
+    assert(join.invoke(&Service::join, "a", 1) == "a1");
+    assert(service.calls == 3);
+    stats = join.get_aspect<0>().stats();
+    assert(stats.hits == 1 && stats.misses == 3 && stats.expirations == 1);
+
+    Memoize<int(int)> source { MemoizeConfig { 4, {}, 2 } };
+    auto square = [&]() { return service.square(3); };
+    service.calls = 0;
+    source.around(square, 3);
+    Memoize<int(int)> moved { std::move(source) };
+    assert(moved.around(square, 3) == 9 && service.calls == 1);
+    assert(source.around(square, 3) == 9 && service.calls == 2);
+    assert(source.stats().size == 0);
+    source = std::move(moved);
+    assert(source.around(square, 3) == 9 && service.calls == 2);
+    assert(moved.stats().size == 0);
+}
+
+#ifdef AOP_HAS_PERSISTENT_MEMOIZE
+/// PersistentMemoize 重新打开同一个文件后可以直接命中，版本号不同时缓存被丢弃。
+static void persistent_memoize_test() {
+    struct Point {
+        int x, y;
+    };
+
+    struct Service {
+        Point scale(Point p, int k) {
+            ++calls;
+            return { p.x * k, p.y * k };
+        };
+
+        int calls = 0;
+    };
+
+    const string path = "AOP_test_persistent_memoize.cache";
+    std::remove(path.c_str());
+    Service service;
+    using Cached = AOP_Wrapper<Service, PersistentMemoize<Point(Point, int)>>;
+    {
+        Cached cold { service, PersistentMemoizeConfig { path, 64, 1 } };
+        assert(cold.get_aspect<0>().is_open() && !cold.get_aspect<0>().is_warm());
+        assert(cold.invoke(&Service::scale, Point { 1, 2 }, 3).y == 6);
+        assert(cold.invoke(&Service::scale, Point { 1, 2 }, 3).x == 3);
+        assert(service.calls == 1);
+    }
+    {
+        Cached warm { service, PersistentMemoizeConfig { path, 64, 1 } };
+        assert(warm.get_aspect<0>().is_warm());
+        assert(AOP_Wrapper_Agent(warm, scale, Point { 1, 2 }, 3).y == 6);
+        assert(service.calls == 1);
+        MemoizeStats stats = warm.get_aspect<0>().stats();
+        assert(stats.hits == 1 && stats.misses == 0 && stats.size == 1);
+    }
+    {
+        Cached other { service, PersistentMemoizeConfig { path, 64, 2 } };
+        assert(!other.get_aspect<0>().is_warm());
+        assert(other.invoke(&Service::scale, Point { 1, 2 }, 3).y == 6);
+        assert(service.calls == 2);
+
+        /// 文件正被使用时，相同配置以共享锁打开，不同配置不使用该文件。
+        Cached shared { service, PersistentMemoizeConfig { path, 64, 2 } };
+        assert(shared.get_aspect<0>().is_open() && shared.get_aspect<0>().is_warm());
+        assert(shared.invoke(&Service::scale, Point { 1, 2 }, 3).y == 6);
+        assert(service.calls == 2);
+        Cached conflict { service, PersistentMemoizeConfig { path, 64, 3 } };
+        assert(!conflict.get_aspect<0>().is_open());
+        assert(conflict.invoke(&Service::scale, Point { 1, 2 }, 3).y == 6);
+        assert(service.calls == 3);
+    }
+    std::remove(path.c_str());
+    /// 打开时使用的初始化锁文件被保留。
+    assert(std::remove((path + ".lock").c_str()) == 0);
+}
+#endif
+
+/// LatencyHistogram 的桶的相对误差不超过 2^-SubBits，快照中的分位数有序。
+static void latency_histogram_test() {
+    using Histogram = LatencyHistogram<>;
+    for (std::uint64_t ticks : { 0ULL, 31ULL, 32ULL, 63ULL, 64ULL, 1000ULL, 123456789ULL, 1ULL << 39 }) {
+        std::uint64_t value = Histogram::bucket_value(Histogram::bucket_of(ticks));
+        std::uint64_t error = value > ticks ? value - ticks : ticks - value;
+        assert(error <= ticks / Histogram::sub_count);
+    }
+    static_assert(Histogram::bucket_of(1ULL << 50) == Histogram::bucket_count - 1);
+
+    AOP<LatencyHistogram<>> aop;
+    int sum = 0;
+    for (int i = 0; i < 1000; ++i)
+        sum += aop.invoke([](int x) { return x % 7; }, i);
+    int &ref = aop.invoke([&]() -> int& { return sum; });
+    assert(&ref == &sum);
+    try {
+        aop.invoke([] { throw runtime_error("latency_histogram_test"); });
+    } catch (runtime_error &) {}
+
+    LatencySnapshot snapshot = aop.get_aspect<0>().snapshot();
+    assert(snapshot.count == 1002);
+    assert(snapshot.p50 <= snapshot.p99 && snapshot.p99 <= snapshot.p999 && snapshot.p999 <= snapshot.max);
+    aop.get_aspect<0>().reset();
+    assert(aop.get_aspect<0>().snapshot().count == 0);
+}
+
+/// 使用 AOP_CALL_SITE_MARK 登记到 CallSiteRegistry 的函数。
+namespace {
+    int call_site_square(int x) {
+        AOP_CALL_SITE_MARK
+        return x * x;
+    }
+
+    void call_site_throw() {
+        AOP_CALL_SITE_MARK
+        throw runtime_error("call_site_test");
+    }
+
+    const CallSiteStats* find_call_site(const std::vector<CallSiteStats> &table, const char* name) {
+        for (const CallSiteStats &stats : table) {
+            if (std::string(stats.location.function()).find(name) != std::string::npos)
+                return &stats;
+        }
+        return nullptr;
+    }
+}
+
+/// 每个被标记的函数只登记一次，调用次数和异常退出的次数都被记录。
+static void call_site_test() {
+    AOP<LatencyHistogram<>> aop;
+    for (int i = 0; i < 10; ++i)
+        aop.invoke(call_site_square, i);
+    for (int i = 0; i < 3; ++i) {
+        try {
+            aop.invoke(call_site_throw);
+        } catch (runtime_error &) {}
+    }
+
+    std::size_t sites = 0;
+    CallSiteRegistry::for_each([&](const CallSite &) { ++sites; });
+    assert(sites >= 2);
+    std::vector<CallSiteStats> table = CallSiteRegistry::snapshot();
+    const CallSiteStats* square = find_call_site(table, "call_site_square");
+    const CallSiteStats* thrower = find_call_site(table, "call_site_throw");
+    assert(square && square->calls == 10 && square->errors == 0);
+    assert(thrower && thrower->calls == 3 && thrower->errors == 3);
+    assert(aop.get_aspect<0>().snapshot().count == 13);
+
+    CallSiteRegistry::reset();
+    assert(!find_call_site(CallSiteRegistry::snapshot(), "call_site_square"));
+    aop.invoke(call_site_square, 1);
+    CallSiteRegistry::for_each([&](const CallSite &) { --sites; });
+    assert(sites == 0);
+
+    /// 每个线程写入自己的计数块，读取时合并。
+    CallSiteRegistry::reset();
+    vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([] {
+            for (int i = 0; i < 1000; ++i) call_site_square(i);
+        });
+    }
+    for (std::thread &thread : threads) thread.join();
+    call_site_square(1);
+    table = CallSiteRegistry::snapshot();
+    square = find_call_site(table, "call_site_square");
+    assert(square && square->calls == 4001 && square->errors == 0);
+}
+
+/// context_test 使用的 aspect（局部类中不能声明成员模板）。
+namespace {
+    struct ContextRecorder {
+        void before(const InvocationContext &context, const int &value) {
+            before_location = context.location;
+            depth = context.depth;
+            arg = value;
+            started = context.start();
+        };
+
+        template <typename R>
+        void after(const InvocationContext &context, const R &) {
+            after_location = context.location;
+            assert(context.start() == started);
+            elapsed = std::chrono::steady_clock::now() - context.start();
+            ++after_count;
+        };
+
+        SourceLocation before_location;
+        SourceLocation after_location;
+        unsigned depth = -1;
+        int arg = 0;
+        int after_count = 0;
+        std::chrono::steady_clock::time_point started;
+        std::chrono::steady_clock::duration elapsed {};
+    };
+
+    /// 泛型的 before() 不会被当作需要上下文。
+    struct GenericBefore {
+        template <typename...Args>
+        void before(const Args &...) { ++count; };
+
+        int count = 0;
+    };
+
+    static_assert(!CallableExitChecker<GenericBefore>::has_before_context_callable<>());
+    static_assert(!CallableExitChecker<GenericBefore>::has_before_context_callable<int>());
+    static_assert(CallableExitChecker<ContextRecorder>::has_before_context_callable<int>());
+    static_assert(CallableExitChecker<ContextRecorder>::has_after_context_result_callable<int>());
+    static_assert(!CallableExitChecker<ContextRecorder>::has_after_context_callable());
+}
+
+/// InvocationContext 只在存在需要它的切入函数时构造，带有调用位置和嵌套深度。
+static void context_test() {
+    struct Target {
+        int twice(int x) {
+            AOP_FUN_MARK
+            return x * 2;
+        };
+    };
+
+    Target target;
+    AOP_Wrapper<Target, GenericBefore, ContextRecorder> wrapper { target };
+    const unsigned line = __LINE__ + 1;
+    assert(AOP_Wrapper_Agent(wrapper, twice, 4) == 8);
+    const ContextRecorder &recorder = wrapper.get_aspect<1>();
+    assert(string(recorder.before_location.function()) == "twice");
+    assert(recorder.before_location.line() == line);
+    assert(recorder.after_location == recorder.before_location);
+    assert(recorder.depth == 0 && recorder.arg == 4 && recorder.after_count == 1);
+    assert(recorder.elapsed >= std::chrono::steady_clock::duration::zero());
+    assert(wrapper.get_aspect<0>().count == 1);
+
+    assert(wrapper.invoke(&Target::twice, 5) == 10);
+    assert(recorder.before_location.is_unknown());
+#ifdef AOP_WILL_USE_SOURCE_LOCATION
+    assert(string(recorder.after_location.function()).find("twice") != string::npos);
+#endif
+
+    AOP<ContextRecorder> outer, inner;
+    outer.invoke_at(CURRENT_FUN_LOCATION, [&](int x) { return inner.invoke([](int y) { return y; }, x); }, 1);
+    assert(outer.get_aspect<0>().depth == 0);
+    assert(inner.get_aspect<0>().depth == 1);
+    assert(string(outer.get_aspect<0>().before_location.function()).find("context_test") != string::npos);
+    assert(AOPcontextDepth == 0);
+
+    AOP<GenericBefore> plain;
+    plain.invoke_at(CURRENT_FUN_LOCATION, [] {});
+    assert(plain.get_aspect<0>().count == 1);
+}
+
+/// switchable_test 使用的全局开关。
+namespace {
+    struct IncidentKey {};
+}
+
+/// Switchable 关闭时不调用内部 aspect 的任何切入函数，开关可以属于对象，也可以由 AspectSwitch 统一控制。
+static void switchable_test() {
+    struct Counter {
+        void before() { ++before_count; };
+
+        void after(const int &result) { last = result; };
+
+        void error(const runtime_error &) { ++typed_errors; };
+
+        int before_count = 0;
+        int last = 0;
+        int typed_errors = 0;
+    };
+
+    struct Target {
+        int fun(int x) { return x + 1; };
+
+        int fail(int) { throw runtime_error("switchable_test"); };
+    };
+
+    using Object = AOP_Object<Target, Switchable<Counter>, Switchable<Cache, IncidentKey>>;
+    Object object { AOP<Switchable<Counter>, Switchable<Cache, IncidentKey>>(
+        Switchable<Counter>(), Switchable<Cache, IncidentKey>(Cache { 1, 100 })) };
+    const Counter &counter = object.get_aspect<0>().aspect();
+
+    assert(AOP_Object_Agent(object, fun, 1) == 2);
+    assert(counter.before_count == 0 && counter.last == 0);
+
+    object.get_aspect<0>().enable();
+    assert(AOP_Object_Agent(object, fun, 1) == 2);
+    assert(counter.before_count == 1 && counter.last == 2);
+    try {
+        AOP_Object_Agent(object, fail, 1);
+    } catch (runtime_error &) {}
+    assert(counter.typed_errors == 1);
+
+    AspectSwitch<IncidentKey>::enable();
+    assert(object.get_aspect<1>().enabled());
+    assert(AOP_Object_Agent(object, fun, 1) == 100);
+    AspectSwitch<IncidentKey>::disable();
+    assert(AOP_Object_Agent(object, fun, 1) == 2);
+
+    object.get_aspect<0>().disable();
+    try {
+        AOP_Object_Agent(object, fail, 1);
+    } catch (runtime_error &) {}
+    assert(counter.before_count == 4 && counter.typed_errors == 1);
+
+    /// 开关在每次调用开始时读取一次，调用期间切换不会只调用 before() 和 after() 中的一个。
+    AOP<Switchable<Counter>> latched;
+    const Counter &latched_counter = latched.get_aspect<0>().aspect();
+    latched.get_aspect<0>().enable();
+    assert(latched.invoke([&](int x) {
+        latched.get_aspect<0>().disable();
+        return x;
+    }, 7) == 7);
+    assert(latched_counter.before_count == 1 && latched_counter.last == 7);
+    assert(latched.invoke([&](int x) {
+        latched.get_aspect<0>().enable();
+        return x;
+    }, 8) == 8);
+    assert(latched_counter.before_count == 1 && latched_counter.last == 7);
+    try {
+        latched.invoke([&](int) -> int {
+            latched.get_aspect<0>().disable();
+            throw runtime_error("switchable_test");
+        }, 9);
+    } catch (runtime_error &) {}
+    assert(latched_counter.before_count == 2 && latched_counter.typed_errors == 1);
+}
+
+/// sampled_test 中嵌套调用使用单独的计数器。
+namespace {
+    struct NestedTag {};
+}
+
+/// Sampled 只在被采样的调用中运行内部 aspect，同一次调用的 before() 和 after() 总是成对出现。
+static void sampled_test() {
+    struct Counter {
+        void before() { ++before_count; };
+
+        void after() { ++after_count; };
+
+        void error(const runtime_error &) { ++errors; };
+
+        int before_count = 0;
+        int after_count = 0;
+        int errors = 0;
+    };
+
+    AOP<Sampled<Counter, SampleEvery<4>>> every;
+    const Counter &counter = every.get_aspect<0>().aspect();
+    for (int i = 0; i < 100; ++i)
+        assert(every.invoke([](int x) { return x * 2; }, i) == i * 2);
+    assert(counter.before_count == 25 && counter.after_count == 25);
+
+    int failures = 0;
+    for (int i = 0; i < 8; ++i) {
+        try {
+            every.invoke([] { throw runtime_error("sampled_test"); });
+        } catch (runtime_error &) {
+            ++failures;
+        }
+    }
+    assert(failures == 8 && counter.errors == 2);
+    assert(counter.before_count == 27 && counter.after_count == 25);
+
+    AOP<Sampled<Counter, SampleEvery<2, NestedTag>>> nested;
+    const Counter &pairs = nested.get_aspect<0>().aspect();
+    auto plus = [](int x) { return x + 1; };
+    for (int i = 0; i < 3; ++i) {
+        int result = nested.invoke([&] { return nested.invoke([&] { return nested.invoke(plus, 1); }); });
+        assert(result == 2);
+        assert(pairs.before_count == pairs.after_count);
+    }
+    assert(pairs.before_count == 5);
+
+    AOP<Sampled<Counter, SampleRandom<8>>> random;
+    for (int i = 0; i < 8000; ++i)
+        assert(random.invoke(plus, i) == i + 1);
+    const Counter &sampled = random.get_aspect<0>().aspect();
+    assert(sampled.before_count == sampled.after_count);
+    assert(sampled.before_count > 700 && sampled.before_count < 1300);
+}
+
+#ifdef AOP_HAS_COROUTINES
+/// async_invoke_test 使用的协程，Signal 由测试手动（或在另一个线程中）触发，模拟异步操作的完成。
+namespace {
+    struct Signal {
+        bool await_ready() const noexcept { return ready; };
+
+        void await_suspend(std::coroutine_handle<> handle) noexcept { waiter = handle; };
+
+        void await_resume() const noexcept {};
+
+        void set() {
+            ready = true;
+            if (waiter) std::exchange(waiter, nullptr).resume();
+        };
+
+        bool ready = false;
+        std::coroutine_handle<> waiter;
+    };
+
+    AOP_Task<int> async_double(Signal &signal, int x) {
+        co_await signal;
+        if (x < 0) throw runtime_error("async_double");
+        co_return x * 2;
+    }
+
+    /// 立即运行、结束后自行销毁的协程，用于在普通函数中等待 AOP_Task。
+    struct Detached {
+        struct promise_type {
+            Detached get_return_object() noexcept { return {}; };
+
+            std::suspend_never initial_suspend() noexcept { return {}; };
+
+            std::suspend_never final_suspend() noexcept { return {}; };
+
+            void return_void() noexcept {};
+
+            void unhandled_exception() noexcept { std::terminate(); };
+        };
+    };
+
+    Detached await_into(AOP_Task<int> task, int &result, bool &failed) {
+        try {
+            result = co_await std::move(task);
+        } catch (runtime_error &) {
+            failed = true;
+        }
+    }
+}
+#endif
+
+/// invoke_async 在异步结果完成时（而不是返回时）调用 after() 和 error()。
+static void async_invoke_test() {
+    struct Recorder {
+        void before(const InvocationContext &context) {
+            started = context.start();
+            ++before_count;
+        };
+
+        void after(const InvocationContext &context, const int &result) {
+            assert(context.start() == started);
+            location = context.location;
+#ifdef AOP_WILL_USE_SOURCE_LOCATION
+            thread_location = AOPthreadLoc;
+#endif
+            last = result;
+            ++after_count;
+        };
+
+        void error(const runtime_error &) { ++errors; };
+
+        SourceLocation location;
+        SourceLocation thread_location;
+        std::chrono::steady_clock::time_point started;
+        int before_count = 0;
+        int after_count = 0;
+        int errors = 0;
+        int last = 0;
+    };
+
+    AOP<Recorder> aop;
+    const Recorder &recorder = aop.get_aspect<0>();
+    std::promise<int> promise;
+    std::future<int> future = aop.invoke_async([&] { return promise.get_future(); });
+    assert(recorder.before_count == 1 && recorder.after_count == 0);
+    assert(future.wait_for(std::chrono::seconds(0)) == std::future_status::timeout);
+    promise.set_value(5);
+    /// 返回的 future 在 after() 运行之后就绪，不需要先调用 get()。
+    assert(future.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+    assert(recorder.after_count == 1 && recorder.last == 5);
+    assert(future.get() == 5);
+
+    std::future<int> failing = aop.invoke_async([] {
+        return std::async(std::launch::deferred, []() -> int { throw runtime_error("async_invoke_test"); });
+    });
+    try {
+        failing.get();
+        assert(false);
+    } catch (runtime_error &) {}
+    assert(recorder.errors == 1 && recorder.after_count == 1);
+
+    assert(aop.invoke_async([] { return 7; }) == 7);
+    assert(recorder.after_count == 2 && recorder.last == 7);
+
+#ifdef AOP_HAS_COROUTINES
+    const SourceLocation location(__FILE__, "async_double", __LINE__);
+    Signal signal;
+    int result = 0;
+    bool failed = false;
+    AOP_Task<int> task = aop.invoke_async_at(location, async_double, std::ref(signal), 21);
+    assert(recorder.before_count == 4 && recorder.after_count == 2);
+    await_into(std::move(task), result, failed);
+    assert(result == 0 && recorder.after_count == 2);
+    std::thread([&signal] { signal.set(); }).join();
+    assert(result == 42 && !failed);
+    assert(recorder.after_count == 3 && recorder.last == 42);
+    assert(recorder.location == location);
+#ifdef AOP_WILL_USE_SOURCE_LOCATION
+    assert(recorder.thread_location == location);
+#endif
+
+    Signal error_signal;
+    await_into(aop.invoke_async(async_double, std::ref(error_signal), -1), result, failed);
+    error_signal.set();
+    assert(failed && recorder.errors == 2 && recorder.after_count == 3);
+#endif
+}
+
+/// invoke_batch 中批量的 aspect 每批只运行一次，其他 aspect 对每个元素运行。
+static void batch_test() {
+    struct BatchCounter {
+        void before_batch(std::size_t count) {
+            ++batches;
+            elements += count;
+        };
+
+        void after_batch(std::size_t count) { finished += count; };
+
+        void before() { ++per_element; };
+
+        void error(const runtime_error &) { ++errors; };
+
+        int batches = 0;
+        std::size_t elements = 0;
+        std::size_t finished = 0;
+        int per_element = 0;
+        int errors = 0;
+    };
+
+    struct ElementCounter {
+        void before(const int &, const int &) { ++calls; };
+
+        void after(const int &result) { sum += result; };
+
+        int calls = 0;
+        int sum = 0;
+    };
+
+    struct Target {
+        int times(int x) const { return x * scale; };
+
+        int scale = 3;
+    };
+
+    vector<int> input { 1, 2, 3, 4 };
+    vector<int> output;
+    AOP<BatchCounter> batch;
+    batch.invoke_batch([](int x) { return x * 2; }, input, std::back_inserter(output));
+    assert((output == vector<int> { 2, 4, 6, 8 }));
+    const BatchCounter &counter = batch.get_aspect<0>();
+    assert(counter.batches == 1 && counter.elements == 4 && counter.finished == 4 && counter.per_element == 0);
+
+    AOP<BatchCounter, ElementCounter> mixed;
+    vector<std::tuple<int, int>> pairs { { 1, 2 }, { 3, 4 }, { 5, 6 } };
+    mixed.invoke_batch([](int x, int y) { return x + y; }, pairs);
+    assert(mixed.get_aspect<0>().elements == 3 && mixed.get_aspect<0>().per_element == 0);
+    assert(mixed.get_aspect<1>().calls == 3 && mixed.get_aspect<1>().sum == 21);
+
+    try {
+        mixed.invoke_batch([](int x, int) {
+            if (x > 2) throw runtime_error("batch_test");
+            return x;
+        }, pairs);
+        assert(false);
+    } catch (runtime_error &) {}
+    assert(mixed.get_aspect<0>().errors == 1 && mixed.get_aspect<0>().finished == 3);
+    assert(mixed.get_aspect<1>().calls == 5 && mixed.get_aspect<1>().sum == 22);
+
+    Target target;
+    AOP_Wrapper<Target, BatchCounter> wrapper { target };
+    vector<int> scaled;
+    wrapper.invoke_batch(&Target::times, input, std::back_inserter(scaled));
+    assert((scaled == vector<int> { 3, 6, 9, 12 }));
+    assert(wrapper.get_aspect<0>().elements == 4);
+}
+
+static void parallel_test() {
+    struct Counter {
+        void before(const int &) { ++calls; };
+
+        void merge(const Counter &other) { calls += other.calls; };
+
+        int calls = 0;
+    };
+
+    struct Scale {
+        void before(const int &) { assert(factor == 3); };
+
+        int factor = 1;
+    };
+
+    struct BatchCounter {
+        void before_batch(std::size_t count) { elements += count; };
+
+        void merge(const BatchCounter &other) { elements += other.elements; };
+
+        std::size_t elements = 0;
+    };
+
+    WorkStealingPool pool(3);
+    vector<int> input(1000);
+    std::iota(input.begin(), input.end(), 0);
+    vector<int> output(input.size());
+
+    AOP<Counter, Scale, BatchCounter> aop;
+    aop.get_aspect<0>().calls = 5;
+    aop.get_aspect<1>().factor = 3;
+    auto end = aop.invoke_parallel_on(pool, [](int x) { return x * 2; }, input, output.begin());
+    assert(end == output.end());
+    for (std::size_t i = 0; i < input.size(); ++i)
+        assert(output[i] == input[i] * 2);
+    assert(aop.get_aspect<0>().calls == 1005 && aop.get_aspect<2>().elements == 1000);
+
+    try {
+        aop.invoke_parallel_on(pool, [](int x) {
+            if (x == 500) throw runtime_error("parallel_test");
+        }, input);
+        assert(false);
+    } catch (runtime_error &) {}
+    assert(aop.get_aspect<0>().calls > 1005 && aop.get_aspect<0>().calls <= 2005);
+
+    /// 在 worker 中嵌套调用时直接在当前线程中运行。
+    AOP<Counter> outer;
+    outer.invoke_parallel_on(pool, [&pool](int) {
+        AOP<Counter> local;
+        vector<int> nested { 1, 2, 3 };
+        local.invoke_parallel_on(pool, [](int) {}, nested);
+        assert(local.get_aspect<0>().calls == 3);
+    }, vector<int> { 1, 2, 3, 4 });
+    assert(outer.get_aspect<0>().calls == 4);
+
+    AOP<LatencyHistogram<>> latency;
+    latency.invoke_parallel([](int x) { return x + 1; }, input);
+    assert(latency.get_aspect<0>().snapshot().count == input.size());
+}
+
+static void concurrency_test() {
+    struct Both {
+        void before() { ++mutable_calls; };
+
+        void before() const { ++const_calls; };
+
+        int mutable_calls = 0;
+        mutable int const_calls = 0;
+    };
+
+    struct MutableOnly {
+        void after(const int &) {};
+    };
+
+    static_assert(AOP_Hooks::const_callable<Both, void>());
+    static_assert(!AOP_Hooks::const_callable<MutableOnly, int>());
+    static_assert(AOP_Hooks::const_callable<MutableOnly, void>());
+
+    AOP<AOP_ConstOnly, Both> const_only;
+    const_only.invoke([] {});
+    const_only.invoke_batch([](int) {}, vector<int> { 1, 2 });
+    assert(const_only.get_aspect<0>().mutable_calls == 0 && const_only.get_aspect<0>().const_calls == 3);
+
+    struct Counter {
+        void before(const int &value) {
+            ++calls;
+            sum += value;
+        };
+
+        void merge(const Counter &other) {
+            calls += other.calls;
+            sum += other.sum;
+        };
+
+        int calls = 0;
+        long sum = 0;
+    };
+
+    struct Target {
+        int twice(int x) const { return x * 2; };
+    };
+
+    Target target;
+    AOP_Wrapper<Target, AOP_ConstOnly, AOP_AlignedSlots, PerThread<Counter>> shared { target };
+    vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&shared] {
+            for (int i = 1; i <= 100; ++i)
+                assert(shared.invoke(&Target::twice, i) == i * 2);
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    const PerThread<Counter> &counters = shared.get_aspect<0>();
+    assert(counters.size() == 4);
+    counters.for_each([](const Counter &counter) { assert(counter.calls == 100 && counter.sum == 5050); });
+    Counter total = counters.merged();
+    assert(total.calls == 400 && total.sum == 4 * 5050);
+
+    WorkStealingPool pool(2);
+    AOP<PerThread<Counter>> parallel;
+    parallel.invoke_parallel_on(pool, [](int) {}, vector<int> { 1, 2, 3, 4, 5 });
+    assert(parallel.get_aspect<0>().merged().calls == 5);
+}
+
+/// dynamic_test 使用的 aspect（局部类中只被模板使用的 error_types 会产生 -Wunused-local-typedefs 警告）。
+namespace {
+    struct Code {
+        using error_types = std::tuple<int>;
+
+        void error(const int &code) { last = code; };
+
+        int last = 0;
+    };
+}
+
+/// AOP_Dynamic 中的 aspect 可以在运行时加入和移除，与静态 aspect 组合时按链中的位置调用。
+static void dynamic_test() {
+    struct Trace {
+        void before(const int &x) { log->push_back(name + ".before(" + to_string(x) + ")"); };
+
+        void after(const int &result) { log->push_back(name + ".after(" + to_string(result) + ")"); };
+
+        void error(const exception_ptr &) { log->push_back(name + ".error"); };
+
+        string name;
+        vector<string>* log;
+    };
+
+    struct Counter {
+        void before() { ++calls; };
+
+        void error(const runtime_error &) { ++typed_errors; };
+
+        int calls = 0;
+        int typed_errors = 0;
+        char payload[64] {};
+    };
+
+    vector<string> log;
+    using Dynamic = AOP_Dynamic<int(int)>;
+    AOP<Trace, Dynamic, Trace> aop { Trace { "outer", &log }, Dynamic(), Trace { "inner", &log } };
+    Dynamic &chain = aop.get_aspect<1>();
+    auto fun = [](int x) {
+        if (x < 0) throw runtime_error("dynamic_test");
+        return x + 1;
+    };
+
+    assert(aop.invoke(fun, 1) == 2);
+    assert(log.size() == 4);
+    log.clear();
+
+    Dynamic::Handle a = chain.attach(Trace { "a", &log });
+    Dynamic::Handle b = chain.attach(Trace { "b", &log });
+    Dynamic::Handle counter = chain.attach(Counter());
+    assert(chain.size() == 3 && a != b);
+    assert(chain.target<Counter>(counter) && !chain.target<Counter>(a));
+    assert(aop.invoke(fun, 1) == 2);
+    assert((log == vector<string> { "outer.before(1)", "a.before(1)", "b.before(1)", "inner.before(1)",
+                                    "inner.after(2)", "b.after(2)", "a.after(2)", "outer.after(2)" }));
+    assert(chain.target<Counter>(counter)->calls == 1);
+
+    log.clear();
+    try {
+        aop.invoke(fun, -1);
+    } catch (runtime_error &) {}
+    assert((log == vector<string> { "outer.before(-1)", "a.before(-1)", "b.before(-1)", "inner.before(-1)",
+                                    "inner.error", "b.error", "a.error", "outer.error" }));
+    assert(chain.target<Counter>(counter)->typed_errors == 1);
+
+    AOP<Trace, Dynamic, Trace> copy = aop;
+    assert(chain.detach(a) && !chain.detach(a));
+    log.clear();
+    aop.invoke(fun, 1);
+    assert(log.size() == 6 && log[1] == "b.before(1)");
+    assert(chain.target<Counter>(counter)->calls == 3);
+    log.clear();
+    copy.invoke(fun, 1);
+    assert(log.size() == 8 && log[1] == "a.before(1)");
+    assert(copy.get_aspect<1>().target<Counter>(counter)->calls == 3);
+
+    chain.clear();
+    log.clear();
+    aop.invoke(fun, 1);
+    assert(log.size() == 4 && chain.empty() && chain.idle());
+    static_assert(AOP_Hooks::has_idle<Dynamic>());
+
+    /// 不是 std::exception 的异常由声明了 error_types 的 aspect 匹配，error_types 相同的 aspect 共享同一次重新抛出。
+    Dynamic::Handle code = chain.attach(Code());
+    Dynamic::Handle same_code = chain.attach(Code());
+    assert(!chain.idle());
+    try {
+        aop.invoke([](int x) -> int { throw x; }, 42);
+    } catch (int) {}
+    assert(chain.target<Code>(code)->last == 42 && chain.target<Code>(same_code)->last == 42);
+    try {
+        aop.invoke(fun, -1);
+    } catch (runtime_error &) {}
+    assert(chain.target<Code>(code)->last == 42 && chain.target<Code>(same_code)->last == 42);
+    chain.clear();
+
+    /// 所有 aspect 都空闲时直接调用被调用函数。
+    AOP<Dynamic> only;
+    assert(only.invoke(fun, 2) == 3);
+    only.get_aspect<0>().attach(Trace { "only", &log });
+    log.clear();
+    assert(only.invoke(fun, 2) == 3);
+    assert((log == vector<string> { "only.before(2)", "only.after(3)" }));
+
+    AOP<AOP_Dynamic<void()>> void_aop;
+    Dynamic::Handle void_counter = void_aop.get_aspect<0>().attach(Counter());
+    struct Tick {
+        void after() { ++*count; };
+
+        int* count;
+    };
+
+    int ticks = 0;
+    void_aop.get_aspect<0>().attach(Tick { &ticks });
+    void_aop.invoke([] {});
+    assert(void_aop.get_aspect<0>().target<Counter>(void_counter)->calls == 1 && ticks == 1);
+}
+
+/// pointcut_test 中的被调用者、标签和 aspect。
+namespace {
+    struct HotPath {};
+
+    template <typename T>
+    struct IsFunctionPointer : std::is_function<std::remove_pointer_t<T>> {};
+
+    struct PointcutService {
+        int get(int x) const { return x; };
+
+        int fail(int) const { throw runtime_error("pointcut_test"); };
+    };
+
+    struct Audit {
+        using pointcut = AOP_Within<PointcutService>;
+
+        void before() { ++calls; };
+
+        int calls = 0;
+    };
+
+    struct Hot {
+        using pointcut = AOP_AnyOf<AOP_Tagged<HotPath>, AOP_Match<IsFunctionPointer>>;
+
+        template <typename Next>
+        int around(Next &next, const int &) { ++calls; return next() * 10; };
+
+        void error(const runtime_error &) { ++errors; };
+
+        int calls = 0;
+        int errors = 0;
+    };
+}
+
+static void pointcut_test() {
+    struct Trace {
+        void before() { ++calls; };
+
+        void after(const int &result) { last = result; };
+
+        int calls = 0;
+        int last = 0;
+    };
+
+    using Getter = int (PointcutService::*)(int) const;
+    static_assert(AOP_applies<Audit, Getter>() && !AOP_applies<Audit, int (*)(int)>());
+    static_assert(AOP_applies<Switchable<Audit>, AOP_Bound<Getter, PointcutService*>>());
+    static_assert(AOP_applies<Hot, AOP_TaggedCall<HotPath, Getter>>() && !AOP_applies<Hot, Getter>());
+    static_assert(!AOP_Not<AOP_Tagged<HotPath>>::matches<AOP_Callee<AOP_TaggedCall<HotPath, int (&)(int)>>>);
+
+    PointcutService service;
+    AOP_Wrapper<PointcutService, Audit, Trace, Hot> wrapper { service };
+    const Audit &audit = wrapper.get_aspect<0>();
+    const Trace &trace = wrapper.get_aspect<1>();
+    const Hot &hot = wrapper.get_aspect<2>();
+
+    assert(wrapper.invoke(&PointcutService::get, 2) == 2);
+    assert(audit.calls == 1 && trace.calls == 1 && trace.last == 2 && hot.calls == 0);
+
+    auto lambda = [](int x) { return x + 1; };
+    assert(wrapper.invoke(lambda, 2) == 3);
+    assert(audit.calls == 1 && trace.calls == 2 && trace.last == 3 && hot.calls == 0);
+
+    assert(wrapper.invoke(AOP_tag<HotPath>(&PointcutService::get), 3) == 30);
+    assert(audit.calls == 2 && trace.calls == 3 && trace.last == 30 && hot.calls == 1);
+
+    int (*pointer)(int) = [](int x) { return x; };
+    assert(wrapper.invoke(pointer, 4) == 40);
+    assert(audit.calls == 2 && trace.calls == 4 && hot.calls == 2);
+
+    try {
+        wrapper.invoke(AOP_tag<HotPath>(&PointcutService::fail), 1);
+    } catch (runtime_error &) {}
+    try {
+        wrapper.invoke(&PointcutService::fail, 1);
+    } catch (runtime_error &) {}
+    assert(hot.errors == 1 && hot.calls == 3);
+
+    vector<int> input { 1, 2, 3 };
+    vector<int> output(3);
+    wrapper.invoke_batch(pointer, input, output.begin());
+    assert((output == vector<int> { 10, 20, 30 }) && trace.calls == 9 && audit.calls == 4);
+
+    AOP<Audit> only_audit;
+    assert(only_audit.invoke(lambda, 1) == 2 && only_audit.get_aspect<0>().calls == 0);
+    only_audit.invoke_batch(lambda, input, output.begin());
+    assert(output[2] == 4 && only_audit.get_aspect<0>().calls == 0);
+
+    /// 策略在 pointcut 过滤后的 AOP 中被保留，它们不占用下标。
+    AOP<AOP_ResultErrors<>, Audit, Trace> with_policy;
+    assert(with_policy.invoke(lambda, 4) == 5);
+    assert(with_policy.get_aspect<0>().calls == 0 && with_policy.get_aspect<1>().last == 5);
+
+    std::future<int> future = wrapper.invoke_async([] { return std::async(std::launch::deferred, [] { return 6; }); });
+    assert(future.get() == 6);
+    assert(trace.calls == 10 && trace.last == 6 && audit.calls == 4);
+}
+
+/// holder_test 中被包装的对象和特化了 AOP_HolderTraits 的自定义句柄。
+namespace {
+    struct Account {
+        int deposit(int x) { return balance += x; };
+
+        int get() const { return balance; };
+
+        int balance = 0;
+    };
+
+    struct AccountHandle {
+        Account* account;
+    };
+}
+
+template <>
+struct Base::AOP_HolderTraits<AccountHandle> {
+    static constexpr bool is_holder = true;
+
+    using element_type = Account;
+
+    static Account* get(const AccountHandle &handle) noexcept { return handle.account; };
+
+    static bool owns(const AccountHandle &) noexcept { return false; };
+};
+
+/// AOP_Wrapper 以 AOP_Hold 或自定义句柄保存 holder，独占对象时析构前调用 destroy()；其他智能指针仍然按引用包装。
+static void holder_test() {
+    struct Ledger {
+        void before() { ++calls; };
+
+        void destroy() { ++*destroyed; };
+
+        int calls = 0;
+        int* destroyed;
+    };
+
+    static_assert(AOP_HolderTraits<AOP_Hold<Account*>>::is_holder && AOP_HolderTraits<AccountHandle>::is_holder);
+    static_assert(!AOP_HolderTraits<Account*>::is_holder && !AOP_HolderTraits<unique_ptr<Account>>::is_holder);
+    static_assert(is_same_v<AOP_Wrapper<AOP_Hold<unique_ptr<Account>>, Ledger>::ClassPtr, Account*>);
+    static_assert(is_same_v<AOP_Wrapper<unique_ptr<Account>, Ledger>::ClassPtr, unique_ptr<Account>*>);
+    static_assert(!is_constructible_v<AOP_Wrapper<AOP_Hold<unique_ptr<Account>>, Ledger>, unique_ptr<Account>&, Ledger>);
+
+    int destroyed = 0;
+    {
+        AOP_Wrapper<AOP_Hold<unique_ptr<Account>>, Ledger> wrapper { make_unique<Account>(), Ledger { 0, &destroyed } };
+        assert(wrapper.owns_object());
+        assert(wrapper.invoke(&Account::deposit, 5) == 5);
+        assert(AOP_Wrapper_Agent(wrapper, deposit, 2) == 7);
+        const auto &const_wrapper = wrapper;
+        assert(const_wrapper.invoke(&Account::get) == 7 && wrapper.get_aspect<0>().calls == 2);
+
+        AOP_Wrapper<AOP_Hold<unique_ptr<Account>>, Ledger> moved = std::move(wrapper);
+        assert(!wrapper.owns_object() && moved.get_class_ptr()->balance == 7);
+    }
+    assert(destroyed == 1);
+    {
+        /// 转换构造时移动另一个 AOP_Wrapper 的 holder，被移动的 AOP_Wrapper 不再独占对象。
+        AOP_Wrapper<AOP_Hold<shared_ptr<Account>>, Ledger> converted {
+            AOP_Wrapper<AOP_Hold<unique_ptr<Account>>, Ledger> { make_unique<Account>(), Ledger { 0, &destroyed } } };
+        assert(converted.get_holder().use_count() == 1 && converted.invoke(&Account::deposit, 1) == 1);
+    }
+    assert(destroyed == 1);
+
+    /// 共享所有权的 holder 不会被隐式复制，也不会在析构时调用 destroy()。
+    auto shared = make_shared<Account>();
+    {
+        AOP_Wrapper<AOP_Hold<shared_ptr<Account>>, Ledger> first { shared_ptr<Account>(shared), Ledger { 0, &destroyed } };
+        AOP_Wrapper<AOP_Hold<shared_ptr<Account>>, Ledger> second { first };
+        first.invoke(&Account::deposit, 1);
+        second.invoke(&Account::deposit, 1);
+        assert(shared->balance == 2 && shared.use_count() == 3 && !first.owns_object());
+    }
+    assert(destroyed == 1 && shared.use_count() == 1);
+
+    /// 智能指针本身作为 Class 时与原来一样按引用包装，不复制也不接管它。
+    {
+        AOP_Wrapper<shared_ptr<Account>, Ledger> by_reference { shared, Ledger { 0, &destroyed } };
+        assert(by_reference.get_class_ptr() == &shared && shared.use_count() == 1);
+        auto unique = make_unique<Account>();
+        AOP_Wrapper<unique_ptr<Account>, Ledger> unique_reference { unique, Ledger { 0, &destroyed } };
+        assert(unique_reference.get_class_ptr() == &unique && unique);
+        assert(unique_reference.invoke([](unique_ptr<Account>* self) { return (*self)->deposit(3); }) == 3);
+    }
+    assert(destroyed == 1);
+
+    Account account;
+    {
+        Account* raw = &account;
+        AOP_Wrapper<AOP_Hold<Account*>, Ledger> pointer { raw, Ledger { 0, &destroyed } };
+        AOP_Wrapper<AccountHandle, Ledger> handle { AccountHandle { &account }, Ledger { 0, &destroyed } };
+        pointer.invoke(&Account::deposit, 3);
+        handle.invoke(&Account::deposit, 4);
+        assert(handle.get_class_ptr() == &account && account.balance == 7);
+        pointer.reset_holder(nullptr);
+        assert(pointer.get_class_ptr() == nullptr);
+    }
+    assert(destroyed == 1);
+
+    /// 移动赋值替换独占的对象前调用 destroy()，被移动的 AOP_Wrapper 析构时不再调用。
+    {
+        AOP_Wrapper<AOP_Hold<unique_ptr<Account>>, Ledger> target { make_unique<Account>(), Ledger { 0, &destroyed } };
+        target = AOP_Wrapper<AOP_Hold<unique_ptr<Account>>, Ledger> { make_unique<Account>(), Ledger { 0, &destroyed } };
+        assert(destroyed == 2 && target.owns_object());
+        target = std::move(target);
+        assert(destroyed == 2 && target.owns_object());
+    }
+    assert(destroyed == 3);
+}
+
+/// constant_invoke_test 中有重载成员函数的类型。
+namespace {
+    struct Meter {
+        int add(int x) { return value += x; };
+
+        int read(int x) { return value + x; };
+
+        int read(int x) const { return value - x; };
+
+        static int twice(int x) { return 2 * x; };
+
+        int value = 0;
+    };
+}
+
+/// invoke<Fun> 以编译期常量调用函数，Sig 选择重载，AOP_Execution 只匹配指定的函数。
+static void constant_invoke_test() {
+    struct Count {
+        void before() { ++calls; };
+
+        int calls = 0;
+    };
+
+    struct AddOnly {
+        using pointcut = AOP_Execution<&Meter::add>;
+
+        void before() { ++calls; };
+
+        int calls = 0;
+    };
+
+    AOP<Count> aop;
+    Meter meter;
+    assert(aop.invoke<&Meter::add>(meter, 3) == 3);
+    assert(aop.invoke<&Meter::twice>(4) == 8);
+    assert((aop.invoke<int (Meter::*)(int) const, &Meter::read>(std::as_const(meter), 1) == 2));
+    assert(aop.get_aspect<0>().calls == 3);
+
+    AOP_Wrapper<Meter, Count, AddOnly> wrapper { meter };
+    assert(wrapper.invoke<&Meter::add>(2) == 5);
+    assert(wrapper.invoke<&Meter::twice>(5) == 10);
+    assert((wrapper.invoke<int (Meter::*)(int), &Meter::read>(1) == 6));
+    const auto &const_wrapper = wrapper;
+    assert((const_wrapper.invoke<int (Meter::*)(int) const, &Meter::read>(1) == 4));
+    SourceLocation location = CURRENT_FUN_LOCATION;
+    assert(wrapper.invoke_at<&Meter::add>(location, 1) == 6);
+    assert(wrapper.get_aspect<0>().calls == 4 && wrapper.get_aspect<1>().calls == 2);
+
+    AOP_Object<Meter, AddOnly> object;
+    assert(object.invoke<&Meter::add>(7) == 7);
+    assert((object.invoke<int (Meter::*)(int), &Meter::read>(1) == 8));
+    assert(object.invoke(&Meter::add, 1) == 8 && object.get_aspect<0>().calls == 1);
+
+    static_assert(AOP_applies<AddOnly, AOP_Fun<&Meter::add>>());
+    static_assert(!AOP_applies<AddOnly, AOP_Fun<&Meter::twice>>());
+    static_assert(is_same_v<AOP_Callee<AOP_Fun<&Meter::twice>>::type, int (*)(int)>);
+}
+
 void Test::AOP_test() {
     // AOP_Wrapper_test();
     // AOP_Object_test();
     example();
+    hook_order_test();
+    invoke_return_test();
+    member_pointer_test();
+    typed_error_test();
+    error_order_test();
+    result_error_test();
+    advice_args_test();
+    around_test();
+    memoize_test();
+#ifdef AOP_HAS_PERSISTENT_MEMOIZE
+    persistent_memoize_test();
+#endif
+    latency_histogram_test();
+    call_site_test();
+    context_test();
+    switchable_test();
+    sampled_test();
+    async_invoke_test();
+    batch_test();
+    parallel_test();
+    concurrency_test();
+    dynamic_test();
+    pointcut_test();
+    holder_test();
+    constant_invoke_test();
 };
+
+/// 无状态的 aspect 不占用空间。
+namespace {
+    struct Layout {
+        int a[3];
+    };
+
+    template <int I>
+    struct Empty {
+        void before() {};
+    };
+
+    static_assert(sizeof(AOP<Empty<0>, Empty<1>, Empty<2>>) == 1);
+    static_assert(sizeof(AOP_Object<Layout, Empty<0>>) == sizeof(Layout));
+    static_assert(sizeof(AOP_Object<Layout, Empty<0>, Empty<1>, Empty<2>>) == sizeof(Layout));
+    static_assert(sizeof(AOP_Object<Layout, AOP<Empty<0>, Empty<1>>, Empty<2>>) == sizeof(Layout));
+    static_assert(sizeof(AOP_Wrapper<Layout, Empty<0>>) == sizeof(void*));
+    static_assert(sizeof(AOP_Wrapper<Layout, Empty<0>, Empty<1>, Empty<2>>) == sizeof(void*));
+    static_assert(sizeof(AOP<Switchable<Empty<0>, Empty<1>>>) == 1);
+    static_assert(sizeof(AOP<Sampled<Empty<0>, SampleEvery<4>>>) == 1);
+
+    /// AOP_AlignedSlots 时非空的 aspect 各自独占缓存行，空的 aspect 仍然不占用空间。
+    static_assert(sizeof(AOP<AOP_AlignedSlots, Empty<0>, Empty<1>>) == 1);
+    static_assert(alignof(AOP<AOP_AlignedSlots, Layout, Empty<0>, Layout>) == AOP_cache_line);
+    static_assert(sizeof(AOP<AOP_AlignedSlots, Layout, Empty<0>, Layout>) == 2 * AOP_cache_line);
+}
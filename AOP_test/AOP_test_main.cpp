@@ -0,0 +1,12 @@
+//
+// Created by taganyer on 26-10-17.
+//
+
+#include "AOP_test.hpp"
+
+/// ctest 运行的测试程序，测试失败时由 assert 终止。
+int main() {
+    Test::construct_test();
+    Test::AOP_test();
+    return 0;
+}
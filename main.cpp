@@ -2,7 +2,7 @@
 #include "AOP_src/AOP.hpp"
 
 int main() {
-#ifdef AOP_WILL_USE_SOURCE_LOCATION /// 用于获得调用函数名称，可以不使用它（删除位于 AOP.hpp 的该宏）
+#ifdef AOP_WILL_USE_SOURCE_LOCATION /// 用于获得调用函数名称，可以不使用它（只有在编译选项中定义 AOP_LEGACY_THREAD_LOCATION 时才会定义该宏）
     using namespace std;
     using namespace Base;
     class A {